@@ -0,0 +1,626 @@
+#include "Benchmark.h"
+#include "SphereKernels.h"
+#include "CpuRenderer.h"
+#include "Bvh.h"
+#include "Grid.h"
+#include "Instances.h"
+#include "WideBvh.h"
+#include "JobSystem.h"
+#include "SceneFile.h"
+#include "SceneStreamer.h"
+#include "SceneGenerator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Benchmark spheres all keep the default material 0.
+static constexpr size_t BENCHMARK_MATERIALS = 1;
+
+static std::vector<Sphere> random_spheres(uint32_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pos(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> radius(0.2f, 1.5f);
+
+    std::vector<Sphere> spheres(count);
+    for (Sphere& s : spheres) {
+        s.center = {pos(rng), pos(rng), pos(rng)};
+        s.radius = radius(rng);
+    }
+    return spheres;
+}
+
+// One ray against all spheres with each kernel, checking they agree.
+static int benchmark_kernels(uint32_t sphereCount) {
+    std::vector<Sphere> spheres = random_spheres(sphereCount, 1234);
+    SphereSoA soa;
+    soa.build(spheres, BENCHMARK_MATERIALS);
+
+    const uint32_t rayCount = std::max(1u, 200000000u / std::max(sphereCount, 1u));
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> pos(-60.0f, 60.0f);
+    std::vector<Vec3> origins(rayCount), directions(rayCount);
+    for (uint32_t i = 0; i < rayCount; i++) {
+        origins[i] = {pos(rng), pos(rng), pos(rng)};
+        directions[i] = normalize(Vec3{pos(rng), pos(rng), pos(rng)} - origins[i]);
+    }
+
+    std::vector<SphereHit> reference(rayCount);
+    for (uint32_t i = 0; i < rayCount; i++) {
+        reference[i] = intersectSpheres(SimdLevel::Scalar, soa, origins[i], directions[i], 1e30f);
+    }
+
+    std::cout << "Sphere kernels: " << sphereCount << " spheres, " << rayCount << " rays, best level "
+              << simdLevelName(detectSimdLevel()) << std::endl;
+
+    double scalarRate = 0.0;
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Sse, SimdLevel::Avx2}) {
+        if (level > detectSimdLevel()) continue;
+
+        uint32_t mismatches = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < rayCount; i++) {
+            SphereHit hit = intersectSpheres(level, soa, origins[i], directions[i], 1e30f);
+            if (hit.lane != reference[i].lane) mismatches++;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double rate = static_cast<double>(rayCount) * sphereCount / seconds;
+        if (level == SimdLevel::Scalar) scalarRate = rate;
+
+        std::cout << "  " << simdLevelName(level) << ": " << rate / 1e6 << " M ray-sphere tests/s ("
+                  << rate / scalarRate << "x scalar)";
+        if (mismatches > 0) std::cout << ", " << mismatches << " hits differ from scalar";
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// Full CPU frames with and without primary-ray packets, on the default scene
+// and on a field of random spheres in front of the default camera.
+static int benchmark_packets(uint32_t sphereCount) {
+    const uint32_t width = 640, height = 480;
+    Camera camera;
+    CpuRenderer renderer;
+
+    Scene field;
+    field.spheres = random_spheres(sphereCount, 1234);
+    for (Sphere& s : field.spheres) {
+        s.center = {s.center.x, s.center.y * 0.2f + 8.0f, s.center.z - 60.0f};
+    }
+    field.spheres.push_back(Scene().spheres.back()); // Floor
+
+    std::cout << "Packet tracing: " << width << "x" << height << " on " << renderer.threadCount() << " threads" << std::endl;
+
+    const std::pair<const char*, const Scene*> scenes[] = {{"default scene", nullptr}, {"random spheres", &field}};
+    Scene defaultScene;
+    for (const auto& [label, scenePtr] : scenes) {
+        const Scene& scene = scenePtr ? *scenePtr : defaultScene;
+        std::vector<uint32_t> single, packets;
+
+        renderer.setPacketTracing(false);
+        CpuRenderStats singleStats = renderer.render(camera, scene, width, height, single);
+        renderer.setPacketTracing(true);
+        CpuRenderStats packetStats = renderer.render(camera, scene, width, height, packets);
+
+        std::cout << "  " << label << " (" << scene.spheres.size() << " spheres): single "
+                  << singleStats.raysPerSecond() / 1e6 << " Mrays/s, packets " << packetStats.raysPerSecond() / 1e6
+                  << " Mrays/s (" << packetStats.raysPerSecond() / singleStats.raysPerSecond() << "x)";
+        if (single != packets) std::cout << ", images differ";
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// Animates every sphere (and then 1% of them) for a number of frames and
+// times BVH updates, refitting until the quality threshold asks for a rebuild.
+static int benchmark_refit(uint32_t sphereCount) {
+    const uint32_t frames = 200;
+    std::vector<Sphere> spheres = random_spheres(sphereCount, 1234);
+    std::vector<Vec3> velocity(sphereCount);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> speed(-0.05f, 0.05f);
+    for (Vec3& v : velocity) v = {speed(rng), speed(rng), speed(rng)};
+
+    Bvh bvh;
+    auto start = std::chrono::high_resolution_clock::now();
+    bvh.build(spheres);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::cout << "BVH refit: " << sphereCount << " spheres, " << bvh.nodes.size() << " nodes, build " << buildMs << " ms"
+              << std::endl;
+
+    for (uint32_t percent : {100u, 1u}) {
+        std::vector<uint32_t> dirty;
+        for (uint32_t i = 0; i < sphereCount; i += 100 / percent) dirty.push_back(i);
+
+        double totalMs = 0.0, maxMs = 0.0;
+        uint32_t rebuilds = 0;
+        uint64_t uploadedNodes = 0, uploadRuns = 0;
+        for (uint32_t frame = 0; frame < frames; frame++) {
+            for (uint32_t i : dirty) spheres[i].center = spheres[i].center + velocity[i];
+
+            start = std::chrono::high_resolution_clock::now();
+            BvhDirtyNodes changed;
+            bvh.refit(spheres, dirty, changed);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            totalMs += ms;
+            maxMs = std::max(maxMs, ms);
+            changed.forEachRun(static_cast<uint32_t>(bvh.nodes.size()), [&](uint32_t, uint32_t count) {
+                uploadedNodes += count;
+                uploadRuns++;
+            });
+
+            if (bvh.needsRebuild()) {
+                bvh.build(spheres);
+                rebuilds++;
+            }
+        }
+
+        std::cout << "  " << percent << "% dirty: refit avg " << totalMs / frames << " ms, max " << maxMs
+                  << " ms, avg upload " << uploadedNodes / frames << " nodes (" << uploadedNodes * sizeof(BvhNode) / frames / 1024
+                  << " KiB in " << uploadRuns / frames << " copies), " << rebuilds << " rebuilds in "
+                  << frames << " frames, SAH cost " << bvh.sahCost() << std::endl;
+    }
+    return 0;
+}
+
+// Build time and tree quality of each BVH builder, plus closest-hit
+// throughput through the resulting trees.
+static int benchmark_build(uint32_t sphereCount) {
+    std::vector<Sphere> spheres = random_spheres(sphereCount, 1234);
+    JobSystem jobs;
+
+    const uint32_t rayCount = 200000;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> pos(-60.0f, 60.0f);
+    std::vector<Vec3> origins(rayCount), directions(rayCount);
+    for (uint32_t i = 0; i < rayCount; i++) {
+        origins[i] = {pos(rng), pos(rng), pos(rng)};
+        directions[i] = normalize(Vec3{pos(rng), pos(rng), pos(rng)} - origins[i]);
+    }
+
+    std::cout << "BVH build: " << sphereCount << " spheres, " << jobs.threadCount() << " threads" << std::endl;
+
+    std::vector<float> reference;
+    for (BvhBuildMethod method : {BvhBuildMethod::Sah, BvhBuildMethod::Lbvh}) {
+        Bvh bvh;
+        double bestMs = 1e30;
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            bvh.build(spheres, method, &jobs);
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+
+        SphereSoA soa;
+        soa.build(spheres, bvh.primIndices, BENCHMARK_MATERIALS);
+        std::vector<float> hits(rayCount);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < rayCount; i++) {
+            SphereHit hit = bvh.intersect(soa, origins[i], directions[i], 1e30f);
+            hits[i] = hit.lane >= 0 ? hit.t : -1.0f;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        uint32_t mismatches = 0;
+        if (reference.empty()) reference = hits;
+        for (uint32_t i = 0; i < rayCount; i++) mismatches += hits[i] != reference[i];
+
+        std::cout << "  " << bvhBuildMethodName(method) << ": build " << bestMs << " ms, " << bvh.nodes.size()
+                  << " nodes, SAH cost " << bvh.sahCost() << ", " << rayCount / seconds / 1e6 << " Mrays/s";
+        if (mismatches > 0) std::cout << ", " << mismatches << " hits differ from SAH";
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// Grid against LBVH on a dense particle field of similar-sized spheres:
+// build time, memory and closest-hit throughput, plus the automatic choice.
+static int benchmark_grid(uint32_t sphereCount) {
+    // About one sphere per 2x2x2 units, radii 0.3 to 0.6
+    float half = std::cbrt(static_cast<float>(sphereCount)) + 1.0f;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(-half, half);
+    std::uniform_real_distribution<float> radius(0.3f, 0.6f);
+    std::vector<Sphere> spheres(sphereCount);
+    for (Sphere& s : spheres) {
+        s.center = {pos(rng), pos(rng), pos(rng)};
+        s.radius = radius(rng);
+    }
+    JobSystem jobs;
+
+    const uint32_t rayCount = 200000;
+    std::uniform_real_distribution<float> outside(-2.0f * half, 2.0f * half);
+    std::vector<Vec3> origins(rayCount), directions(rayCount);
+    for (uint32_t i = 0; i < rayCount; i++) {
+        origins[i] = {outside(rng), outside(rng), outside(rng)};
+        directions[i] = normalize(Vec3{pos(rng), pos(rng), pos(rng)} - origins[i]);
+    }
+
+    std::cout << "Grid vs BVH: " << sphereCount << " spheres, " << jobs.threadCount() << " threads, auto picks "
+              << accelStructureName(SphereGrid::choose(spheres)) << std::endl;
+
+    auto time = [](auto&& fn) {
+        double bestMs = 1e30;
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            fn();
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+        return bestMs;
+    };
+    auto trace = [&](auto&& intersect, std::vector<float>& hits) {
+        hits.resize(rayCount);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < rayCount; i++) {
+            SphereHit hit = intersect(origins[i], directions[i]);
+            hits[i] = hit.lane >= 0 ? hit.t : -1.0f;
+        }
+        return rayCount / std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    Bvh bvh;
+    double bvhMs = time([&] { bvh.build(spheres, BvhBuildMethod::Lbvh, &jobs); });
+    SphereSoA bvhSoa;
+    bvhSoa.build(spheres, bvh.primIndices, BENCHMARK_MATERIALS);
+    std::vector<float> reference;
+    double bvhRate = trace([&](Vec3 o, Vec3 d) { return bvh.intersect(bvhSoa, o, d, 1e30f); }, reference);
+    std::cout << "  LBVH: build " << bvhMs << " ms, " << bvh.nodes.size() * sizeof(BvhNode) / 1024 << " KiB, "
+              << bvhRate / 1e6 << " Mrays/s" << std::endl;
+
+    SphereGrid grid;
+    double gridMs = time([&] { grid.build(spheres, &jobs); });
+    SphereSoA gridSoa;
+    gridSoa.build(spheres, BENCHMARK_MATERIALS);
+    std::vector<float> hits;
+    double gridRate = trace([&](Vec3 o, Vec3 d) { return grid.intersect(gridSoa, o, d, 1e30f); }, hits);
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < rayCount; i++) mismatches += hits[i] != reference[i];
+
+    std::cout << "  Grid: build " << gridMs << " ms, " << grid.dims[0] << "x" << grid.dims[1] << "x" << grid.dims[2]
+              << " cells, " << static_cast<double>(grid.cellSpheres.size()) / sphereCount << " cells per sphere, "
+              << (grid.cellStart.size() + grid.cellSpheres.size()) * sizeof(uint32_t) / 1024 << " KiB, "
+              << gridRate / 1e6 << " Mrays/s";
+    if (mismatches > 0) std::cout << ", " << mismatches << " hits differ from LBVH";
+    std::cout << std::endl;
+    return 0;
+}
+
+// Instanced clusters through the two-level BVH against the same spheres
+// flattened into one BVH: memory, build time, the cost of moving 1% of the
+// instances, and closest-hit throughput.
+static int benchmark_instances(uint32_t sphereCount) {
+    const uint32_t clusterSize = 64;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> local(-2.0f, 2.0f);
+
+    Scene scene;
+    scene.spheres.clear();
+    scene.clusters.resize(1);
+    for (uint32_t i = 0; i < clusterSize; i++) {
+        scene.clusters[0].spheres.push_back({{local(rng), local(rng), local(rng)}, 0.3f + 0.3f * unit(rng)});
+    }
+
+    uint32_t instanceCount = std::max(1u, sphereCount / clusterSize);
+    float half = 4.0f * std::cbrt(static_cast<float>(instanceCount));
+    std::uniform_real_distribution<float> pos(-half, half);
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        ClusterInstance instance;
+        instance.position = {pos(rng), pos(rng), pos(rng)};
+        instance.scale = 0.5f + unit(rng);
+        instance.setRotation(normalize(Vec3{local(rng), local(rng), local(rng)}), 6.2831853f * unit(rng));
+        scene.instances.push_back(instance);
+    }
+
+    auto flatten = [&](std::vector<Sphere>& out) {
+        out.clear();
+        for (const ClusterInstance& instance : scene.instances) {
+            for (Sphere s : scene.clusters[instance.cluster].spheres) {
+                s.center = instance.toWorld(s.center);
+                s.radius *= instance.scale;
+                out.push_back(s);
+            }
+        }
+    };
+    auto elapsedMs = [](auto start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    const uint32_t rayCount = 200000;
+    std::uniform_real_distribution<float> outside(-1.5f * half, 1.5f * half);
+    std::vector<Vec3> origins(rayCount), directions(rayCount);
+    for (uint32_t i = 0; i < rayCount; i++) {
+        origins[i] = {outside(rng), outside(rng), outside(rng)};
+        directions[i] = normalize(Vec3{pos(rng), pos(rng), pos(rng)} - origins[i]);
+    }
+
+    std::cout << "Instancing: " << instanceCount << " instances of a " << clusterSize << "-sphere cluster ("
+              << instanceCount * clusterSize << " spheres)" << std::endl;
+
+    // Flattened
+    std::vector<Sphere> flat;
+    flatten(flat);
+    Bvh bvh;
+    auto start = std::chrono::high_resolution_clock::now();
+    bvh.build(flat);
+    double flatBuildMs = elapsedMs(start);
+    SphereSoA soa;
+    soa.build(flat, bvh.primIndices, BENCHMARK_MATERIALS);
+
+    // Two-level
+    TwoLevelBvh twoLevel;
+    start = std::chrono::high_resolution_clock::now();
+    twoLevel.build(scene);
+    double twoLevelBuildMs = elapsedMs(start);
+
+    // Move 1% of the instances: the flat BVH refits all of their spheres,
+    // the two-level BVH only their top-level leaves.
+    std::vector<uint32_t> movedInstances, movedSpheres;
+    for (uint32_t i = 0; i < instanceCount; i += 100) {
+        movedInstances.push_back(i);
+        scene.instances[i].position = scene.instances[i].position + Vec3{0.1f, 0.0f, 0.0f};
+        for (uint32_t s = 0; s < clusterSize; s++) movedSpheres.push_back(i * clusterSize + s);
+    }
+    flatten(flat);
+    start = std::chrono::high_resolution_clock::now();
+    BvhDirtyNodes flatChanged;
+    bvh.refit(flat, movedSpheres, flatChanged);
+    double flatMoveMs = elapsedMs(start);
+    soa.build(flat, bvh.primIndices, BENCHMARK_MATERIALS);
+
+    start = std::chrono::high_resolution_clock::now();
+    BvhDirtyNodes topChanged;
+    twoLevel.update(scene, movedInstances, topChanged);
+    double twoLevelMoveMs = elapsedMs(start);
+
+    std::vector<float> reference(rayCount);
+    start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < rayCount; i++) {
+        SphereHit hit = bvh.intersect(soa, origins[i], directions[i], 1e30f);
+        reference[i] = hit.lane >= 0 ? hit.t : -1.0f;
+    }
+    double flatRate = rayCount / (elapsedMs(start) / 1000.0);
+
+    uint32_t mismatches = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < rayCount; i++) {
+        InstanceHit hit = twoLevel.intersect(scene, origins[i], directions[i], 1e30f);
+        float t = hit.instance >= 0 ? hit.t : -1.0f;
+        // Local space intersection rounds differently: b * b - c cancels on
+        // grazing rays, which can flip a hit to a neighbouring sphere.
+        mismatches += std::abs(t - reference[i]) > 1e-3f * std::max(1.0f, std::abs(reference[i]));
+    }
+    double twoLevelRate = rayCount / (elapsedMs(start) / 1000.0);
+
+    std::cout << "  flat BVH: " << (bvh.nodes.size() * sizeof(BvhNode) + soa.paddedCount() * 20) / 1024 << " KiB, build "
+              << flatBuildMs << " ms, move 1% " << flatMoveMs << " ms, " << flatRate / 1e6 << " Mrays/s" << std::endl;
+    std::cout << "  two-level: " << twoLevel.memoryBytes() / 1024 << " KiB, build " << twoLevelBuildMs << " ms, move 1% "
+              << twoLevelMoveMs << " ms, " << twoLevelRate / 1e6 << " Mrays/s";
+    if (mismatches > 0) std::cout << ", " << mismatches << " grazing hits differ from flat";
+    std::cout << std::endl;
+    return 0;
+}
+
+// Quantized four-wide nodes against the binary BVH they are collapsed from:
+// node bytes, collapse time and closest-hit throughput on the same rays.
+static int benchmark_wide(uint32_t sphereCount) {
+    std::vector<Sphere> spheres = random_spheres(sphereCount, 1234);
+
+    const uint32_t rayCount = 200000;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> pos(-60.0f, 60.0f);
+    std::vector<Vec3> origins(rayCount), directions(rayCount);
+    for (uint32_t i = 0; i < rayCount; i++) {
+        origins[i] = {pos(rng), pos(rng), pos(rng)};
+        directions[i] = normalize(Vec3{pos(rng), pos(rng), pos(rng)} - origins[i]);
+    }
+
+    Bvh bvh;
+    bvh.build(spheres);
+    SphereSoA soa;
+    soa.build(spheres, bvh.primIndices, BENCHMARK_MATERIALS);
+
+    WideBvh wide;
+    double collapseMs = 1e30;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        wide.build(bvh);
+        collapseMs = std::min(collapseMs, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+
+    std::cout << "Wide BVH: " << sphereCount << " spheres" << std::endl;
+
+    // Best of three runs each
+    std::vector<float> reference(rayCount), hits(rayCount);
+    double binarySeconds = 1e30, wideSeconds = 1e30;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < rayCount; i++) {
+            SphereHit hit = bvh.intersect(soa, origins[i], directions[i], 1e30f);
+            reference[i] = hit.lane >= 0 ? hit.t : -1.0f;
+        }
+        binarySeconds = std::min(binarySeconds, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+
+        start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < rayCount; i++) {
+            SphereHit hit = wide.intersect(soa, origins[i], directions[i], 1e30f);
+            hits[i] = hit.lane >= 0 ? hit.t : -1.0f;
+        }
+        wideSeconds = std::min(wideSeconds, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < rayCount; i++) mismatches += hits[i] != reference[i];
+
+    std::cout << "  binary: " << bvh.nodes.size() << " nodes, " << bvh.nodes.size() * sizeof(BvhNode) / 1024 << " KiB, "
+              << rayCount / binarySeconds / 1e6 << " Mrays/s" << std::endl;
+    std::cout << "  wide:   " << wide.nodes.size() << " nodes, " << wide.nodes.size() * sizeof(WideBvhNode) / 1024 << " KiB, collapse "
+              << collapseMs << " ms, " << rayCount / wideSeconds / 1e6 << " Mrays/s";
+    if (mismatches > 0) std::cout << ", " << mismatches << " hits differ from binary";
+    std::cout << std::endl;
+    return 0;
+}
+
+// Round trip through a scene file with a prebuilt BVH, against building
+// the BVH after loading.
+static int benchmark_scenefile(uint32_t sphereCount) {
+    Scene scene;
+    scene.spheres = random_spheres(sphereCount, 1234);
+    JobSystem jobs;
+    Bvh bvh;
+    bvh.build(scene.spheres, BvhBuildMethod::Lbvh, &jobs);
+
+    std::string path = (std::filesystem::temp_directory_path() / "raygame_bench.scene").string();
+    auto start = std::chrono::high_resolution_clock::now();
+    if (!SceneFile::write(path, scene, &bvh)) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return -1;
+    }
+    double writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    // Best of three runs each
+    double loadMs = 1e30, adoptMs = 1e30, buildMs = 1e30;
+    Bvh loaded;
+    for (int run = 0; run < 3; run++) {
+        Scene target;
+        start = std::chrono::high_resolution_clock::now();
+        if (!loadScene(path, target)) return -1;
+        auto loadEnd = std::chrono::high_resolution_clock::now();
+        if (!loadSourceBvh(target, target.spheres.size(), loaded)) {
+            std::cerr << "Prebuilt BVH was rejected" << std::endl;
+            return -1;
+        }
+        auto adoptEnd = std::chrono::high_resolution_clock::now();
+        Bvh rebuilt;
+        rebuilt.build(target.spheres, BvhBuildMethod::Lbvh, &jobs);
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+        loadMs = std::min(loadMs, std::chrono::duration<double, std::milli>(loadEnd - start).count());
+        adoptMs = std::min(adoptMs, std::chrono::duration<double, std::milli>(adoptEnd - loadEnd).count());
+        buildMs = std::min(buildMs, std::chrono::duration<double, std::milli>(buildEnd - adoptEnd).count());
+    }
+    uintmax_t bytes = std::filesystem::file_size(path);
+    std::filesystem::remove(path);
+
+    // A valid root leaf over four spheres followed by unreachable leaves
+    // pointing far past primIndices must be rejected.
+    std::vector<BvhNode> unreachable(7);
+    unreachable[0] = {{-1, -1, -1}, Bvh::LEAF_BIT, {1, 1, 1}, 4};
+    for (size_t i = 1; i < unreachable.size(); i++) unreachable[i] = {{-1, -1, -1}, Bvh::LEAF_BIT | 0x7ffffff0u, {1, 1, 1}, 4};
+    std::vector<uint32_t> unreachableIndices = {0, 1, 2, 3};
+    Bvh garbage;
+    if (garbage.adopt(unreachable, unreachableIndices, unreachableIndices.size())) {
+        std::cerr << "BVH with unreachable nodes was adopted" << std::endl;
+        return -1;
+    }
+
+    bool same = loaded.primIndices == bvh.primIndices && loaded.nodes.size() == bvh.nodes.size() && loaded.sahCost() == bvh.sahCost();
+    std::cout << "Scene file: " << sphereCount << " spheres, " << bytes / 1024 << " KiB, write " << writeMs << " ms" << std::endl;
+    std::cout << "  load " << loadMs << " ms, prebuilt BVH " << adoptMs << " ms (LBVH build " << buildMs << " ms)";
+    if (!same) std::cout << ", loaded BVH differs from the one written";
+    std::cout << std::endl;
+    return 0;
+}
+
+// Camera walk through a chunked scene file streamed under a quarter of the
+// memory it needs, then the whole file loaded under an unlimited budget.
+static int benchmark_streaming(uint32_t sphereCount) {
+    Scene source;
+    source.spheres = random_spheres(sphereCount, 1234);
+    std::string path = (std::filesystem::temp_directory_path() / "raygame_bench_chunked.scene").string();
+    if (!SceneFile::writeChunked(path, source, 20.0f)) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return -1;
+    }
+
+    size_t budget = size_t(sphereCount) * SceneStreamer::BYTES_PER_SPHERE / 4;
+    Scene scene;
+    SceneStreamer streamer;
+    if (!streamer.open(path, budget, scene)) return -1;
+    TwoLevelBvh instances;
+    instances.build(scene);
+
+    const int steps = 50;
+    double streamMs = 0.0, rebuildMs = 0.0;
+    size_t peakBytes = 0, swaps = 0;
+    for (int step = 0; step <= steps; step++) {
+        Vec3 eye = {-60.0f + 120.0f * step / steps, 0.0f, 0.0f};
+        auto start = std::chrono::high_resolution_clock::now();
+        streamer.finish(eye, scene);
+        auto streamEnd = std::chrono::high_resolution_clock::now();
+        instances.rebuildClusters(scene, scene.dirtyClusters);
+        auto rebuildEnd = std::chrono::high_resolution_clock::now();
+        swaps += scene.dirtyClusters.size();
+        scene.dirtyClusters.clear();
+        streamMs += std::chrono::duration<double, std::milli>(streamEnd - start).count();
+        rebuildMs += std::chrono::duration<double, std::milli>(rebuildEnd - streamEnd).count();
+        peakBytes = std::max(peakBytes, streamer.loadedBytes());
+    }
+
+    SceneStreamer everything;
+    Scene whole;
+    if (!everything.open(path, size_t(sphereCount) * SceneStreamer::BYTES_PER_SPHERE, whole)) return -1;
+    everything.finish({0.0f, 0.0f, 0.0f}, whole);
+    size_t loadedSpheres = 0;
+    for (const SphereCluster& cluster : whole.clusters) loadedSpheres += cluster.spheres.size();
+    std::filesystem::remove(path);
+
+    std::cout << "Streaming: " << sphereCount << " spheres in " << streamer.chunkCount() << " chunks, budget "
+              << budget / 1024 << " KiB, peak " << peakBytes / 1024 << " KiB" << std::endl;
+    std::cout << "  per step: stream " << streamMs / (steps + 1) << " ms, cluster rebuild " << rebuildMs / (steps + 1)
+              << " ms, " << double(swaps) / (steps + 1) << " chunks swapped";
+    if (peakBytes > budget) std::cout << ", budget exceeded";
+    if (loadedSpheres != sphereCount) std::cout << ", full load has " << loadedSpheres << " spheres";
+    std::cout << std::endl;
+    return 0;
+}
+
+// Each distribution generated on the job system and on one thread, which
+// must give the same spheres.
+static int benchmark_generate(uint32_t sphereCount) {
+    JobSystem jobs;
+    std::cout << "Generate: " << sphereCount << " spheres, " << jobs.threadCount() << " threads" << std::endl;
+    for (SphereDistribution distribution : {SphereDistribution::Uniform, SphereDistribution::Clustered, SphereDistribution::Grid, SphereDistribution::PoissonDisk}) {
+        SceneGeneratorSettings settings;
+        settings.sphereCount = sphereCount;
+        settings.distribution = distribution;
+        Scene parallel, serial;
+        auto start = std::chrono::high_resolution_clock::now();
+        generateScene(settings, parallel, &jobs);
+        auto parallelEnd = std::chrono::high_resolution_clock::now();
+        generateScene(settings, serial, nullptr);
+        auto serialEnd = std::chrono::high_resolution_clock::now();
+
+        bool same = parallel.spheres.size() == serial.spheres.size();
+        for (size_t i = 0; same && i < parallel.spheres.size(); i++) {
+            const Sphere& a = parallel.spheres[i];
+            const Sphere& b = serial.spheres[i];
+            same = a.center.x == b.center.x && a.center.y == b.center.y && a.center.z == b.center.z && a.radius == b.radius && a.material == b.material;
+        }
+        std::cout << "  " << sphereDistributionName(distribution) << ": " << std::chrono::duration<double, std::milli>(parallelEnd - start).count()
+                  << " ms (one thread " << std::chrono::duration<double, std::milli>(serialEnd - parallelEnd).count() << " ms)";
+        if (!same) std::cout << ", differs on one thread";
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+int run_benchmark(const std::string& name, uint32_t sphereCount) {
+    if (name == "kernels") return benchmark_kernels(sphereCount);
+    if (name == "packets") return benchmark_packets(sphereCount);
+    if (name == "refit") return benchmark_refit(sphereCount);
+    if (name == "build") return benchmark_build(sphereCount);
+    if (name == "grid") return benchmark_grid(sphereCount);
+    if (name == "instances") return benchmark_instances(sphereCount);
+    if (name == "wide") return benchmark_wide(sphereCount);
+    if (name == "scenefile") return benchmark_scenefile(sphereCount);
+    if (name == "streaming") return benchmark_streaming(sphereCount);
+    if (name == "generate") return benchmark_generate(sphereCount);
+
+    std::cerr << "Unknown benchmark: " << name << " (available: kernels, packets, refit, build, grid, instances, wide, scenefile, streaming, generate)" << std::endl;
+    return -1;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Microbenchmarks for the CPU tracing paths, run with `RayGame --bench <name>`.
+// Each one prints its results to stdout and returns 0 on success.
+int run_benchmark(const std::string& name, uint32_t sphereCount);
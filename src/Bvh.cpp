@@ -0,0 +1,596 @@
+#include "Bvh.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <utility>
+
+struct Aabb {
+    Vec3 min = {1e30f, 1e30f, 1e30f};
+    Vec3 max = {-1e30f, -1e30f, -1e30f};
+
+    void grow(Vec3 p) {
+        min = {std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+        max = {std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+    }
+    void grow(const Aabb& other) {
+        // Componentwise, so growing by an empty box is a no-op.
+        min = {std::min(min.x, other.min.x), std::min(min.y, other.min.y), std::min(min.z, other.min.z)};
+        max = {std::max(max.x, other.max.x), std::max(max.y, other.max.y), std::max(max.z, other.max.z)};
+    }
+    float area() const {
+        Vec3 e = max - min;
+        if (e.x < 0.0f) return 0.0f;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+static float axisOf(Vec3 v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Depth after which nodes are split at the median, which bounds the tree
+// depth (and so the traversal stack) even for degenerate SAH splits.
+static constexpr uint32_t MEDIAN_SPLIT_DEPTH = 32;
+
+// Cost of visiting a node relative to one sphere test.
+static constexpr float SAH_TRAVERSAL_COST = 2.0f;
+
+// Relative costs used for the SAH quality estimate.
+static float nodeArea(const BvhNode& node) {
+    float ex = node.boundsMax[0] - node.boundsMin[0];
+    float ey = node.boundsMax[1] - node.boundsMin[1];
+    float ez = node.boundsMax[2] - node.boundsMin[2];
+    if (ex < 0.0f) return 0.0f;
+    return 2.0f * (ex * ey + ey * ez + ez * ex);
+}
+
+static float nodeWeight(const BvhNode& node) {
+    return Bvh::isLeaf(node) ? static_cast<float>(node.right) : 1.0f;
+}
+
+static void computeBounds(const Bvh& bvh, const BvhNode& node, std::span<const Sphere> spheres, float* bmin, float* bmax);
+
+void Bvh::clear() {
+    nodes.clear();
+    primIndices.clear();
+    parents.clear();
+    sphereLeaf.clear();
+    costSum = 0.0;
+    builtSahCost = 0.0f;
+}
+
+const char* bvhBuildMethodName(BvhBuildMethod method) {
+    switch (method) {
+        case BvhBuildMethod::Sah: return "SAH";
+        case BvhBuildMethod::Lbvh: return "LBVH";
+    }
+    return "unknown";
+}
+
+void Bvh::build(std::span<const Sphere> spheres, BvhBuildMethod method, JobSystem* jobs) {
+    clear();
+    if (spheres.empty()) return;
+
+    if (method == BvhBuildMethod::Lbvh) {
+        buildLbvh(spheres, jobs);
+    } else {
+        buildSah(spheres);
+        costSum = 0.0;
+        for (const BvhNode& node : nodes) costSum += static_cast<double>(nodeArea(node)) * nodeWeight(node);
+    }
+    builtSahCost = sahCost();
+}
+
+bool Bvh::adopt(std::span<const BvhNode> prebuiltNodes, std::span<const uint32_t> prebuiltIndices, size_t sphereCount) {
+    clear();
+    uint32_t count = static_cast<uint32_t>(prebuiltIndices.size());
+    if (count == 0 || count != sphereCount || prebuiltNodes.empty() || prebuiltNodes.size() > 2 * size_t(count) - 1) return false;
+    nodes.assign(prebuiltNodes.begin(), prebuiltNodes.end());
+    primIndices.assign(prebuiltIndices.begin(), prebuiltIndices.end());
+    parents.assign(nodes.size(), NO_PARENT);
+    sphereLeaf.assign(count, NO_PARENT);
+    parentsBeforeChildren = true;
+
+    // Every node must be reached exactly once from the root and every
+    // sphere must sit in exactly one leaf. Leaves must be no larger than
+    // build() makes them and the tree no deeper than the traversal stacks.
+    uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+    uint32_t leafSpheres = 0, visited = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 1}}; // Node, depth
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        visited++;
+        const BvhNode& node = nodes[index];
+        if (depth > STACK_SIZE) { clear(); return false; }
+        if (isLeaf(node)) {
+            uint32_t first = node.left & ~LEAF_BIT;
+            if (node.right == 0 || node.right > MAX_LEAF_SIZE || first > count || node.right > count - first) { clear(); return false; }
+            for (uint32_t i = first; i < first + node.right; i++) {
+                uint32_t sphere = primIndices[i];
+                if (sphere >= count || sphereLeaf[sphere] != NO_PARENT) { clear(); return false; }
+                sphereLeaf[sphere] = index;
+            }
+            leafSpheres += node.right;
+            continue;
+        }
+        for (uint32_t child : {node.left, node.right}) {
+            if (child == 0 || child >= nodeCount || parents[child] != NO_PARENT) { clear(); return false; }
+            parents[child] = index;
+            if (child < index) parentsBeforeChildren = false;
+            stack.push_back({child, depth + 1});
+        }
+    }
+    // Unreachable nodes would still be swept by the refits.
+    if (leafSpheres != count || visited != nodeCount) { clear(); return false; }
+
+    costSum = 0.0;
+    for (const BvhNode& node : nodes) costSum += static_cast<double>(nodeArea(node)) * nodeWeight(node);
+    builtSahCost = sahCost();
+    return true;
+}
+
+void Bvh::buildSah(std::span<const Sphere> spheres) {
+    uint32_t count = static_cast<uint32_t>(spheres.size());
+    parentsBeforeChildren = true;
+
+    std::vector<Aabb> bounds(count);
+    primIndices.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        Vec3 r = {spheres[i].radius, spheres[i].radius, spheres[i].radius};
+        bounds[i].min = spheres[i].center - r;
+        bounds[i].max = spheres[i].center + r;
+        primIndices[i] = i;
+    }
+
+    struct BuildTask {
+        uint32_t node;
+        uint32_t first;
+        uint32_t count;
+        uint32_t depth;
+    };
+
+    nodes.reserve(2 * count - 1);
+    parents.reserve(2 * count - 1);
+    sphereLeaf.resize(count);
+    nodes.push_back({});
+    parents.push_back(NO_PARENT);
+    std::vector<BuildTask> stack;
+    stack.push_back({0, 0, count, 0});
+
+    while (!stack.empty()) {
+        BuildTask task = stack.back();
+        stack.pop_back();
+
+        Aabb nodeBounds, centroidBounds;
+        for (uint32_t i = task.first; i < task.first + task.count; i++) {
+            nodeBounds.grow(bounds[primIndices[i]]);
+            centroidBounds.grow(spheres[primIndices[i]].center);
+        }
+
+        BvhNode& node = nodes[task.node];
+        node.boundsMin[0] = nodeBounds.min.x; node.boundsMin[1] = nodeBounds.min.y; node.boundsMin[2] = nodeBounds.min.z;
+        node.boundsMax[0] = nodeBounds.max.x; node.boundsMax[1] = nodeBounds.max.y; node.boundsMax[2] = nodeBounds.max.z;
+
+        auto makeLeaf = [&] {
+            nodes[task.node].left = LEAF_BIT | task.first;
+            nodes[task.node].right = task.count;
+            for (uint32_t i = task.first; i < task.first + task.count; i++) sphereLeaf[primIndices[i]] = task.node;
+        };
+
+        if (task.count <= 1) { makeLeaf(); continue; }
+
+        // Find the cheapest binned SAH split over all three axes.
+        int bestAxis = -1;
+        uint32_t bestSplit = 0;
+        float bestCost = 1e30f;
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = axisOf(centroidBounds.min, axis);
+            float extent = axisOf(centroidBounds.max, axis) - lo;
+            if (extent <= 0.0f) continue;
+            float scale = SAH_BINS / extent;
+
+            Aabb binBounds[SAH_BINS];
+            uint32_t binCounts[SAH_BINS] = {};
+            for (uint32_t i = task.first; i < task.first + task.count; i++) {
+                uint32_t p = primIndices[i];
+                uint32_t bin = std::min(SAH_BINS - 1, static_cast<uint32_t>((axisOf(spheres[p].center, axis) - lo) * scale));
+                binBounds[bin].grow(bounds[p]);
+                binCounts[bin]++;
+            }
+
+            // Sweep from the right to get the cost of every split plane.
+            float rightArea[SAH_BINS - 1];
+            uint32_t rightCount[SAH_BINS - 1];
+            Aabb acc;
+            uint32_t n = 0;
+            for (uint32_t b = SAH_BINS - 1; b > 0; b--) {
+                acc.grow(binBounds[b]);
+                n += binCounts[b];
+                rightArea[b - 1] = acc.area();
+                rightCount[b - 1] = n;
+            }
+            acc = Aabb();
+            n = 0;
+            for (uint32_t b = 0; b < SAH_BINS - 1; b++) {
+                acc.grow(binBounds[b]);
+                n += binCounts[b];
+                float cost = acc.area() * n + rightArea[b] * rightCount[b];
+                if (n > 0 && rightCount[b] > 0 && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        // Splitting pays for one more node visit on top of the children.
+        float leafCost = nodeBounds.area() * task.count;
+        float splitCost = bestCost + nodeBounds.area() * SAH_TRAVERSAL_COST;
+        if (task.count <= MAX_LEAF_SIZE && (bestAxis < 0 || splitCost >= leafCost)) { makeLeaf(); continue; }
+
+        uint32_t* begin = primIndices.data() + task.first;
+        uint32_t* end = begin + task.count;
+        uint32_t* mid = nullptr;
+        if (bestAxis >= 0 && task.depth < MEDIAN_SPLIT_DEPTH) {
+            float lo = axisOf(centroidBounds.min, bestAxis);
+            float scale = SAH_BINS / (axisOf(centroidBounds.max, bestAxis) - lo);
+            mid = std::partition(begin, end, [&](uint32_t p) {
+                uint32_t bin = std::min(SAH_BINS - 1, static_cast<uint32_t>((axisOf(spheres[p].center, bestAxis) - lo) * scale));
+                return bin <= bestSplit;
+            });
+        } else {
+            // Coincident centers or a very deep branch: split at the median
+            // of the widest centroid axis.
+            Vec3 e = centroidBounds.max - centroidBounds.min;
+            int axis = (e.x >= e.y && e.x >= e.z) ? 0 : (e.y >= e.z ? 1 : 2);
+            mid = begin + task.count / 2;
+            std::nth_element(begin, mid, end, [&](uint32_t a, uint32_t b) {
+                return axisOf(spheres[a].center, axis) < axisOf(spheres[b].center, axis);
+            });
+        }
+
+        uint32_t leftCount = static_cast<uint32_t>(mid - begin);
+        uint32_t left = static_cast<uint32_t>(nodes.size());
+        nodes.push_back({});
+        nodes.push_back({});
+        parents.push_back(task.node);
+        parents.push_back(task.node);
+        nodes[task.node].left = left;
+        nodes[task.node].right = left + 1;
+
+        stack.push_back({left + 1, task.first + leftCount, task.count - leftCount, task.depth + 1});
+        stack.push_back({left, task.first, leftCount, task.depth + 1});
+    }
+}
+
+// Work is split into chunks of this many spheres or nodes.
+static constexpr uint32_t LBVH_CHUNK_SIZE = 16384;
+
+// Spreads the low 10 bits of v so there are two zero bits between each.
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// Stable LSD radix sort of 30-bit keys with their values, 10 bits per pass.
+// Each chunk histograms and then scatters its own range, so both steps run
+// in parallel; only the prefix sum over the chunk histograms is serial.
+static void radixSort(JobSystem* jobs, std::vector<uint32_t>& keys, std::vector<uint32_t>& values) {
+    const uint32_t RADIX_BITS = 10, BUCKETS = 1u << RADIX_BITS;
+    uint32_t count = static_cast<uint32_t>(keys.size());
+    uint32_t chunks = (count + LBVH_CHUNK_SIZE - 1) / LBVH_CHUNK_SIZE;
+    std::vector<uint32_t> tmpKeys(count), tmpValues(count);
+    std::vector<uint32_t> offsets(static_cast<size_t>(chunks) * BUCKETS);
+
+    for (uint32_t shift = 0; shift < 30; shift += RADIX_BITS) {
+        forEachChunk(jobs, count, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+            uint32_t* histogram = &offsets[static_cast<size_t>(begin / LBVH_CHUNK_SIZE) * BUCKETS];
+            std::fill(histogram, histogram + BUCKETS, 0u);
+            for (uint32_t i = begin; i < end; i++) histogram[(keys[i] >> shift) & (BUCKETS - 1)]++;
+        });
+
+        uint32_t sum = 0;
+        for (uint32_t bucket = 0; bucket < BUCKETS; bucket++) {
+            for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+                uint32_t& slot = offsets[static_cast<size_t>(chunk) * BUCKETS + bucket];
+                uint32_t n = slot;
+                slot = sum;
+                sum += n;
+            }
+        }
+
+        forEachChunk(jobs, count, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+            uint32_t* offset = &offsets[static_cast<size_t>(begin / LBVH_CHUNK_SIZE) * BUCKETS];
+            for (uint32_t i = begin; i < end; i++) {
+                uint32_t dst = offset[(keys[i] >> shift) & (BUCKETS - 1)]++;
+                tmpKeys[dst] = keys[i];
+                tmpValues[dst] = values[i];
+            }
+        });
+        keys.swap(tmpKeys);
+        values.swap(tmpValues);
+    }
+}
+
+// Linear BVH (Karras 2012): sort the spheres along a Morton curve, then find
+// every internal node's range and split independently from the sorted codes.
+// Internal nodes are nodes [0, n - 1) with the root at 0, leaves follow with
+// one sphere each.
+void Bvh::buildLbvh(std::span<const Sphere> spheres, JobSystem* jobs) {
+    uint32_t count = static_cast<uint32_t>(spheres.size());
+    parentsBeforeChildren = false;
+
+    // Centroid bounds, reduced per worker.
+    unsigned workerCount = jobs ? jobs->threadCount() : 1;
+    std::vector<Aabb> workerBounds(workerCount);
+    forEachChunk(jobs, count, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned worker) {
+        Aabb b = workerBounds[worker];
+        for (uint32_t i = begin; i < end; i++) b.grow(spheres[i].center);
+        workerBounds[worker] = b;
+    });
+    Aabb centroids;
+    for (const Aabb& b : workerBounds) centroids.grow(b);
+
+    Vec3 extent = centroids.max - centroids.min;
+    Vec3 scale = {1024.0f / std::max(extent.x, 1e-6f), 1024.0f / std::max(extent.y, 1e-6f), 1024.0f / std::max(extent.z, 1e-6f)};
+    std::vector<uint32_t> codes(count);
+    primIndices.resize(count);
+    forEachChunk(jobs, count, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+        for (uint32_t i = begin; i < end; i++) {
+            Vec3 q = (spheres[i].center - centroids.min) * scale;
+            uint32_t x = static_cast<uint32_t>(std::clamp(q.x, 0.0f, 1023.0f));
+            uint32_t y = static_cast<uint32_t>(std::clamp(q.y, 0.0f, 1023.0f));
+            uint32_t z = static_cast<uint32_t>(std::clamp(q.z, 0.0f, 1023.0f));
+            codes[i] = (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+            primIndices[i] = i;
+        }
+    });
+    radixSort(jobs, codes, primIndices);
+
+    uint32_t nodeCount = 2 * count - 1;
+    uint32_t firstLeaf = count - 1;
+    nodes.resize(nodeCount);
+    parents.resize(nodeCount);
+    sphereLeaf.resize(count);
+    parents[0] = NO_PARENT;
+
+    forEachChunk(jobs, count, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+        for (uint32_t i = begin; i < end; i++) {
+            BvhNode& leaf = nodes[firstLeaf + i];
+            leaf.left = LEAF_BIT | i;
+            leaf.right = 1;
+            sphereLeaf[primIndices[i]] = firstLeaf + i;
+        }
+    });
+    // Leaf bounds in sphere order: sequential reads and scattered writes are
+    // much cheaper than gathering the spheres in Morton order.
+    forEachChunk(jobs, count, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+        for (uint32_t i = begin; i < end; i++) {
+            const Sphere& s = spheres[i];
+            BvhNode& leaf = nodes[sphereLeaf[i]];
+            leaf.boundsMin[0] = s.center.x - s.radius; leaf.boundsMax[0] = s.center.x + s.radius;
+            leaf.boundsMin[1] = s.center.y - s.radius; leaf.boundsMax[1] = s.center.y + s.radius;
+            leaf.boundsMin[2] = s.center.z - s.radius; leaf.boundsMax[2] = s.center.z + s.radius;
+        }
+    });
+
+    // Length of the common prefix of the keys at i and j, with the sorted
+    // position breaking ties between equal codes; -1 outside the array.
+    auto delta = [&](uint32_t i, int64_t j) -> int {
+        if (j < 0 || j >= count) return -1;
+        uint32_t a = codes[i], b = codes[static_cast<uint32_t>(j)];
+        if (a != b) return std::countl_zero(a ^ b);
+        return 32 + std::countl_zero(i ^ static_cast<uint32_t>(j));
+    };
+
+    forEachChunk(jobs, firstLeaf, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+        for (uint32_t i = begin; i < end; i++) {
+            // Direction of the range and its other end.
+            int d = delta(i, int64_t(i) + 1) > delta(i, int64_t(i) - 1) ? 1 : -1;
+            int deltaMin = delta(i, int64_t(i) - d);
+            int64_t lengthMax = 2;
+            while (delta(i, i + lengthMax * d) > deltaMin) lengthMax *= 2;
+            int64_t length = 0;
+            for (int64_t t = lengthMax / 2; t >= 1; t /= 2) {
+                if (delta(i, i + (length + t) * d) > deltaMin) length += t;
+            }
+            int64_t j = i + length * d;
+
+            // Binary search for the split position.
+            int deltaNode = delta(i, j);
+            int64_t split = 0;
+            for (int64_t div = 2;; div *= 2) {
+                int64_t t = (length + div - 1) / div;
+                if (delta(i, i + (split + t) * d) > deltaNode) split += t;
+                if (t <= 1) break;
+            }
+            uint32_t gamma = static_cast<uint32_t>(i + split * d + std::min(d, 0));
+
+            uint32_t left = std::min<int64_t>(i, j) == gamma ? firstLeaf + gamma : gamma;
+            uint32_t right = std::max<int64_t>(i, j) == gamma + 1 ? firstLeaf + gamma + 1 : gamma + 1;
+            nodes[i].left = left;
+            nodes[i].right = right;
+            parents[left] = i;
+            parents[right] = i;
+        }
+    });
+
+    std::vector<double> workerCost(workerCount, 0.0);
+    refitBottomUp(spheres, jobs, workerCost.data(), true);
+    costSum = 0.0;
+    for (double c : workerCost) costSum += c;
+}
+
+// Bottom-up bounds for any topology: every leaf walks towards the root and
+// the second child to arrive at a node computes it, so each node is
+// computed once, after both children. Adds area * weight per worker to cost.
+void Bvh::refitBottomUp(std::span<const Sphere> spheres, JobSystem* jobs, double* cost, bool leafBoundsReady) {
+    uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+    std::vector<std::atomic<uint32_t>> arrivals(nodeCount);
+
+    forEachChunk(jobs, nodeCount, LBVH_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned worker) {
+        double sum = 0.0;
+        for (uint32_t i = begin; i < end; i++) {
+            if (!isLeaf(nodes[i])) continue;
+            uint32_t node = i;
+            while (true) {
+                BvhNode& n = nodes[node];
+                if (node != i || !leafBoundsReady) {
+                    float bmin[3], bmax[3];
+                    computeBounds(*this, n, spheres, bmin, bmax);
+                    for (int a = 0; a < 3; a++) {
+                        n.boundsMin[a] = bmin[a];
+                        n.boundsMax[a] = bmax[a];
+                    }
+                }
+                sum += static_cast<double>(nodeArea(n)) * nodeWeight(n);
+
+                node = parents[node];
+                if (node == NO_PARENT || arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 0) break;
+            }
+        }
+        cost[worker] += sum;
+    });
+}
+
+float Bvh::sahCost() const {
+    if (nodes.empty()) return 0.0f;
+    float rootArea = nodeArea(nodes[0]);
+    return rootArea > 0.0f ? static_cast<float>(costSum / rootArea) : 0.0f;
+}
+
+// Bounds of a node from its spheres (leaf) or children (interior).
+static void computeBounds(const Bvh& bvh, const BvhNode& node, std::span<const Sphere> spheres, float* bmin, float* bmax) {
+    if (Bvh::isLeaf(node)) {
+        bmin[0] = bmin[1] = bmin[2] = 1e30f;
+        bmax[0] = bmax[1] = bmax[2] = -1e30f;
+        uint32_t first = node.left & ~Bvh::LEAF_BIT;
+        for (uint32_t i = first; i < first + node.right; i++) {
+            const Sphere& s = spheres[bvh.primIndices[i]];
+            bmin[0] = std::min(bmin[0], s.center.x - s.radius); bmax[0] = std::max(bmax[0], s.center.x + s.radius);
+            bmin[1] = std::min(bmin[1], s.center.y - s.radius); bmax[1] = std::max(bmax[1], s.center.y + s.radius);
+            bmin[2] = std::min(bmin[2], s.center.z - s.radius); bmax[2] = std::max(bmax[2], s.center.z + s.radius);
+        }
+    } else {
+        const BvhNode& l = bvh.nodes[node.left];
+        const BvhNode& r = bvh.nodes[node.right];
+        for (int a = 0; a < 3; a++) {
+            bmin[a] = std::min(l.boundsMin[a], r.boundsMin[a]);
+            bmax[a] = std::max(l.boundsMax[a], r.boundsMax[a]);
+        }
+    }
+}
+
+// Recomputes one node. Returns false if its bounds did not change, in which
+// case its ancestors are still valid.
+bool Bvh::refitNode(uint32_t index, std::span<const Sphere> spheres) {
+    BvhNode& node = nodes[index];
+    float bmin[3], bmax[3];
+    computeBounds(*this, node, spheres, bmin, bmax);
+
+    if (bmin[0] == node.boundsMin[0] && bmin[1] == node.boundsMin[1] && bmin[2] == node.boundsMin[2] &&
+        bmax[0] == node.boundsMax[0] && bmax[1] == node.boundsMax[1] && bmax[2] == node.boundsMax[2]) {
+        return false;
+    }
+
+    float oldArea = nodeArea(node);
+    for (int a = 0; a < 3; a++) {
+        node.boundsMin[a] = bmin[a];
+        node.boundsMax[a] = bmax[a];
+    }
+    costSum += static_cast<double>(nodeArea(node) - oldArea) * nodeWeight(node);
+    return true;
+}
+
+void Bvh::refit(std::span<const Sphere> spheres, std::span<const uint32_t> dirty, BvhDirtyNodes& changed) {
+    if (nodes.empty()) return;
+
+    // Walking up from every sphere touches O(dirty * depth) nodes; past a
+    // point a full sweep over the nodes is cheaper.
+    if (dirty.size() > nodes.size() / 16) {
+        refitAll(spheres);
+        changed.markAll(static_cast<uint32_t>(nodes.size()));
+        return;
+    }
+
+    for (uint32_t sphere : dirty) {
+        if (sphere >= sphereLeaf.size()) continue;
+        for (uint32_t node = sphereLeaf[sphere]; node != NO_PARENT; node = parents[node]) {
+            if (!refitNode(node, spheres)) break;
+            changed.mark(node);
+        }
+    }
+}
+
+void Bvh::refitAll(std::span<const Sphere> spheres) {
+    if (!parentsBeforeChildren) {
+        costSum = 0.0;
+        refitBottomUp(spheres, nullptr, &costSum, false);
+        return;
+    }
+
+    // Children are always stored after their parent, so a reverse sweep
+    // sees both children of a node before the node itself. This runs for
+    // every node whenever much of the scene moves, so it is computeBounds()
+    // unrolled: bounds start from the first sphere or the left child
+    // instead of an empty box, and stay in registers until stored.
+    double sum = 0.0;
+    for (uint32_t i = static_cast<uint32_t>(nodes.size()); i-- > 0;) {
+        BvhNode& node = nodes[i];
+        float minX, minY, minZ, maxX, maxY, maxZ, weight;
+        if (isLeaf(node)) {
+            const uint32_t* prims = primIndices.data() + (node.left & ~LEAF_BIT);
+            const Sphere& s = spheres[prims[0]];
+            minX = s.center.x - s.radius; maxX = s.center.x + s.radius;
+            minY = s.center.y - s.radius; maxY = s.center.y + s.radius;
+            minZ = s.center.z - s.radius; maxZ = s.center.z + s.radius;
+            for (uint32_t j = 1; j < node.right; j++) {
+                const Sphere& o = spheres[prims[j]];
+                minX = std::min(minX, o.center.x - o.radius); maxX = std::max(maxX, o.center.x + o.radius);
+                minY = std::min(minY, o.center.y - o.radius); maxY = std::max(maxY, o.center.y + o.radius);
+                minZ = std::min(minZ, o.center.z - o.radius); maxZ = std::max(maxZ, o.center.z + o.radius);
+            }
+            weight = static_cast<float>(node.right);
+        } else {
+            const BvhNode& l = nodes[node.left];
+            const BvhNode& r = nodes[node.right];
+            minX = std::min(l.boundsMin[0], r.boundsMin[0]); maxX = std::max(l.boundsMax[0], r.boundsMax[0]);
+            minY = std::min(l.boundsMin[1], r.boundsMin[1]); maxY = std::max(l.boundsMax[1], r.boundsMax[1]);
+            minZ = std::min(l.boundsMin[2], r.boundsMin[2]); maxZ = std::max(l.boundsMax[2], r.boundsMax[2]);
+            weight = 1.0f;
+        }
+        node.boundsMin[0] = minX; node.boundsMin[1] = minY; node.boundsMin[2] = minZ;
+        node.boundsMax[0] = maxX; node.boundsMax[1] = maxY; node.boundsMax[2] = maxZ;
+        sum += static_cast<double>(nodeArea(node) * weight);
+    }
+    costSum = sum;
+}
+
+SphereHit Bvh::intersect(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) const {
+    SphereHit best;
+    best.t = tMax;
+    traverse(origin, direction, best.t, [&](uint32_t first, uint32_t count, float& t) {
+        for (uint32_t lane = first; lane < first + count; lane++) {
+            float ocx = origin.x - spheres.centerX[lane];
+            float ocy = origin.y - spheres.centerY[lane];
+            float ocz = origin.z - spheres.centerZ[lane];
+            float b = ocx * direction.x + ocy * direction.y + ocz * direction.z;
+            float c = ocx * ocx + ocy * ocy + ocz * ocz - spheres.radiusSq[lane];
+            float h = b * b - c;
+            if (h > 0.0f) {
+                float hitT = -b - std::sqrt(h);
+                if (hitT > 0.001f && hitT < t) {
+                    t = hitT;
+                    best.lane = static_cast<int32_t>(lane);
+                }
+            }
+        }
+    });
+    return best;
+}
@@ -0,0 +1,218 @@
+#pragma once
+#include "Camera.h"
+#include "Scene.h"
+#include "SphereKernels.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Node layout shared with BvhNode in raytracer.frag (std430, 32 bytes).
+struct BvhNode {
+    float boundsMin[3];
+    uint32_t left;  // Interior: left child index. Leaf: LEAF_BIT | first entry in primIndices
+    float boundsMax[3];
+    uint32_t right; // Interior: right child index. Leaf: number of spheres
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match the std430 layout in raytracer.frag");
+
+// Tracks which BVH nodes (or entries of any other GPU array) changed since
+// the last upload, one bit each, so only those need to be copied again.
+struct BvhDirtyNodes {
+    // Clean gaps of up to this many entries are copied along with the runs
+    // around them; a few hundred bytes cost less than another copy region.
+    static constexpr uint32_t MERGE_GAP = 8;
+
+    std::vector<uint64_t> bits;
+
+    void mark(uint32_t node) {
+        if (node / 64 >= bits.size()) bits.resize(node / 64 + 1, 0);
+        bits[node / 64] |= uint64_t(1) << (node % 64);
+    }
+    void markAll(uint32_t nodeCount) {
+        if (nodeCount == 0) return;
+        bits.assign((nodeCount + 63) / 64, ~uint64_t(0));
+    }
+    void merge(const BvhDirtyNodes& other) {
+        if (other.bits.size() > bits.size()) bits.resize(other.bits.size(), 0);
+        for (size_t i = 0; i < other.bits.size(); i++) bits[i] |= other.bits[i];
+    }
+    void clear() { bits.clear(); }
+    bool empty() const {
+        return std::all_of(bits.begin(), bits.end(), [](uint64_t b) { return b == 0; });
+    }
+
+    // Calls upload(firstNode, nodeCount) for each run of dirty nodes, clamped
+    // to nodeCount nodes. Runs at most MERGE_GAP nodes apart are joined.
+    template <typename Upload>
+    void forEachRun(uint32_t nodeCount, Upload&& upload) const {
+        uint32_t end = static_cast<uint32_t>(std::min<size_t>(bits.size() * 64, nodeCount));
+        uint32_t runStart = 0, runEnd = 0;
+        bool inRun = false;
+        for (uint32_t first = findBit(0, end, true); first < end;) {
+            uint32_t last = findBit(first, end, false);
+            if (inRun && first - runEnd <= MERGE_GAP) {
+                runEnd = last;
+            } else {
+                if (inRun) upload(runStart, runEnd - runStart);
+                runStart = first;
+                runEnd = last;
+                inRun = true;
+            }
+            first = findBit(last, end, true);
+        }
+        if (inRun) upload(runStart, runEnd - runStart);
+    }
+
+private:
+    // First index from `i` on whose bit equals `set`, or `end`
+    uint32_t findBit(uint32_t i, uint32_t end, bool set) const {
+        while (i < end) {
+            uint64_t word = (set ? bits[i / 64] : ~bits[i / 64]) >> (i % 64);
+            if (word != 0) return std::min(end, i + static_cast<uint32_t>(std::countr_zero(word)));
+            i = (i / 64 + 1) * 64;
+        }
+        return end;
+    }
+};
+
+class JobSystem;
+
+enum class BvhBuildMethod {
+    Sah,  // Binned SAH, best trees, single threaded
+    Lbvh, // Morton-sorted linear BVH, parallel and much faster to build
+};
+
+const char* bvhBuildMethodName(BvhBuildMethod method);
+
+// Bounding volume hierarchy over Scene::spheres, built on the CPU. The root
+// is nodes[0]; leaves reference ranges of primIndices.
+class Bvh {
+public:
+    static constexpr uint32_t LEAF_BIT = 0x80000000u;
+    static constexpr uint32_t MAX_LEAF_SIZE = 4;
+    static constexpr uint32_t SAH_BINS = 16;
+    // Must match BVH_STACK_SIZE in raytracer.frag
+    static constexpr uint32_t STACK_SIZE = 64;
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+    // Rebuild once refitting has made the SAH cost this much worse than
+    // right after the last build.
+    static constexpr float REBUILD_THRESHOLD = 1.5f;
+
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primIndices; // Index into Scene::spheres for each leaf entry
+    std::vector<uint32_t> parents;     // Parent of each node, NO_PARENT for the root
+    std::vector<uint32_t> sphereLeaf;  // Leaf node holding each sphere
+
+    // LBVH spreads its work over `jobs` when given; SAH ignores it.
+    void build(std::span<const Sphere> spheres, BvhBuildMethod method = BvhBuildMethod::Sah, JobSystem* jobs = nullptr);
+    // Takes over a tree built elsewhere, e.g. a scene file's prebuilt one,
+    // over `sphereCount` spheres. Every index is checked, so a corrupt tree
+    // is rejected: returns false and leaves the BVH empty.
+    bool adopt(std::span<const BvhNode> prebuiltNodes, std::span<const uint32_t> prebuiltIndices, size_t sphereCount);
+    void clear();
+    bool empty() const { return nodes.empty(); }
+
+    // Updates the bounds of the leaves holding `dirty` spheres and of their
+    // ancestors, keeping the topology. Spheres must not have been added or
+    // removed since build(). Nodes whose bounds changed are marked in `changed`.
+    void refit(std::span<const Sphere> spheres, std::span<const uint32_t> dirty, BvhDirtyNodes& changed);
+    // Refits every node in one reverse sweep; refit() switches to this once
+    // a large part of the scene moved.
+    void refitAll(std::span<const Sphere> spheres);
+
+    // SAH cost of the current tree relative to its root area.
+    float sahCost() const;
+    bool needsRebuild() const { return sahCost() > builtSahCost * REBUILD_THRESHOLD; }
+
+    static bool isLeaf(const BvhNode& node) { return (node.left & LEAF_BIT) != 0; }
+
+    // Closest hit, same contract as intersectSpheres(). `spheres` must hold
+    // the spheres in primIndices order (SphereSoA::build with primIndices),
+    // so a leaf covers a contiguous run of lanes.
+    SphereHit intersect(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) const;
+
+    // Slab test; returns the entry distance or 1e30 on a miss.
+    static float intersectNode(const BvhNode& node, Vec3 origin, Vec3 invDir, float tMax) {
+        float tx0 = (node.boundsMin[0] - origin.x) * invDir.x, tx1 = (node.boundsMax[0] - origin.x) * invDir.x;
+        float ty0 = (node.boundsMin[1] - origin.y) * invDir.y, ty1 = (node.boundsMax[1] - origin.y) * invDir.y;
+        float tz0 = (node.boundsMin[2] - origin.z) * invDir.z, tz1 = (node.boundsMax[2] - origin.z) * invDir.z;
+        float tNear = std::max({std::min(tx0, tx1), std::min(ty0, ty1), std::min(tz0, tz1), 0.0f});
+        float tFar = std::min({std::max(tx0, tx1), std::max(ty0, ty1), std::max(tz0, tz1), tMax});
+        return tNear <= tFar ? tNear : 1e30f;
+    }
+
+    // Visits the leaves a ray enters, nearest child first. visitLeaf(first,
+    // count, tMax) tests primIndices entries [first, first + count) and
+    // lowers tMax on a hit, which culls the nodes beyond it.
+    template <typename VisitLeaf>
+    void traverse(Vec3 origin, Vec3 direction, float& tMax, VisitLeaf&& visitLeaf) const {
+        if (nodes.empty()) return;
+        Vec3 invDir = {safeInverse(direction.x), safeInverse(direction.y), safeInverse(direction.z)};
+        if (intersectNode(nodes[0], origin, invDir, tMax) >= 1e30f) return;
+
+        uint32_t stack[STACK_SIZE];
+        uint32_t sp = 0;
+        uint32_t current = 0;
+        while (true) {
+            const BvhNode& node = nodes[current];
+            if (isLeaf(node)) {
+                visitLeaf(node.left & ~LEAF_BIT, node.right, tMax);
+                if (sp == 0) break;
+                current = stack[--sp];
+                continue;
+            }
+
+            uint32_t nearChild = node.left, farChild = node.right;
+            float nearDist = intersectNode(nodes[nearChild], origin, invDir, tMax);
+            float farDist = intersectNode(nodes[farChild], origin, invDir, tMax);
+            if (farDist < nearDist) {
+                std::swap(nearChild, farChild);
+                std::swap(nearDist, farDist);
+            }
+
+            if (nearDist >= 1e30f) {
+                if (sp == 0) break;
+                current = stack[--sp];
+            } else {
+                current = nearChild;
+                if (farDist < 1e30f && sp < STACK_SIZE) stack[sp++] = farChild;
+            }
+        }
+    }
+
+    // Calls visit(lane) for every leaf entry whose node and ancestors all
+    // pass boxTest(boundsMin, boundsMax).
+    template <typename BoxTest, typename Visit>
+    void collect(BoxTest&& boxTest, Visit&& visit) const {
+        if (nodes.empty()) return;
+        uint32_t stack[STACK_SIZE];
+        uint32_t sp = 0;
+        stack[sp++] = 0;
+        while (sp > 0) {
+            const BvhNode& node = nodes[stack[--sp]];
+            if (!boxTest(node.boundsMin, node.boundsMax)) continue;
+            if (isLeaf(node)) {
+                uint32_t first = node.left & ~LEAF_BIT;
+                for (uint32_t i = 0; i < node.right; i++) visit(first + i);
+            } else if (sp + 2 <= STACK_SIZE) {
+                stack[sp++] = node.right;
+                stack[sp++] = node.left;
+            }
+        }
+    }
+
+private:
+    // Sum of area * cost weight over all nodes, kept up to date by refits.
+    double costSum = 0.0;
+    float builtSahCost = 0.0f;
+    // True when every node is stored before its children (SAH builds), which
+    // lets refitAll() use a single reverse sweep.
+    bool parentsBeforeChildren = true;
+
+    void buildSah(std::span<const Sphere> spheres);
+    void buildLbvh(std::span<const Sphere> spheres, JobSystem* jobs);
+    bool refitNode(uint32_t index, std::span<const Sphere> spheres);
+    void refitBottomUp(std::span<const Sphere> spheres, JobSystem* jobs, double* cost, bool leafBoundsReady);
+};
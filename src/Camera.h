@@ -7,9 +7,19 @@ struct Vec3 {
     Vec3 operator+(const Vec3& other) const { return {x + other.x, y + other.y, z + other.z}; }
     Vec3 operator-(const Vec3& other) const { return {x - other.x, y - other.y, z - other.z}; }
     Vec3 operator*(float s) const { return {x * s, y * s, z * s}; }
+    Vec3 operator*(const Vec3& other) const { return {x * other.x, y * other.y, z * other.z}; }
+    Vec3 operator-() const { return {-x, -y, -z}; }
     Vec3& operator+=(const Vec3& other) { x += other.x; y += other.y; z += other.z; return *this; }
 };
 
+inline float dot(Vec3 a, Vec3 b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline float length(Vec3 v) {
+    return std::sqrt(dot(v, v));
+}
+
 inline Vec3 normalize(Vec3 v) {
     float len = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
     if (len == 0) return {0, 0, 0};
@@ -24,6 +34,17 @@ inline Vec3 cross(Vec3 a, Vec3 b) {
     };
 }
 
+// Same convention as GLSL reflect(): n must be normalized.
+inline Vec3 reflect(Vec3 i, Vec3 n) {
+    return i - n * (2.0f * dot(n, i));
+}
+
+// 1 / d with tiny components clamped away from zero, so axis-aligned rays
+// give large finite slab distances instead of infinities.
+inline float safeInverse(float d) {
+    return 1.0f / (std::abs(d) < 1e-8f ? std::copysign(1e-8f, d) : d);
+}
+
 class Camera {
 public:
     Vec3 position = {0.0f, 2.0f, 5.0f};
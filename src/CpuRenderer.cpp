@@ -0,0 +1,576 @@
+#include "CpuRenderer.h"
+#include "SceneFile.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+// Everything below mirrors raytracer.frag; keep the two in sync.
+
+struct Ray {
+    Vec3 origin;
+    Vec3 direction;
+};
+
+struct HitInfo {
+    bool hit;
+    float dist;
+    Vec3 point;
+    Vec3 normal;
+    Vec3 matColor;
+    float reflectivity;
+};
+
+struct alignas(64) RayCounter {
+    uint64_t rays = 0;
+};
+
+// Spheres to test a ray against: a SoA copy, optionally with a BVH whose
+// primIndices order matches the SoA lanes or a grid over the SoA in scene
+// order. Without either every lane is tested. A wide BVH collapsed from the
+// BVH replaces it for closest hits; culling still walks the binary one.
+// Instanced clusters are traced through their own two-level BVH when there
+// are any.
+struct SphereSet {
+    const SphereSoA* spheres;
+    const Bvh* bvh;
+    const SphereGrid* grid = nullptr;
+    const TwoLevelBvh* instances = nullptr;
+    const WideBvh* wide = nullptr;
+
+    SphereHit intersect(Vec3 origin, Vec3 direction, float tMax) const {
+        if (wide) return wide->intersect(*spheres, origin, direction, tMax);
+        if (bvh) return bvh->intersect(*spheres, origin, direction, tMax);
+        if (grid) return grid->intersect(*spheres, origin, direction, tMax);
+        return intersectSpheres(*spheres, origin, direction, tMax);
+    }
+};
+
+static void intersectEmitter(const Ray& ray, Vec3 position, Vec3 color, HitInfo& closestHit) {
+    Vec3 oc = ray.origin - position;
+    float b = dot(oc, ray.direction);
+    float c = dot(oc, oc) - 0.1f * 0.1f; // Small radius 0.1
+    float h = b * b - c;
+    if (h > 0.0f) {
+        float t = -b - std::sqrt(h);
+        if (t > 0.001f && t < closestHit.dist) {
+            closestHit.hit = true;
+            closestHit.dist = t;
+            closestHit.point = ray.origin + ray.direction * t;
+            closestHit.normal = normalize(closestHit.point - position);
+            closestHit.matColor = color * 10.0f; // Emissive
+            closestHit.reflectivity = 0.0f;
+        }
+    }
+}
+
+static HitInfo traceScene(const Scene& scene, SphereSet set, const Ray& ray) {
+    HitInfo closestHit{};
+    closestHit.hit = false;
+    closestHit.dist = 1e30f;
+    closestHit.reflectivity = 0.0f;
+
+    SphereHit sphereHit = set.intersect(ray.origin, ray.direction, closestHit.dist);
+    if (sphereHit.lane >= 0) {
+        const SphereSoA& spheres = *set.spheres;
+        uint32_t lane = static_cast<uint32_t>(sphereHit.lane);
+        Vec3 center = {spheres.centerX[lane], spheres.centerY[lane], spheres.centerZ[lane]};
+        const Material& m = scene.materials[spheres.material[lane]];
+        closestHit.hit = true;
+        closestHit.dist = sphereHit.t;
+        closestHit.point = ray.origin + ray.direction * sphereHit.t;
+        closestHit.normal = normalize(closestHit.point - center);
+        closestHit.matColor = m.color;
+        closestHit.reflectivity = 1.0f - m.roughness;
+    }
+
+    if (set.instances) {
+        InstanceHit instanceHit = set.instances->intersect(scene, ray.origin, ray.direction, closestHit.dist);
+        if (instanceHit.instance >= 0) {
+            const Material& m = scene.materials[instanceHit.material];
+            closestHit.hit = true;
+            closestHit.dist = instanceHit.t;
+            closestHit.point = ray.origin + ray.direction * instanceHit.t;
+            closestHit.normal = normalize(closestHit.point - instanceHit.center);
+            closestHit.matColor = m.color;
+            closestHit.reflectivity = 1.0f - m.roughness;
+        }
+    }
+
+    // Point and spot light visual representations
+    intersectEmitter(ray, scene.pointLight.position, scene.pointLight.color, closestHit);
+    intersectEmitter(ray, scene.spotLight.position, scene.spotLight.color, closestHit);
+
+    return closestHit;
+}
+
+static bool isEmissive(const HitInfo& hit) {
+    return length(hit.matColor) > 2.0f;
+}
+
+// Shadow factor for a shadow ray toward a light `dist` away (1e30 for the sun).
+static float shadowFactor(const HitInfo& shadowHit, float dist) {
+    return (shadowHit.hit && shadowHit.dist < dist && !isEmissive(shadowHit)) ? 0.1f : 1.0f;
+}
+
+enum LightIndex { SUN_LIGHT = 0, POINT_LIGHT = 1, SPOT_LIGHT = 2 };
+
+// Direct lighting for one hit. shadow(light, shadowRay, dist) returns the
+// shadow factor for that light, so callers decide how shadow rays are traced.
+template <typename ShadowFn>
+static Vec3 directLight(const Scene& scene, const HitInfo& hit, ShadowFn&& shadow) {
+    Vec3 totalLight = {0.0f, 0.0f, 0.0f};
+
+    // 1. Directional Light (Sun)
+    if (scene.sunEnabled) {
+        Vec3 lightDir = normalize(scene.sunDirection);
+        float diff = std::max(dot(hit.normal, lightDir), 0.0f);
+        Ray shadowRay = {hit.point + hit.normal * 0.001f, lightDir};
+        totalLight += hit.matColor * (diff * shadow(SUN_LIGHT, shadowRay, 1e30f));
+    }
+
+    // 2. Point Light
+    {
+        const PointLight& light = scene.pointLight;
+        Vec3 L = normalize(light.position - hit.point);
+        float dist = length(light.position - hit.point);
+        float attenuation = 1.0f / (1.0f + 0.09f * dist + 0.032f * dist * dist);
+        float diff = std::max(dot(hit.normal, L), 0.0f);
+
+        Ray shadowRay = {hit.point + hit.normal * 0.001f, L};
+        totalLight += hit.matColor * light.color * (light.intensity * diff * attenuation * shadow(POINT_LIGHT, shadowRay, dist));
+    }
+
+    // 3. Spot Light
+    {
+        const SpotLight& light = scene.spotLight;
+        Vec3 L = normalize(light.position - hit.point);
+        float dist = length(light.position - hit.point);
+        float attenuation = 1.0f / (1.0f + 0.09f * dist + 0.032f * dist * dist);
+
+        float theta = dot(L, normalize(-light.direction));
+        float epsilon = light.cutOff - light.outerCutOff;
+        float intensity = std::clamp((theta - light.outerCutOff) / epsilon, 0.0f, 1.0f);
+
+        if (intensity > 0.0f) {
+            float diff = std::max(dot(hit.normal, L), 0.0f);
+            Ray shadowRay = {hit.point + hit.normal * 0.001f, L};
+            totalLight += hit.matColor * light.color * (light.intensity * diff * attenuation * intensity * shadow(SPOT_LIGHT, shadowRay, dist));
+        }
+    }
+
+    return totalLight;
+}
+
+struct PathState {
+    Ray ray;
+    Vec3 color;
+    Vec3 throughput;
+};
+
+// One iteration of the bounce loop. Returns false once the path has ended.
+template <typename ShadowFn>
+static bool shadeBounce(const Scene& scene, PathState& path, const HitInfo& hit, ShadowFn&& shadow) {
+    if (!hit.hit) {
+        // Sky Color
+        float t = 0.5f * (path.ray.direction.y + 1.0f);
+        Vec3 sky = Vec3{0.5f, 0.7f, 1.0f} * (1.0f - t) + Vec3{0.1f, 0.1f, 0.2f} * t;
+        path.color += sky * path.throughput;
+        return false;
+    }
+
+    // Emissive light source representation
+    if (isEmissive(hit)) {
+        path.color += hit.matColor * path.throughput;
+        return false;
+    }
+
+    float ambient = 0.1f;
+    Vec3 totalLight = directLight(scene, hit, shadow);
+    totalLight += hit.matColor * ambient;
+
+    path.color += totalLight * path.throughput * (1.0f - hit.reflectivity);
+    path.throughput = path.throughput * hit.reflectivity;
+
+    // Prepare next ray (Reflection)
+    path.ray.origin = hit.point + hit.normal * 0.001f;
+    path.ray.direction = reflect(path.ray.direction, hit.normal);
+    return true;
+}
+
+// Runs the bounce loop from `firstBounce` on, tracing every ray individually.
+static void continuePath(const Scene& scene, SphereSet spheres, PathState& path, int firstBounce, uint64_t& rays) {
+    auto shadow = [&](int, const Ray& shadowRay, float dist) {
+        rays++;
+        return shadowFactor(traceScene(scene, spheres, shadowRay), dist);
+    };
+
+    for (int bounce = firstBounce; bounce < 3; bounce++) {
+        HitInfo hit = traceScene(scene, spheres, path.ray);
+        rays++;
+        if (!shadeBounce(scene, path, hit, shadow)) break;
+    }
+}
+
+static Vec3 tracePixel(const Scene& scene, SphereSet spheres, Ray ray, uint64_t& rays) {
+    PathState path = {ray, {0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}};
+    continuePath(scene, spheres, path, 0, rays);
+    return path.color;
+}
+
+struct CameraBasis {
+    Vec3 position;
+    Vec3 forward;
+    Vec3 right;
+    Vec3 up;
+    float width;
+    float height;
+    float aspect;
+
+    // Unnormalized direction through the center of pixel (x, y); (0, 0) is the
+    // top-left corner, the same UV convention as the fullscreen triangle.
+    Vec3 pixelDirection(uint32_t x, uint32_t y) const {
+        float u = (static_cast<float>(x) + 0.5f) / width * 2.0f - 1.0f;
+        float v = (static_cast<float>(y) + 0.5f) / height * 2.0f - 1.0f;
+        return forward * 1.5f + right * (u * aspect) + up * (-v);
+    }
+};
+
+// Culling volumes for packets. sphere() and box() return false only when
+// no ray of the packet can hit anything inside.
+
+// Pyramid spanned by four corner rays from the camera. Pixel directions are
+// affine in screen space, so every primary ray of the block lies inside it.
+struct FrustumCull {
+    Vec3 origin;
+    Vec3 normals[4];
+
+    FrustumCull(Vec3 o, const Vec3 corners[4]) : origin(o) {
+        Vec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+        for (int i = 0; i < 4; i++) {
+            Vec3 n = normalize(cross(corners[i], corners[(i + 1) % 4]));
+            normals[i] = dot(n, center) < 0.0f ? -n : n;
+        }
+    }
+    bool sphere(Vec3 c, float radiusSq) const {
+        for (const Vec3& n : normals) {
+            float d = dot(n, c - origin);
+            if (d < 0.0f && d * d > radiusSq) return false;
+        }
+        return true;
+    }
+    bool box(const float* bmin, const float* bmax) const {
+        for (const Vec3& n : normals) {
+            Vec3 p = {n.x >= 0.0f ? bmax[0] : bmin[0], n.y >= 0.0f ? bmax[1] : bmin[1], n.z >= 0.0f ? bmax[2] : bmin[2]};
+            if (dot(n, p - origin) < 0.0f) return false;
+        }
+        return true;
+    }
+};
+
+// Box around segments that all end at one light.
+struct BoxCull {
+    Vec3 min, max;
+
+    bool sphere(Vec3 c, float radiusSq) const {
+        float dx = std::max({min.x - c.x, 0.0f, c.x - max.x});
+        float dy = std::max({min.y - c.y, 0.0f, c.y - max.y});
+        float dz = std::max({min.z - c.z, 0.0f, c.z - max.z});
+        return dx * dx + dy * dy + dz * dz <= radiusSq;
+    }
+    bool box(const float* bmin, const float* bmax) const {
+        return bmin[0] <= max.x && bmax[0] >= min.x && bmin[1] <= max.y && bmax[1] >= min.y && bmin[2] <= max.z && bmax[2] >= min.z;
+    }
+};
+
+// Parallel rays along `dir`. Projected onto the plane orthogonal to `dir`,
+// a blocker must come within the rectangle bounding the ray origins, and it
+// must not lie entirely behind all of them.
+struct BeamCull {
+    Vec3 dir, u, v;
+    float uMin = 1e30f, uMax = -1e30f, vMin = 1e30f, vMax = -1e30f, dMin = 1e30f;
+
+    explicit BeamCull(Vec3 d) : dir(d) {
+        u = normalize(cross(dir, std::abs(dir.y) < 0.99f ? Vec3{0.0f, 1.0f, 0.0f} : Vec3{1.0f, 0.0f, 0.0f}));
+        v = cross(dir, u);
+    }
+    void addOrigin(Vec3 o) {
+        float pu = dot(o, u), pv = dot(o, v);
+        uMin = std::min(uMin, pu); uMax = std::max(uMax, pu);
+        vMin = std::min(vMin, pv); vMax = std::max(vMax, pv);
+        dMin = std::min(dMin, dot(o, dir));
+    }
+    bool overlaps(Vec3 c, Vec3 extent) const {
+        // Radius of the volume projected on each axis
+        auto reach = [&](Vec3 axis) { return std::abs(axis.x) * extent.x + std::abs(axis.y) * extent.y + std::abs(axis.z) * extent.z; };
+        float pu = dot(c, u), pv = dot(c, v), ru = reach(u), rv = reach(v);
+        return !(pu + ru < uMin || pu - ru > uMax || pv + rv < vMin || pv - rv > vMax || dot(c, dir) + reach(dir) < dMin);
+    }
+    bool sphere(Vec3 c, float radiusSq) const {
+        float r = std::sqrt(radiusSq);
+        float pu = dot(c, u), pv = dot(c, v);
+        return !(pu + r < uMin || pu - r > uMax || pv + r < vMin || pv - r > vMax || dot(c, dir) + r < dMin);
+    }
+    bool box(const float* bmin, const float* bmax) const {
+        Vec3 c = {(bmin[0] + bmax[0]) * 0.5f, (bmin[1] + bmax[1]) * 0.5f, (bmin[2] + bmax[2]) * 0.5f};
+        Vec3 e = {(bmax[0] - bmin[0]) * 0.5f, (bmax[1] - bmin[1]) * 0.5f, (bmax[2] - bmin[2]) * 0.5f};
+        return overlaps(c, e);
+    }
+};
+
+struct PacketScratch {
+    std::vector<uint32_t> lanes;
+    SphereSoA candidates;
+};
+
+// Below this many spheres culling costs more than it saves.
+static constexpr uint32_t MIN_CULL_SPHERES = 2 * SphereSoA::SPHERE_LANES;
+
+// Narrows a sphere set down to the spheres a culling volume keeps, walking
+// the BVH when there is one. Small scenes are returned as they are, and so
+// are grids: the culled spheres would lose the grid and be tested linearly.
+template <typename Cull>
+static SphereSet cullPacket(SphereSet set, PacketScratch& scratch, const Cull& cull) {
+    const SphereSoA& spheres = *set.spheres;
+    if (spheres.count < MIN_CULL_SPHERES || set.grid) return set;
+
+    scratch.lanes.clear();
+    auto consider = [&](uint32_t lane) {
+        Vec3 c = {spheres.centerX[lane], spheres.centerY[lane], spheres.centerZ[lane]};
+        if (cull.sphere(c, spheres.radiusSq[lane])) scratch.lanes.push_back(lane);
+    };
+    if (set.bvh) {
+        set.bvh->collect([&](const float* bmin, const float* bmax) { return cull.box(bmin, bmax); }, consider);
+    } else {
+        for (uint32_t lane = 0; lane < spheres.count; lane++) consider(lane);
+    }
+
+    scratch.candidates.gather(spheres, scratch.lanes);
+    SphereSet culled = {&scratch.candidates, nullptr};
+    culled.instances = set.instances;
+    return culled;
+}
+
+static void traceShadowPacket(const Scene& scene, SphereSet candidates, const Ray* shadowRays, const float* dists,
+                              const bool* active, float* shadows, uint32_t count, uint64_t& rays) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (!active[i]) continue;
+        shadows[i] = shadowFactor(traceScene(scene, candidates, shadowRays[i]), dists[i]);
+        rays++;
+    }
+}
+
+// Traces the shadow rays of a packet toward one point-like light. Every
+// segment from a hit point to the light lies in the box spanned by those
+// points and the light, so spheres outside it cannot cast the shadow.
+static void tracePointShadowPacket(const Scene& scene, SphereSet spheres, PacketScratch& scratch, Vec3 lightPos,
+                                   const HitInfo* hits, const bool* active, float* shadows, uint32_t count, uint64_t& rays) {
+    constexpr uint32_t MAX_RAYS = CpuRenderer::PACKET_SIZE * CpuRenderer::PACKET_SIZE;
+    Ray shadowRays[MAX_RAYS];
+    float dists[MAX_RAYS];
+    BoxCull cull = {lightPos, lightPos};
+    bool any = false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!active[i]) continue;
+        shadowRays[i] = {hits[i].point + hits[i].normal * 0.001f, normalize(lightPos - hits[i].point)};
+        dists[i] = length(lightPos - hits[i].point);
+        Vec3 o = shadowRays[i].origin;
+        cull.min = {std::min(cull.min.x, o.x), std::min(cull.min.y, o.y), std::min(cull.min.z, o.z)};
+        cull.max = {std::max(cull.max.x, o.x), std::max(cull.max.y, o.y), std::max(cull.max.z, o.z)};
+        any = true;
+    }
+    if (!any) return;
+
+    traceShadowPacket(scene, cullPacket(spheres, scratch, cull), shadowRays, dists, active, shadows, count, rays);
+}
+
+// Traces a block of up to PACKET_SIZE x PACKET_SIZE primary rays together.
+// Spheres are culled once against the block's frustum. When every ray hits
+// an opaque surface, the sun, point and spot light shadow rays are also
+// traced as packets. Later bounces are incoherent and go through continuePath.
+static void tracePacket(const Scene& scene, SphereSet spheres, const CameraBasis& camera, PacketScratch& scratch,
+                        uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, Vec3* colors, uint64_t& rays) {
+    constexpr uint32_t MAX_RAYS = CpuRenderer::PACKET_SIZE * CpuRenderer::PACKET_SIZE;
+    const uint32_t w = x1 - x0;
+    const uint32_t count = w * (y1 - y0);
+
+    Vec3 corners[4] = {
+        camera.pixelDirection(x0, y0), camera.pixelDirection(x1 - 1, y0),
+        camera.pixelDirection(x1 - 1, y1 - 1), camera.pixelDirection(x0, y1 - 1)
+    };
+    SphereSet primaryCandidates = cullPacket(spheres, scratch, FrustumCull(camera.position, corners));
+
+    PathState paths[MAX_RAYS];
+    HitInfo hits[MAX_RAYS];
+    bool allOpaque = true;
+    for (uint32_t i = 0; i < count; i++) {
+        Ray ray = {camera.position, normalize(camera.pixelDirection(x0 + i % w, y0 + i / w))};
+        paths[i] = {ray, {0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}};
+        hits[i] = traceScene(scene, primaryCandidates, ray);
+        rays++;
+        allOpaque = allOpaque && hits[i].hit && !isEmissive(hits[i]);
+    }
+
+    float sunShadows[MAX_RAYS];
+    float pointShadows[MAX_RAYS];
+    float spotShadows[MAX_RAYS];
+    if (allOpaque) {
+        bool active[MAX_RAYS];
+        for (uint32_t i = 0; i < count; i++) active[i] = true;
+
+        if (scene.sunEnabled) {
+            Vec3 lightDir = normalize(scene.sunDirection);
+            Ray shadowRays[MAX_RAYS];
+            float dists[MAX_RAYS];
+            BeamCull cull(lightDir);
+            for (uint32_t i = 0; i < count; i++) {
+                shadowRays[i] = {hits[i].point + hits[i].normal * 0.001f, lightDir};
+                dists[i] = 1e30f;
+                cull.addOrigin(shadowRays[i].origin);
+            }
+            traceShadowPacket(scene, cullPacket(spheres, scratch, cull), shadowRays, dists, active, sunShadows, count, rays);
+        }
+
+        tracePointShadowPacket(scene, spheres, scratch, scene.pointLight.position, hits, active, pointShadows, count, rays);
+
+        // Only hits inside the spot cone trace a shadow ray, as in directLight().
+        const SpotLight& spot = scene.spotLight;
+        for (uint32_t i = 0; i < count; i++) {
+            float theta = dot(normalize(spot.position - hits[i].point), normalize(-spot.direction));
+            active[i] = std::clamp((theta - spot.outerCutOff) / (spot.cutOff - spot.outerCutOff), 0.0f, 1.0f) > 0.0f;
+        }
+        tracePointShadowPacket(scene, spheres, scratch, spot.position, hits, active, spotShadows, count, rays);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        auto shadow = [&](int light, const Ray& shadowRay, float dist) {
+            if (allOpaque) {
+                if (light == SUN_LIGHT) return sunShadows[i];
+                if (light == POINT_LIGHT) return pointShadows[i];
+                return spotShadows[i];
+            }
+            rays++;
+            return shadowFactor(traceScene(scene, spheres, shadowRay), dist);
+        };
+        if (shadeBounce(scene, paths[i], hits[i], shadow)) {
+            continuePath(scene, spheres, paths[i], 1, rays);
+        }
+        colors[i] = paths[i].color;
+    }
+}
+
+static uint32_t packColor(Vec3 color) {
+    // Gamma Correction
+    auto channel = [](float c) {
+        c = std::pow(std::max(c, 0.0f), 1.0f / 2.2f);
+        return static_cast<uint32_t>(std::min(c, 1.0f) * 255.0f + 0.5f);
+    };
+    return channel(color.x) | (channel(color.y) << 8) | (channel(color.z) << 16) | (255u << 24);
+}
+
+CpuRenderer::CpuRenderer(unsigned threadCount) : jobs(threadCount) {}
+
+CpuRenderStats CpuRenderer::render(const Camera& camera, const Scene& scene, uint32_t width, uint32_t height, std::vector<uint32_t>& pixels) {
+    pixels.assign(static_cast<size_t>(width) * height, 0);
+
+    SphereSet sphereSet = {&spheres, nullptr};
+    AccelStructure accel = accelStructure == AccelStructure::Auto ? SphereGrid::choose(scene.spheres) : accelStructure;
+    if (accel == AccelStructure::Grid) {
+        grid.build(scene.spheres, &jobs);
+        spheres.build(scene.spheres, scene.materials.size());
+        sphereSet.grid = &grid;
+    } else if (scene.spheres.size() >= BVH_MIN_SPHERES) {
+        BvhBuildMethod method = scene.spheres.size() >= LBVH_MIN_SPHERES ? BvhBuildMethod::Lbvh : BvhBuildMethod::Sah;
+        if (!loadSourceBvh(scene, scene.spheres.size(), bvh)) bvh.build(scene.spheres, method, &jobs);
+        spheres.build(scene.spheres, bvh.primIndices, scene.materials.size());
+        sphereSet.bvh = &bvh;
+        if (wideBvhEnabled) {
+            wideBvh.build(bvh);
+            sphereSet.wide = &wideBvh;
+        }
+    } else {
+        spheres.build(scene.spheres, scene.materials.size());
+    }
+    if (!scene.instances.empty()) {
+        instanceBvh.build(scene);
+        sphereSet.instances = &instanceBvh;
+    }
+
+    // Camera Setup
+    CameraBasis basis;
+    basis.position = camera.position;
+    basis.forward = normalize(camera.getForward());
+    basis.right = normalize(cross({0.0f, 1.0f, 0.0f}, basis.forward));
+    basis.up = cross(basis.forward, basis.right);
+    basis.width = static_cast<float>(width);
+    basis.height = static_cast<float>(height);
+    basis.aspect = basis.width / basis.height;
+
+    uint32_t tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<RayCounter> counters(jobs.threadCount());
+    std::vector<PacketScratch> scratch(jobs.threadCount());
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    jobs.parallelFor(tilesX * tilesY, [&](uint32_t tile, unsigned worker) {
+        uint32_t x0 = (tile % tilesX) * TILE_SIZE;
+        uint32_t y0 = (tile / tilesX) * TILE_SIZE;
+        uint32_t x1 = std::min(x0 + TILE_SIZE, width);
+        uint32_t y1 = std::min(y0 + TILE_SIZE, height);
+        uint64_t rays = 0;
+
+        if (packetTracing) {
+            Vec3 colors[PACKET_SIZE * PACKET_SIZE];
+            for (uint32_t py = y0; py < y1; py += PACKET_SIZE) {
+                for (uint32_t px = x0; px < x1; px += PACKET_SIZE) {
+                    uint32_t px1 = std::min(px + PACKET_SIZE, x1);
+                    uint32_t py1 = std::min(py + PACKET_SIZE, y1);
+                    tracePacket(scene, sphereSet, basis, scratch[worker], px, py, px1, py1, colors, rays);
+
+                    uint32_t w = px1 - px;
+                    for (uint32_t y = py; y < py1; y++) {
+                        for (uint32_t x = px; x < px1; x++) {
+                            pixels[static_cast<size_t>(y) * width + x] = packColor(colors[(y - py) * w + (x - px)]);
+                        }
+                    }
+                }
+            }
+        } else {
+            for (uint32_t y = y0; y < y1; y++) {
+                for (uint32_t x = x0; x < x1; x++) {
+                    Ray ray = {basis.position, normalize(basis.pixelDirection(x, y))};
+                    pixels[static_cast<size_t>(y) * width + x] = packColor(tracePixel(scene, sphereSet, ray, rays));
+                }
+            }
+        }
+        counters[worker].rays += rays;
+    });
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    CpuRenderStats stats;
+    stats.seconds = std::chrono::duration<double>(end - start).count();
+    for (const RayCounter& counter : counters) {
+        stats.rays += counter.rays;
+    }
+    return stats;
+}
+
+bool CpuRenderer::writePpm(const std::string& filename, uint32_t width, uint32_t height, const std::vector<uint32_t>& pixels) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<char> row(static_cast<size_t>(width) * 3);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t p = pixels[static_cast<size_t>(y) * width + x];
+            row[x * 3 + 0] = static_cast<char>(p & 0xff);
+            row[x * 3 + 1] = static_cast<char>((p >> 8) & 0xff);
+            row[x * 3 + 2] = static_cast<char>((p >> 16) & 0xff);
+        }
+        file.write(row.data(), static_cast<std::streamsize>(row.size()));
+    }
+    return file.good();
+}
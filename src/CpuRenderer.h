@@ -0,0 +1,62 @@
+#pragma once
+#include "Camera.h"
+#include "Scene.h"
+#include "JobSystem.h"
+#include "SphereKernels.h"
+#include "Bvh.h"
+#include "Grid.h"
+#include "Instances.h"
+#include "WideBvh.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct CpuRenderStats {
+    uint64_t rays = 0;
+    double seconds = 0.0;
+
+    double raysPerSecond() const { return seconds > 0.0 ? static_cast<double>(rays) / seconds : 0.0; }
+};
+
+// Reference implementation of raytracer.frag for machines without a GPU.
+// The image is split into tiles that are traced on every core through the
+// work-stealing JobSystem; inside a tile, primary rays are traced as packets.
+class CpuRenderer {
+public:
+    explicit CpuRenderer(unsigned threadCount = 0);
+
+    // Traces one frame into RGBA8 pixels, row-major with the top row first.
+    CpuRenderStats render(const Camera& camera, const Scene& scene, uint32_t width, uint32_t height, std::vector<uint32_t>& pixels);
+
+    unsigned threadCount() const { return jobs.threadCount(); }
+
+    // Trace primary rays in PACKET_SIZE x PACKET_SIZE blocks (on by default).
+    void setPacketTracing(bool enabled) { packetTracing = enabled; }
+
+    // Trace BVH scenes through the quantized 4-wide BVH (on by default).
+    void setWideBvh(bool enabled) { wideBvhEnabled = enabled; }
+
+    // Grid or BVH, or Auto (the default) to let SphereGrid::choose() decide.
+    void setAccelStructure(AccelStructure accel) { accelStructure = accel; }
+
+    static constexpr uint32_t PACKET_SIZE = 8;
+
+    static bool writePpm(const std::string& filename, uint32_t width, uint32_t height, const std::vector<uint32_t>& pixels);
+
+private:
+    static constexpr uint32_t TILE_SIZE = 16;
+    // Smaller scenes are faster with the linear SIMD kernel than with a BVH.
+    static constexpr uint32_t BVH_MIN_SPHERES = 32;
+    // Past this the SAH build costs more than the faster traversal saves.
+    static constexpr uint32_t LBVH_MIN_SPHERES = 250000;
+
+    JobSystem jobs;
+    SphereSoA spheres;
+    Bvh bvh;
+    WideBvh wideBvh;
+    SphereGrid grid;
+    TwoLevelBvh instanceBvh;
+    bool packetTracing = true;
+    bool wideBvhEnabled = true;
+    AccelStructure accelStructure = AccelStructure::Auto;
+};
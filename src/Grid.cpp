@@ -0,0 +1,248 @@
+#include "Grid.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+// Work is split into chunks of this many spheres or cells.
+static constexpr uint32_t GRID_CHUNK_SIZE = 16384;
+
+const char* accelStructureName(AccelStructure accel) {
+    switch (accel) {
+        case AccelStructure::Auto: return "auto";
+        case AccelStructure::Bvh: return "BVH";
+        case AccelStructure::Grid: return "grid";
+    }
+    return "unknown";
+}
+
+// Bounds of all spheres and their radius statistics.
+struct SphereStats {
+    float boundsMin[3] = {1e30f, 1e30f, 1e30f};
+    float boundsMax[3] = {-1e30f, -1e30f, -1e30f};
+    double radiusSum = 0.0;
+    float maxRadius = 0.0f;
+
+    void grow(const SphereStats& other) {
+        for (int a = 0; a < 3; a++) {
+            boundsMin[a] = std::min(boundsMin[a], other.boundsMin[a]);
+            boundsMax[a] = std::max(boundsMax[a], other.boundsMax[a]);
+        }
+        radiusSum += other.radiusSum;
+        maxRadius = std::max(maxRadius, other.maxRadius);
+    }
+};
+
+static SphereStats computeStats(std::span<const Sphere> spheres, JobSystem* jobs) {
+    unsigned workerCount = jobs ? jobs->threadCount() : 1;
+    std::vector<SphereStats> workerStats(workerCount);
+    forEachChunk(jobs, static_cast<uint32_t>(spheres.size()), GRID_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned worker) {
+        SphereStats stats = workerStats[worker];
+        for (uint32_t i = begin; i < end; i++) {
+            const Sphere& s = spheres[i];
+            float center[3] = {s.center.x, s.center.y, s.center.z};
+            for (int a = 0; a < 3; a++) {
+                stats.boundsMin[a] = std::min(stats.boundsMin[a], center[a] - s.radius);
+                stats.boundsMax[a] = std::max(stats.boundsMax[a], center[a] + s.radius);
+            }
+            stats.radiusSum += s.radius;
+            stats.maxRadius = std::max(stats.maxRadius, s.radius);
+        }
+        workerStats[worker] = stats;
+    });
+
+    SphereStats stats;
+    for (const SphereStats& w : workerStats) stats.grow(w);
+    return stats;
+}
+
+static float meanRadius(const SphereStats& stats, size_t sphereCount) {
+    return static_cast<float>(stats.radiusSum / static_cast<double>(sphereCount));
+}
+
+// Cells along each axis for a cell edge of `size`; returns the total.
+static uint64_t cellsFor(const SphereStats& stats, float size, uint32_t dims[3]) {
+    uint64_t total = 1;
+    for (int a = 0; a < 3; a++) {
+        double cells = std::ceil(static_cast<double>(stats.boundsMax[a] - stats.boundsMin[a]) / size);
+        dims[a] = static_cast<uint32_t>(std::clamp(cells, 1.0, 4294967295.0));
+        total *= dims[a];
+    }
+    return total;
+}
+
+// Cell of coordinate x along one axis, clamped into the grid.
+static uint32_t cellCoord(float x, float boundsMin, float invCellSize, uint32_t dim) {
+    float cell = (x - boundsMin) * invCellSize;
+    return static_cast<uint32_t>(std::clamp(cell, 0.0f, static_cast<float>(dim - 1)));
+}
+
+void SphereGrid::clear() {
+    boundsMin = {0.0f, 0.0f, 0.0f};
+    cellSize = 0.0f;
+    dims[0] = dims[1] = dims[2] = 0;
+    cellStart.clear();
+    cellSpheres.clear();
+}
+
+GridHeader SphereGrid::header() const {
+    GridHeader h{};
+    h.boundsMin[0] = boundsMin.x;
+    h.boundsMin[1] = boundsMin.y;
+    h.boundsMin[2] = boundsMin.z;
+    h.cellSize = cellSize;
+    for (int a = 0; a < 3; a++) h.dims[a] = dims[a];
+    h.enabled = empty() ? 0u : 1u;
+    return h;
+}
+
+// Sphere lists are counted and then filled, both in parallel with atomic
+// counters; sorting each cell afterwards makes the result independent of
+// the thread count.
+void SphereGrid::build(std::span<const Sphere> spheres, JobSystem* jobs, uint32_t maxCells) {
+    clear();
+    if (spheres.empty()) return;
+
+    uint32_t count = static_cast<uint32_t>(spheres.size());
+    SphereStats stats = computeStats(spheres, jobs);
+    if (maxCells == 0) maxCells = static_cast<uint32_t>(std::min<uint64_t>(uint64_t(count) * MAX_CELLS_PER_SPHERE, UINT32_MAX));
+
+    // Cells a little larger than the spheres, grown until they fit the budget.
+    cellSize = std::max(2.0f * CELL_DIAMETERS * meanRadius(stats, count), 1e-6f);
+    while (cellsFor(stats, cellSize, dims) > maxCells || std::max({dims[0], dims[1], dims[2]}) > MAX_DIM) {
+        cellSize *= 1.25f;
+    }
+    boundsMin = {stats.boundsMin[0], stats.boundsMin[1], stats.boundsMin[2]};
+
+    const float invCellSize = 1.0f / cellSize;
+    const float gridMin[3] = {boundsMin.x, boundsMin.y, boundsMin.z};
+    auto forEachCell = [&](const Sphere& s, auto&& fn) {
+        float center[3] = {s.center.x, s.center.y, s.center.z};
+        uint32_t lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = cellCoord(center[a] - s.radius, gridMin[a], invCellSize, dims[a]);
+            hi[a] = cellCoord(center[a] + s.radius, gridMin[a], invCellSize, dims[a]);
+        }
+        for (uint32_t z = lo[2]; z <= hi[2]; z++) {
+            for (uint32_t y = lo[1]; y <= hi[1]; y++) {
+                for (uint32_t x = lo[0]; x <= hi[0]; x++) fn((z * dims[1] + y) * dims[0] + x);
+            }
+        }
+    };
+
+    // Plain increments when single threaded; locked ones cost several times more.
+    const bool parallel = jobs && jobs->threadCount() > 1;
+    auto increment = [parallel](uint32_t& counter) {
+        return parallel ? std::atomic_ref<uint32_t>(counter).fetch_add(1, std::memory_order_relaxed) : counter++;
+    };
+
+    uint32_t cells = cellCount();
+    cellStart.assign(static_cast<size_t>(cells) + 1, 0);
+    forEachChunk(jobs, count, GRID_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+        for (uint32_t i = begin; i < end; i++) {
+            forEachCell(spheres[i], [&](uint32_t cell) {
+                increment(cellStart[cell]);
+            });
+        }
+    });
+
+    uint32_t sum = 0;
+    for (uint32_t& start : cellStart) {
+        uint32_t n = start;
+        start = sum;
+        sum += n;
+    }
+
+    cellSpheres.resize(sum);
+    std::vector<uint32_t> cursor(cellStart.begin(), cellStart.end() - 1);
+    forEachChunk(jobs, count, GRID_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+        for (uint32_t i = begin; i < end; i++) {
+            forEachCell(spheres[i], [&](uint32_t cell) {
+                cellSpheres[increment(cursor[cell])] = i;
+            });
+        }
+    });
+
+    if (parallel) {
+        forEachChunk(jobs, cells, GRID_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, unsigned) {
+            for (uint32_t cell = begin; cell < end; cell++) {
+                std::sort(cellSpheres.begin() + cellStart[cell], cellSpheres.begin() + cellStart[cell + 1]);
+            }
+        });
+    }
+}
+
+AccelStructure SphereGrid::choose(std::span<const Sphere> spheres) {
+    if (spheres.size() < MIN_SPHERES) return AccelStructure::Bvh;
+
+    SphereStats stats = computeStats(spheres, nullptr);
+    float mean = meanRadius(stats, spheres.size());
+    if (stats.maxRadius > MAX_RADIUS_SPREAD * mean) return AccelStructure::Bvh;
+
+    uint32_t dims[3];
+    uint64_t cells = cellsFor(stats, std::max(2.0f * CELL_DIAMETERS * mean, 1e-6f), dims);
+    return cells <= uint64_t(spheres.size()) * MAX_CELLS_PER_SPHERE ? AccelStructure::Grid : AccelStructure::Bvh;
+}
+
+// 3D-DDA (Amanatides & Woo): visits the cells along the ray in order and
+// stops at the first cell whose exit lies beyond the closest hit so far.
+// Spheres spanning several cells may be tested more than once.
+SphereHit SphereGrid::intersect(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) const {
+    SphereHit best;
+    best.t = tMax;
+    if (empty()) return best;
+
+    const float o[3] = {origin.x, origin.y, origin.z};
+    const float d[3] = {direction.x, direction.y, direction.z};
+    const float gridMin[3] = {boundsMin.x, boundsMin.y, boundsMin.z};
+    float invDir[3];
+    float tNear = 0.0f, tFar = tMax;
+    for (int a = 0; a < 3; a++) {
+        invDir[a] = safeInverse(d[a]);
+        float t0 = (gridMin[a] - o[a]) * invDir[a];
+        float t1 = (gridMin[a] + dims[a] * cellSize - o[a]) * invDir[a];
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+    if (tNear > tFar) return best;
+
+    const float invCellSize = 1.0f / cellSize;
+    int32_t cell[3], step[3], end[3];
+    float tNext[3], tDelta[3];
+    for (int a = 0; a < 3; a++) {
+        cell[a] = static_cast<int32_t>(cellCoord(o[a] + d[a] * tNear, gridMin[a], invCellSize, dims[a]));
+        step[a] = d[a] >= 0.0f ? 1 : -1;
+        end[a] = d[a] >= 0.0f ? static_cast<int32_t>(dims[a]) : -1;
+        float boundary = gridMin[a] + static_cast<float>(cell[a] + (step[a] > 0 ? 1 : 0)) * cellSize;
+        tNext[a] = (boundary - o[a]) * invDir[a];
+        tDelta[a] = cellSize * std::abs(invDir[a]);
+    }
+
+    while (true) {
+        uint32_t index = (static_cast<uint32_t>(cell[2]) * dims[1] + static_cast<uint32_t>(cell[1])) * dims[0] + static_cast<uint32_t>(cell[0]);
+        for (uint32_t i = cellStart[index]; i < cellStart[index + 1]; i++) {
+            uint32_t lane = cellSpheres[i];
+            float ocx = origin.x - spheres.centerX[lane];
+            float ocy = origin.y - spheres.centerY[lane];
+            float ocz = origin.z - spheres.centerZ[lane];
+            float b = ocx * direction.x + ocy * direction.y + ocz * direction.z;
+            float c = ocx * ocx + ocy * ocy + ocz * ocz - spheres.radiusSq[lane];
+            float h = b * b - c;
+            if (h > 0.0f) {
+                float t = -b - std::sqrt(h);
+                if (t > 0.001f && t < best.t) {
+                    best.t = t;
+                    best.lane = static_cast<int32_t>(lane);
+                }
+            }
+        }
+
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        float tExit = tNext[axis];
+        if (best.t <= tExit || tExit > tFar) break;
+        cell[axis] += step[axis];
+        if (cell[axis] == end[axis]) break;
+        tNext[axis] += tDelta[axis];
+    }
+    return best;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Camera.h"
+#include "Scene.h"
+#include "SphereKernels.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Header of the grid buffer, shared with GridCells in raytracer.frag (std430).
+// cellStart[] follows it directly.
+struct GridHeader {
+    float boundsMin[3];
+    float cellSize;
+    uint32_t dims[3];
+    uint32_t enabled; // 0 makes the shader trace the BVH instead
+};
+static_assert(sizeof(GridHeader) == 32, "GridHeader must match the std430 layout in raytracer.frag");
+
+class JobSystem;
+
+enum class AccelStructure {
+    Auto, // Pick per scene with SphereGrid::choose()
+    Bvh,
+    Grid,
+};
+
+const char* accelStructureName(AccelStructure accel);
+
+// Uniform grid over Scene::spheres for dense fields of similar-sized spheres,
+// where it builds faster than a BVH and traverses with a plain 3D-DDA. Each
+// sphere is listed in every cell its bounding box overlaps; the lists are
+// packed CSR style, cell c owning cellSpheres[cellStart[c], cellStart[c + 1]).
+class SphereGrid {
+public:
+    // Cell edge in mean sphere diameters
+    static constexpr float CELL_DIAMETERS = 2.5f;
+    // Cells per sphere past which the cells are made larger
+    static constexpr uint32_t MAX_CELLS_PER_SPHERE = 8;
+    static constexpr uint32_t MAX_DIM = 1024;
+    // choose() only picks the grid for at least this many spheres whose
+    // largest radius is at most MAX_RADIUS_SPREAD times the mean.
+    static constexpr uint32_t MIN_SPHERES = 4096;
+    static constexpr float MAX_RADIUS_SPREAD = 4.0f;
+
+    Vec3 boundsMin = {0.0f, 0.0f, 0.0f};
+    float cellSize = 0.0f;
+    uint32_t dims[3] = {0, 0, 0};
+    std::vector<uint32_t> cellStart;   // cellCount() + 1 offsets into cellSpheres
+    std::vector<uint32_t> cellSpheres; // Index into Scene::spheres
+
+    // Spreads the work over `jobs` when given. maxCells caps the cell count
+    // (0 for the MAX_CELLS_PER_SPHERE default); cells grow to stay under it.
+    void build(std::span<const Sphere> spheres, JobSystem* jobs = nullptr, uint32_t maxCells = 0);
+    void clear();
+    bool empty() const { return cellStart.empty(); }
+    uint32_t cellCount() const { return dims[0] * dims[1] * dims[2]; }
+    GridHeader header() const;
+
+    // Closest hit, same contract as intersectSpheres(). `spheres` must hold
+    // the spheres in scene order (SphereSoA::build without an order).
+    SphereHit intersect(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) const;
+
+    // Grid for dense fields of similar radii, BVH for everything else: mixed
+    // sizes put big spheres in many cells, and sparse scenes would need huge
+    // cells to stay within the cell budget.
+    static AccelStructure choose(std::span<const Sphere> spheres);
+};
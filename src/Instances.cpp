@@ -0,0 +1,98 @@
+#include "Instances.h"
+#include <algorithm>
+#include <cmath>
+
+void TwoLevelBvh::clear() {
+    bottom.clear();
+    top.clear();
+    instanceBounds.clear();
+}
+
+Sphere TwoLevelBvh::boundsOf(const ClusterInstance& instance) const {
+    const BottomLevel& level = bottom[instance.cluster];
+    Sphere bounds{};
+    bounds.center = instance.toWorld(level.center);
+    bounds.radius = level.radius * instance.scale;
+    return bounds;
+}
+
+void TwoLevelBvh::buildBottom(const Scene& scene, size_t c) {
+    const std::vector<Sphere>& spheres = scene.clusters[c].spheres;
+    BottomLevel& level = bottom[c];
+    level.bvh.build(spheres);
+    level.spheres.build(spheres, level.bvh.primIndices, scene.materials.size());
+
+    // Bounding sphere around the center of the cluster's box
+    level.center = {0.0f, 0.0f, 0.0f};
+    level.radius = 0.0f;
+    if (spheres.empty()) return;
+    const BvhNode& root = level.bvh.nodes[0];
+    level.center = {(root.boundsMin[0] + root.boundsMax[0]) * 0.5f, (root.boundsMin[1] + root.boundsMax[1]) * 0.5f,
+                    (root.boundsMin[2] + root.boundsMax[2]) * 0.5f};
+    for (const Sphere& s : spheres) {
+        level.radius = std::max(level.radius, length(s.center - level.center) + s.radius);
+    }
+}
+
+void TwoLevelBvh::build(const Scene& scene) {
+    bottom.clear();
+    bottom.resize(scene.clusters.size());
+    for (size_t c = 0; c < scene.clusters.size(); c++) buildBottom(scene, c);
+    buildTop(scene);
+}
+
+void TwoLevelBvh::rebuildClusters(const Scene& scene, std::span<const uint32_t> clusters) {
+    bottom.resize(scene.clusters.size());
+    for (uint32_t c : clusters) buildBottom(scene, c);
+    buildTop(scene);
+}
+
+void TwoLevelBvh::buildTop(const Scene& scene) {
+    instanceBounds.resize(scene.instances.size());
+    for (size_t i = 0; i < scene.instances.size(); i++) instanceBounds[i] = boundsOf(scene.instances[i]);
+    top.build(instanceBounds);
+}
+
+bool TwoLevelBvh::update(const Scene& scene, std::span<const uint32_t> dirty, BvhDirtyNodes& changed) {
+    for (uint32_t i : dirty) instanceBounds[i] = boundsOf(scene.instances[i]);
+    top.refit(instanceBounds, dirty, changed);
+    if (!top.needsRebuild()) return false;
+
+    top.build(instanceBounds);
+    changed.markAll(static_cast<uint32_t>(top.nodes.size()));
+    return true;
+}
+
+InstanceHit TwoLevelBvh::intersect(const Scene& scene, Vec3 origin, Vec3 direction, float tMax) const {
+    InstanceHit best;
+    best.t = tMax;
+    top.traverse(origin, direction, best.t, [&](uint32_t first, uint32_t count, float& t) {
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t index = top.primIndices[i];
+            const ClusterInstance& instance = scene.instances[index];
+            const BottomLevel& level = bottom[instance.cluster];
+
+            // The local ray keeps a unit direction, so local distances are
+            // world distances divided by the scale.
+            float invScale = 1.0f / instance.scale;
+            SphereHit hit = level.bvh.intersect(level.spheres, instance.toLocal(origin), instance.directionToLocal(direction), t * invScale);
+            if (hit.lane >= 0) {
+                t = hit.t * instance.scale;
+                best.instance = static_cast<int32_t>(index);
+                best.material = level.spheres.material[hit.lane];
+                best.center = instance.toWorld({level.spheres.centerX[hit.lane], level.spheres.centerY[hit.lane], level.spheres.centerZ[hit.lane]});
+            }
+        }
+    });
+    return best;
+}
+
+size_t TwoLevelBvh::memoryBytes() const {
+    size_t bytes = top.nodes.size() * sizeof(BvhNode) + top.primIndices.size() * sizeof(uint32_t) +
+                   instanceBounds.size() * sizeof(Sphere);
+    for (const BottomLevel& level : bottom) {
+        bytes += level.bvh.nodes.size() * sizeof(BvhNode) + level.bvh.primIndices.size() * sizeof(uint32_t);
+        bytes += level.spheres.paddedCount() * (4 * sizeof(float) + sizeof(uint32_t));
+    }
+    return bytes;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "Bvh.h"
+#include "Scene.h"
+#include "SphereKernels.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Closest hit on instanced geometry.
+struct InstanceHit {
+    int32_t instance = -1; // Index into Scene::instances, -1 on a miss
+    uint32_t material = 0; // Index into Scene::materials
+    Vec3 center;           // World center of the sphere hit
+    float t = 0.0f;
+};
+
+// Two-level acceleration structure over Scene::instances. Every cluster gets
+// a bottom-level BVH in its local space, built once and shared by all of its
+// instances; the top level is a BVH over each instance's world bounding
+// sphere. Bounding spheres do not change when an instance rotates, so
+// moving instances only refits the top level.
+class TwoLevelBvh {
+public:
+    struct BottomLevel {
+        Bvh bvh;
+        SphereSoA spheres; // Cluster spheres in bvh.primIndices order
+        Vec3 center;       // Local bounding sphere of the cluster
+        float radius;
+    };
+
+    std::vector<BottomLevel> bottom;    // One per Scene::clusters entry
+    Bvh top;                            // Built over instanceBounds
+    std::vector<Sphere> instanceBounds; // World bounding sphere of each instance
+
+    // Builds both levels.
+    void build(const Scene& scene);
+    // Rebuilds only the top level, for added or removed instances.
+    void buildTop(const Scene& scene);
+    // Rebuilds the bottom levels of `clusters`, whose spheres changed, and
+    // then the top level, since their bounds may have changed too.
+    void rebuildClusters(const Scene& scene, std::span<const uint32_t> clusters);
+    // Refits the top level for `dirty` instances, marking the changed top
+    // nodes in `changed`. Returns true when it rebuilt the top level instead.
+    bool update(const Scene& scene, std::span<const uint32_t> dirty, BvhDirtyNodes& changed);
+    void clear();
+    bool empty() const { return top.empty(); }
+
+    // Closest hit along a normalized world space ray with 0.001 < t < tMax.
+    InstanceHit intersect(const Scene& scene, Vec3 origin, Vec3 direction, float tMax) const;
+
+    // Bytes held by both levels, sphere data included.
+    size_t memoryBytes() const;
+
+private:
+    void buildBottom(const Scene& scene, size_t c);
+    Sphere boundsOf(const ClusterInstance& instance) const;
+};
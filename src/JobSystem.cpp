@@ -0,0 +1,103 @@
+#include "JobSystem.h"
+#include <algorithm>
+
+JobSystem::JobSystem(unsigned threadCount) {
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    workers.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (unsigned i = 1; i < threadCount; i++) {
+        threads.emplace_back(&JobSystem::workerMain, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(batchMutex);
+        stopping = true;
+    }
+    batchCv.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void JobSystem::parallelFor(uint32_t count, const Task& fn) {
+    if (count == 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(batchMutex);
+        task = &fn;
+        pending.store(count);
+
+        // Hand out contiguous ranges so neighbouring items start on the same
+        // worker; stealing evens out whatever imbalance is left.
+        uint32_t n = static_cast<uint32_t>(workers.size());
+        for (uint32_t w = 0; w < n; w++) {
+            uint32_t begin = static_cast<uint32_t>(uint64_t(count) * w / n);
+            uint32_t end = static_cast<uint32_t>(uint64_t(count) * (w + 1) / n);
+            std::lock_guard<std::mutex> workerLock(workers[w]->mutex);
+            for (uint32_t i = begin; i < end; i++) {
+                workers[w]->tasks.push_back(i);
+            }
+        }
+        generation++;
+    }
+    batchCv.notify_all();
+
+    workLoop(0);
+
+    std::unique_lock<std::mutex> lock(batchMutex);
+    doneCv.wait(lock, [this] { return pending.load() == 0; });
+    task = nullptr;
+}
+
+void JobSystem::workerMain(unsigned index) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(batchMutex);
+            batchCv.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        workLoop(index);
+    }
+}
+
+void JobSystem::workLoop(unsigned index) {
+    uint32_t item;
+    while (popOrSteal(index, item)) {
+        (*task)(item, index);
+        if (pending.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            doneCv.notify_all();
+        }
+    }
+}
+
+bool JobSystem::popOrSteal(unsigned index, uint32_t& out) {
+    {
+        Worker& own = *workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            out = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    unsigned n = static_cast<unsigned>(workers.size());
+    for (unsigned offset = 1; offset < n; offset++) {
+        Worker& victim = *workers[(index + offset) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            out = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing pool. Each worker owns a deque of task indices; when it
+// runs dry it steals from the back of another worker's deque. The calling
+// thread takes part as worker 0, so a pool of N threads spawns N - 1.
+class JobSystem {
+public:
+    using Task = std::function<void(uint32_t index, unsigned worker)>;
+
+    explicit JobSystem(unsigned threadCount = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    unsigned threadCount() const { return static_cast<unsigned>(workers.size()); }
+
+    // Runs task(i, worker) for every i in [0, count) and blocks until all are done.
+    // Not reentrant: call from one thread at a time, never from inside a task.
+    void parallelFor(uint32_t count, const Task& task);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex batchMutex;
+    std::condition_variable batchCv;
+    std::condition_variable doneCv;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    const Task* task = nullptr;
+    std::atomic<uint32_t> pending{0};
+
+    void workerMain(unsigned index);
+    void workLoop(unsigned index);
+    bool popOrSteal(unsigned index, uint32_t& out);
+};
+
+// Runs fn(begin, end, worker) over [0, count) in chunks of chunkSize, spread
+// over the job system when there is one and serially on the caller otherwise.
+template <typename Fn>
+void forEachChunk(JobSystem* jobs, uint32_t count, uint32_t chunkSize, Fn&& fn) {
+    uint32_t chunks = (count + chunkSize - 1) / chunkSize;
+    auto runChunk = [&](uint32_t chunk, unsigned worker) {
+        fn(chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize), worker);
+    };
+    if (jobs && chunks > 1) {
+        jobs->parallelFor(chunks, runChunk);
+    } else {
+        for (uint32_t chunk = 0; chunk < chunks; chunk++) runChunk(chunk, 0);
+    }
+}
@@ -1,10 +1,135 @@
 #include "Renderer.h"
+#include "SceneFile.h"
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <cmath>
 #include <imgui.h>
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
+// Stages that read the scene: the fragment tracing path, or the compute one
+// and the composite pass after it
+const VkShaderStageFlags TRACE_STAGES = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+// Workgroup size of raytracer.comp, a tile of pixels
+const uint32_t TRACE_TILE_SIZE = 8;
+// HDR-capable format of the compute path's image; storage support is required
+const VkFormat TRACE_IMAGE_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+// Full float, so thousands of samples still average without banding
+const VkFormat ACCUMULATION_IMAGE_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+// Past this the average barely moves; tracing stops until something changes.
+const uint32_t MAX_ACCUMULATED_SAMPLES = 4096;
+// Dynamic resolution: the smallest traced fraction of the swapchain size,
+// how far each step goes toward the scale that would meet the target, and
+// the relative frame time error left alone
+const float MIN_RENDER_SCALE = 0.25f;
+const float RENDER_SCALE_DAMPING = 0.5f;
+const float RENDER_SCALE_DEADBAND = 0.1f;
+// Every this many frames a checkerboard frame is traced in full to measure
+// how well the skipped half would have been reconstructed.
+const uint32_t CHECKERBOARD_VALIDATION_PERIOD = 32;
+// CheckerboardStats in checkerboard.comp
+struct CheckerboardStats {
+    uint32_t errorLow, errorHigh, pixels;
+};
+// Wavefront tracing: kernels in the order record_wavefront dispatches them,
+// the pixels traced per batch, which bounds the queues, and the workgroup
+// size of the queue kernels. Both sizes must match wavefront_common.glsl.
+enum WavefrontStage {
+    WAVEFRONT_GENERATE,
+    WAVEFRONT_INTERSECT,
+    WAVEFRONT_SHADE,
+    WAVEFRONT_ARGS,
+    WAVEFRONT_SHADOW,
+    WAVEFRONT_RESOLVE,
+    WAVEFRONT_STAGE_COUNT
+};
+
+const char* WAVEFRONT_SHADERS[WAVEFRONT_STAGE_COUNT] = {
+    "shaders/wavefront_generate.comp.spv",
+    "shaders/wavefront_intersect.comp.spv",
+    "shaders/wavefront_shade.comp.spv",
+    "shaders/wavefront_args.comp.spv",
+    "shaders/wavefront_shadow.comp.spv",
+    "shaders/wavefront_resolve.comp.spv",
+};
+
+const uint32_t WAVEFRONT_BATCH = 1 << 18;
+const uint32_t WAVEFRONT_GROUP_SIZE = 64;
+const uint32_t WAVEFRONT_BOUNCES = 3;      // MAX_BOUNCES in raytracer_common.glsl
+const uint32_t WAVEFRONT_LIGHTS = 3;       // LIGHT_COUNT, shadow rays per hit at most
+const uint32_t WAVEFRONT_PATH_BYTES = 32;  // PathRay and PathHit
+// WavefrontCounters in wavefront_common.glsl
+struct WavefrontCounters {
+    VkDispatchIndirectCommand intersectArgs;
+    uint32_t rayCount;
+    VkDispatchIndirectCommand shadowArgs;
+    uint32_t shadowCount;
+    uint32_t rayLaunch;
+    uint32_t shadowLaunch;
+};
+
+// Sphere-sized buffers start out with room for this many spheres and grow
+// geometrically with the scene, see reserve_sphere_buffers.
+const uint32_t INITIAL_SPHERE_CAPACITY = 1024;
+const uint32_t INITIAL_GRID_CELLS = SphereGrid::MAX_CELLS_PER_SPHERE * INITIAL_SPHERE_CAPACITY;
+const uint32_t INITIAL_GRID_REFS = 8 * INITIAL_SPHERE_CAPACITY;
+const uint32_t INITIAL_MATERIAL_CAPACITY = 64;
+const uint32_t INITIAL_INSTANCE_CAPACITY = 1024;
+const uint32_t INITIAL_CLUSTER_SPHERE_CAPACITY = 4096;
+
+// Each frame's staging segment starts at this size and grows to fit the
+// largest upload seen.
+const VkDeviceSize STAGING_MIN_SIZE = 1 << 20;
+
+// BVH capacities for `spheres` spheres. Every wide node but a lone leaf root
+// has at least two children.
+static uint32_t bvh_node_capacity(uint32_t spheres) { return 2 * spheres - 1; }
+static uint32_t wide_bvh_node_capacity(uint32_t spheres) { return spheres; }
+// Instance buffer ranges. The top level comes first, bottom levels start at
+// the top level's node capacity in the node range and at the instance
+// capacity in the prim range.
+static uint32_t instance_node_capacity(uint32_t instances, uint32_t clusterSpheres) {
+    return bvh_node_capacity(instances) + 2 * clusterSpheres;
+}
+static uint32_t instance_prim_capacity(uint32_t instances, uint32_t clusterSpheres) { return instances + clusterSpheres; }
+
+// GPU BVH build stages, dispatched in this order by record_bvh_build
+enum BvhBuildStage {
+    BVH_BUILD_CENTROIDS,
+    BVH_BUILD_MORTON,
+    BVH_BUILD_RADIX_COUNT,
+    BVH_BUILD_RADIX_SCAN,
+    BVH_BUILD_RADIX_SCATTER,
+    BVH_BUILD_EMIT,
+    BVH_BUILD_BOUNDS,
+    BVH_BUILD_STAGE_COUNT
+};
+
+const char* BVH_BUILD_SHADERS[BVH_BUILD_STAGE_COUNT] = {
+    "shaders/bvh_centroids.comp.spv",
+    "shaders/bvh_morton.comp.spv",
+    "shaders/bvh_radix_count.comp.spv",
+    "shaders/bvh_radix_scan.comp.spv",
+    "shaders/bvh_radix_scatter.comp.spv",
+    "shaders/bvh_emit.comp.spv",
+    "shaders/bvh_bounds.comp.spv",
+};
+
+const uint32_t BVH_BUILD_BINDINGS = 9;
+const uint32_t RADIX_BITS = 4;
+const uint32_t RADIX_BUCKETS = 1 << RADIX_BITS;
+const uint32_t RADIX_ITEMS = 64; // Keys per radix sort thread, must match bvh_build_common.glsl
+const uint32_t BVH_STATE_HEADER = 8 * sizeof(uint32_t);
+
+// Matches BuildParams in bvh_build_common.glsl
+struct BvhBuildParams {
+    uint32_t sphereCount;
+    uint32_t shift;
+    uint32_t blockCount;
+    uint32_t padding;
+};
 
 Renderer::Renderer() {}
 
@@ -23,15 +148,34 @@ bool Renderer::init(SDL_Window* window) {
     if (create_render_pass() != 0) { std::cerr << "Render pass creation failed" << std::endl; return false; }
     if (create_descriptor_set_layout() != 0) { std::cerr << "Descriptor set layout creation failed" << std::endl; return false; }
     if (create_graphics_pipeline() != 0) { std::cerr << "Graphics pipeline creation failed" << std::endl; return false; }
+    if (create_bvh_build_pipelines() != 0) { std::cerr << "BVH build pipeline creation failed" << std::endl; return false; }
+    if (create_trace_pipeline() != 0) { std::cerr << "Compute trace pipeline creation failed" << std::endl; return false; }
     std::cout << "Graphics pipeline created." << std::endl;
     if (create_framebuffers() != 0) { std::cerr << "Framebuffer creation failed" << std::endl; return false; }
     if (create_command_pool() != 0) { std::cerr << "Command pool creation failed" << std::endl; return false; }
     if (create_uniform_buffers() != 0) { std::cerr << "Uniform buffer creation failed" << std::endl; return false; }
+    if (create_staging_buffers() != 0) { std::cerr << "Staging buffer creation failed" << std::endl; return false; }
+    sphere_capacity = INITIAL_SPHERE_CAPACITY;
+    grid_cell_capacity = INITIAL_GRID_CELLS;
+    grid_ref_capacity = INITIAL_GRID_REFS;
+    material_capacity = INITIAL_MATERIAL_CAPACITY;
+    instance_capacity = INITIAL_INSTANCE_CAPACITY;
+    cluster_sphere_capacity = INITIAL_CLUSTER_SPHERE_CAPACITY;
     if (create_scene_buffers() != 0) { std::cerr << "Scene buffer creation failed" << std::endl; return false; }
+    if (create_material_buffers() != 0) { std::cerr << "Material buffer creation failed" << std::endl; return false; }
+    if (create_bvh_buffers() != 0) { std::cerr << "BVH buffer creation failed" << std::endl; return false; }
+    if (create_bvh_scratch_buffers() != 0) { std::cerr << "BVH scratch buffer creation failed" << std::endl; return false; }
+    if (create_grid_buffers() != 0) { std::cerr << "Grid buffer creation failed" << std::endl; return false; }
+    if (create_instance_buffers() != 0) { std::cerr << "Instance buffer creation failed" << std::endl; return false; }
+    if (create_trace_images() != 0) { std::cerr << "Trace image creation failed" << std::endl; return false; }
+    if (create_checkerboard_stats_buffers() != 0) { std::cerr << "Checkerboard stats buffer creation failed" << std::endl; return false; }
+    if (create_wavefront_buffers() != 0) { std::cerr << "Wavefront buffer creation failed" << std::endl; return false; }
     if (create_descriptor_pool() != 0) { std::cerr << "Descriptor pool creation failed" << std::endl; return false; }
     if (create_descriptor_sets() != 0) { std::cerr << "Descriptor sets creation failed" << std::endl; return false; }
+    if (create_bvh_build_descriptor_sets() != 0) { std::cerr << "BVH build descriptor sets creation failed" << std::endl; return false; }
     if (create_command_buffers() != 0) { std::cerr << "Command buffers creation failed" << std::endl; return false; }
     if (create_sync_objects() != 0) { std::cerr << "Sync objects creation failed" << std::endl; return false; }
+    if (create_timestamp_queries() != 0) { std::cerr << "Timestamp query pool creation failed" << std::endl; return false; }
     if (init_imgui() != 0) { std::cerr << "ImGui init failed" << std::endl; return false; }
     std::cout << "Renderer initialized successfully." << std::endl;
     return true;
@@ -121,6 +265,12 @@ int Renderer::device_initialization() {
     init_data.device = device_ret.value();
     init_data.disp = init_data.device.make_table();
 
+    // The BVH nodes are the largest per-sphere range bound to a shader.
+    VkDeviceSize maxRange = init_data.device.physical_device.properties.limits.maxStorageBufferRange;
+    max_gpu_spheres = static_cast<size_t>(std::min<VkDeviceSize>(maxRange / (2 * sizeof(BvhNode)), UINT32_MAX / 2));
+
+    // Only discrete GPUs read host memory across the bus.
+    device_local_scene = init_data.device.physical_device.properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
     return 0;
 }
 
@@ -146,6 +296,19 @@ int Renderer::get_queues() {
     auto pq = init_data.device.get_queue(vkb::QueueType::present);
     if (!pq.has_value()) return -1;
     render_data.present_queue = pq.value();
+
+    // Staged uploads go to a separate transfer queue when the device has
+    // one, otherwise they are recorded ahead of the frame's own commands.
+    render_data.graphics_family = init_data.device.get_queue_index(vkb::QueueType::graphics).value();
+    render_data.transfer_queue = render_data.graphics_queue;
+    render_data.transfer_family = render_data.graphics_family;
+    auto tq = init_data.device.get_queue(vkb::QueueType::transfer);
+    auto tf = init_data.device.get_queue_index(vkb::QueueType::transfer);
+    if (device_local_scene && tq.has_value() && tf.has_value() && tf.value() != render_data.graphics_family) {
+        render_data.transfer_queue = tq.value();
+        render_data.transfer_family = tf.value();
+    }
+    std::cout << "Scene data: " << (!device_local_scene ? "host visible" : render_data.transfer_queue != render_data.graphics_queue ? "device local, transfer queue uploads" : "device local, graphics queue uploads") << std::endl;
     return 0;
 }
 
@@ -214,21 +377,97 @@ VkShaderModule Renderer::createShaderModule(const std::vector<char>& code) {
 int Renderer::create_descriptor_set_layout() {
     VkDescriptorSetLayoutBinding uboLayoutBinding{};
     uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    uboLayoutBinding.stageFlags = TRACE_STAGES;
 
     VkDescriptorSetLayoutBinding sceneLayoutBinding{};
     sceneLayoutBinding.binding = 1;
     sceneLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     sceneLayoutBinding.descriptorCount = 1;
-    sceneLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    sceneLayoutBinding.stageFlags = TRACE_STAGES;
+
+    VkDescriptorSetLayoutBinding bvhNodesLayoutBinding{};
+    bvhNodesLayoutBinding.binding = 2;
+    bvhNodesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bvhNodesLayoutBinding.descriptorCount = 1;
+    bvhNodesLayoutBinding.stageFlags = TRACE_STAGES;
+
+    VkDescriptorSetLayoutBinding bvhIndicesLayoutBinding{};
+    bvhIndicesLayoutBinding.binding = 3;
+    bvhIndicesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bvhIndicesLayoutBinding.descriptorCount = 1;
+    bvhIndicesLayoutBinding.stageFlags = TRACE_STAGES;
+
+    VkDescriptorSetLayoutBinding gridCellsLayoutBinding{};
+    gridCellsLayoutBinding.binding = 4;
+    gridCellsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    gridCellsLayoutBinding.descriptorCount = 1;
+    gridCellsLayoutBinding.stageFlags = TRACE_STAGES;
+
+    VkDescriptorSetLayoutBinding gridSpheresLayoutBinding{};
+    gridSpheresLayoutBinding.binding = 5;
+    gridSpheresLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    gridSpheresLayoutBinding.descriptorCount = 1;
+    gridSpheresLayoutBinding.stageFlags = TRACE_STAGES;
+
+    VkDescriptorSetLayoutBinding wideBvhLayoutBinding{};
+    wideBvhLayoutBinding.binding = 10;
+    wideBvhLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    wideBvhLayoutBinding.descriptorCount = 1;
+    wideBvhLayoutBinding.stageFlags = TRACE_STAGES;
+
+    // Material indices of the scene and of the cluster spheres, then the
+    // material table they index
+    VkDescriptorSetLayoutBinding materialLayoutBindings[3]{};
+    for (uint32_t i = 0; i < 3; i++) {
+        materialLayoutBindings[i].binding = 11 + i;
+        materialLayoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        materialLayoutBindings[i].descriptorCount = 1;
+        materialLayoutBindings[i].stageFlags = TRACE_STAGES;
+    }
 
-    VkDescriptorSetLayoutBinding bindings[] = {uboLayoutBinding, sceneLayoutBinding};
+    // Instance nodes, prims, transforms and cluster spheres
+    VkDescriptorSetLayoutBinding instanceLayoutBindings[4]{};
+    for (uint32_t i = 0; i < 4; i++) {
+        instanceLayoutBindings[i].binding = 6 + i;
+        instanceLayoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        instanceLayoutBindings[i].descriptorCount = 1;
+        instanceLayoutBindings[i].stageFlags = TRACE_STAGES;
+    }
+
+    // Written by the compute tracing path, read by the composite pass
+    VkDescriptorSetLayoutBinding tracedImageLayoutBinding{};
+    tracedImageLayoutBinding.binding = 14;
+    tracedImageLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    tracedImageLayoutBinding.descriptorCount = 1;
+    tracedImageLayoutBinding.stageFlags = TRACE_STAGES;
+    VkDescriptorSetLayoutBinding accumulationLayoutBinding = tracedImageLayoutBinding;
+    accumulationLayoutBinding.binding = 15;
+    // This frame's reprojection history, then the previous frame's
+    VkDescriptorSetLayoutBinding historyLayoutBindings[2] = {tracedImageLayoutBinding, tracedImageLayoutBinding};
+    historyLayoutBindings[0].binding = 16;
+    historyLayoutBindings[1].binding = 17;
+    VkDescriptorSetLayoutBinding checkerboardStatsLayoutBinding = materialLayoutBindings[0];
+    checkerboardStatsLayoutBinding.binding = 18;
+    // Wavefront ray queues, hits, shadow queue, radiance and counters
+    VkDescriptorSetLayoutBinding wavefrontLayoutBindings[5]{};
+    for (uint32_t i = 0; i < 5; i++) {
+        wavefrontLayoutBindings[i] = materialLayoutBindings[0];
+        wavefrontLayoutBindings[i].binding = 19 + i;
+    }
+
+    VkDescriptorSetLayoutBinding bindings[] = {uboLayoutBinding, sceneLayoutBinding, bvhNodesLayoutBinding, bvhIndicesLayoutBinding,
+                                               gridCellsLayoutBinding, gridSpheresLayoutBinding,
+                                               instanceLayoutBindings[0], instanceLayoutBindings[1], instanceLayoutBindings[2], instanceLayoutBindings[3],
+                                               wideBvhLayoutBinding, materialLayoutBindings[0], materialLayoutBindings[1], materialLayoutBindings[2],
+                                               tracedImageLayoutBinding, accumulationLayoutBinding, historyLayoutBindings[0], historyLayoutBindings[1],
+                                               checkerboardStatsLayoutBinding, wavefrontLayoutBindings[0], wavefrontLayoutBindings[1],
+                                               wavefrontLayoutBindings[2], wavefrontLayoutBindings[3], wavefrontLayoutBindings[4]};
 
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 2;
+    layoutInfo.bindingCount = 24;
     layoutInfo.pBindings = bindings;
 
     if (init_data.disp.createDescriptorSetLayout(&layoutInfo, nullptr, &render_data.descriptor_set_layout) != VK_SUCCESS) return -1;
@@ -310,10 +549,17 @@ int Renderer::create_graphics_pipeline() {
     color_blending.attachmentCount = 1;
     color_blending.pAttachments = &colorBlendAttachment;
 
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = TRACE_STAGES;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(FrameConstants);
+
     VkPipelineLayoutCreateInfo pipeline_layout_info = {};
     pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipeline_layout_info.setLayoutCount = 1;
     pipeline_layout_info.pSetLayouts = &render_data.descriptor_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &pushRange;
 
     if (init_data.disp.createPipelineLayout(&pipeline_layout_info, nullptr, &render_data.pipeline_layout) != VK_SUCCESS) return -1;
 
@@ -340,8 +586,92 @@ int Renderer::create_graphics_pipeline() {
 
     if (init_data.disp.createGraphicsPipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &render_data.graphics_pipeline) != VK_SUCCESS) return -1;
 
+    // The composite pass only swaps the fragment shader.
+    VkShaderModule composite_module = createShaderModule(readFile("shaders/composite.frag.spv"));
+    if (composite_module == VK_NULL_HANDLE) return -1;
+    shader_stages[1].module = composite_module;
+    VkResult result = init_data.disp.createGraphicsPipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &render_data.composite_pipeline);
+
+    init_data.disp.destroyShaderModule(composite_module, nullptr);
     init_data.disp.destroyShaderModule(frag_module, nullptr);
     init_data.disp.destroyShaderModule(vert_module, nullptr);
+    return result == VK_SUCCESS ? 0 : -1;
+}
+
+// The compute tracing pass and the checkerboard pass after it, both on the
+// graphics pipeline layout
+int Renderer::create_trace_pipeline() {
+    render_data.wavefront_pipelines.resize(WAVEFRONT_STAGE_COUNT, VK_NULL_HANDLE);
+    struct Pass { const char* path; VkPipeline* pipeline; };
+    std::vector<Pass> passes = {
+        {"shaders/raytracer.comp.spv", &render_data.trace_pipeline},
+        {"shaders/checkerboard.comp.spv", &render_data.checkerboard_pipeline},
+    };
+    for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; stage++) passes.push_back({WAVEFRONT_SHADERS[stage], &render_data.wavefront_pipelines[stage]});
+    for (const auto& pass : passes) {
+        VkShaderModule module = createShaderModule(readFile(pass.path));
+        if (module == VK_NULL_HANDLE) return -1;
+
+        VkComputePipelineCreateInfo pipeline_info = {};
+        pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipeline_info.stage.module = module;
+        pipeline_info.stage.pName = "main";
+        pipeline_info.layout = render_data.pipeline_layout;
+
+        VkResult result = init_data.disp.createComputePipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, pass.pipeline);
+        init_data.disp.destroyShaderModule(module, nullptr);
+        if (result != VK_SUCCESS) return -1;
+    }
+    return 0;
+}
+
+int Renderer::create_bvh_build_pipelines() {
+    VkDescriptorSetLayoutBinding bindings[BVH_BUILD_BINDINGS]{};
+    for (uint32_t i = 0; i < BVH_BUILD_BINDINGS; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = BVH_BUILD_BINDINGS;
+    layoutInfo.pBindings = bindings;
+    if (init_data.disp.createDescriptorSetLayout(&layoutInfo, nullptr, &render_data.bvh_build_set_layout) != VK_SUCCESS) return -1;
+
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(BvhBuildParams);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &render_data.bvh_build_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &pushRange;
+    if (init_data.disp.createPipelineLayout(&pipeline_layout_info, nullptr, &render_data.bvh_build_pipeline_layout) != VK_SUCCESS) return -1;
+
+    render_data.bvh_build_pipelines.resize(BVH_BUILD_STAGE_COUNT, VK_NULL_HANDLE);
+    for (int stage = 0; stage < BVH_BUILD_STAGE_COUNT; stage++) {
+        VkShaderModule module = createShaderModule(readFile(BVH_BUILD_SHADERS[stage]));
+        if (module == VK_NULL_HANDLE) return -1;
+
+        VkComputePipelineCreateInfo pipeline_info = {};
+        pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipeline_info.stage.module = module;
+        pipeline_info.stage.pName = "main";
+        pipeline_info.layout = render_data.bvh_build_pipeline_layout;
+
+        VkResult result = init_data.disp.createComputePipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &render_data.bvh_build_pipelines[stage]);
+        init_data.disp.destroyShaderModule(module, nullptr);
+        if (result != VK_SUCCESS) return -1;
+    }
     return 0;
 }
 
@@ -375,110 +705,349 @@ int Renderer::create_command_pool() {
     pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     if (init_data.disp.createCommandPool(&pool_info, nullptr, &render_data.command_pool) != VK_SUCCESS) return -1;
+
+    if (render_data.transfer_queue == render_data.graphics_queue) return 0;
+    pool_info.queueFamilyIndex = render_data.transfer_family;
+    if (init_data.disp.createCommandPool(&pool_info, nullptr, &render_data.transfer_command_pool) != VK_SUCCESS) return -1;
     return 0;
 }
 
-void Renderer::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+uint32_t Renderer::find_memory_type(uint32_t typeBits, VkMemoryPropertyFlags properties) const {
+    VkPhysicalDeviceMemoryProperties memProperties;
+    init_data.inst_disp.getPhysicalDeviceMemoryProperties(init_data.device.physical_device, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeBits & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) return i;
+    }
+    return UINT32_MAX;
+}
+
+// On failure nothing is left allocated and both handles are null.
+int Renderer::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    buffer = VK_NULL_HANDLE;
+    bufferMemory = VK_NULL_HANDLE;
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // Copy destinations may be written by the transfer queue and read by the
+    // graphics queue; concurrent sharing spares the ownership transfers.
+    uint32_t families[] = {render_data.graphics_family, render_data.transfer_family};
+    if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) && families[0] != families[1]) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = families;
+    }
 
-    init_data.disp.createBuffer(&bufferInfo, nullptr, &buffer);
+    if (init_data.disp.createBuffer(&bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        buffer = VK_NULL_HANDLE;
+        return -1;
+    }
 
     VkMemoryRequirements memRequirements;
     init_data.disp.getBufferMemoryRequirements(buffer, &memRequirements);
 
-    VkPhysicalDeviceMemoryProperties memProperties;
-    init_data.inst_disp.getPhysicalDeviceMemoryProperties(init_data.device.physical_device, &memProperties);
-
-    uint32_t typeIndex = -1;
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((memRequirements.memoryTypeBits & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            typeIndex = i;
-            break;
-        }
-    }
-
     VkMemoryAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = typeIndex;
+    allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, properties);
 
-    init_data.disp.allocateMemory(&allocInfo, nullptr, &bufferMemory);
-    init_data.disp.bindBufferMemory(buffer, bufferMemory, 0);
+    if (allocInfo.memoryTypeIndex == UINT32_MAX || init_data.disp.allocateMemory(&allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+        bufferMemory = VK_NULL_HANDLE;
+        destroy_buffer(buffer, bufferMemory);
+        return -1;
+    }
+    if (init_data.disp.bindBufferMemory(buffer, bufferMemory, 0) != VK_SUCCESS) {
+        destroy_buffer(buffer, bufferMemory);
+        return -1;
+    }
+    return 0;
 }
 
-int Renderer::create_uniform_buffers() {
-    VkDeviceSize bufferSize = sizeof(Uniforms);
-    render_data.uniform_buffers.resize(MAX_FRAMES_IN_FLIGHT);
-    render_data.uniform_buffers_memory.resize(MAX_FRAMES_IN_FLIGHT);
-    render_data.uniform_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+void Renderer::destroy_buffer(VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    init_data.disp.destroyBuffer(buffer, nullptr);
+    init_data.disp.freeMemory(bufferMemory, nullptr);
+    buffer = VK_NULL_HANDLE;
+    bufferMemory = VK_NULL_HANDLE;
+}
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        create_buffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, render_data.uniform_buffers[i], render_data.uniform_buffers_memory[i]);
-        init_data.disp.mapMemory(render_data.uniform_buffers_memory[i], 0, bufferSize, 0, &render_data.uniform_buffers_mapped[i]);
+// Scene and acceleration data live in device-local memory and are written
+// through the staging ring. Where device memory is host memory anyway
+// (integrated and software devices) they stay host visible and mapped.
+int Renderer::create_scene_data_buffer(VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& bufferMemory, void*& mapped) {
+    mapped = nullptr;
+    if (device_local_scene) {
+        return create_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+    }
+    if (create_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory) != 0) return -1;
+    if (init_data.disp.mapMemory(bufferMemory, 0, size, 0, &mapped) != VK_SUCCESS) {
+        mapped = nullptr;
+        destroy_buffer(buffer, bufferMemory);
+        return -1;
     }
     return 0;
 }
 
-struct SphereGPU {
-    float center[3];
-    float radius;
-    float color[3];
-    float roughness;
-};
+// Returns where to write `size` bytes meant for `offset` in `buffer`: its
+// mapped memory, or space in this frame's staging segment that is copied
+// over before the frame's commands run. The pointer is valid until the next
+// call.
+void* Renderer::upload_target(VkBuffer buffer, void* mapped, VkDeviceSize offset, VkDeviceSize size) {
+    if (mapped) return static_cast<char*>(mapped) + offset;
+
+    size_t frame = render_data.current_frame;
+    VkDeviceSize start = (render_data.staging_used[frame] + 15) & ~VkDeviceSize(15);
+    if (start + size > render_data.staging_capacity[frame]) {
+        // This frame's fence has signaled, so its segment is idle and can be
+        // replaced; what was staged so far moves along.
+        VkDeviceSize capacity = std::max(2 * render_data.staging_capacity[frame], std::max(start + size, STAGING_MIN_SIZE));
+        VkBuffer staging;
+        VkDeviceMemory stagingMemory;
+        void* stagingMapped = nullptr;
+        if (create_buffer(capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging, stagingMemory) != 0 ||
+            init_data.disp.mapMemory(stagingMemory, 0, capacity, 0, &stagingMapped) != VK_SUCCESS) {
+            destroy_buffer(staging, stagingMemory);
+            if (!staging_failed) std::cerr << "Staging buffer of " << capacity << " bytes could not be allocated" << std::endl;
+            staging_failed = true;
+            if (staging_discard.size() < size) staging_discard.resize(size);
+            return staging_discard.data();
+        }
+        if (render_data.staging_used[frame] > 0) memcpy(stagingMapped, render_data.staging_buffers_mapped[frame], render_data.staging_used[frame]);
+        init_data.disp.destroyBuffer(render_data.staging_buffers[frame], nullptr);
+        init_data.disp.freeMemory(render_data.staging_buffers_memory[frame], nullptr);
+        render_data.staging_buffers[frame] = staging;
+        render_data.staging_buffers_memory[frame] = stagingMemory;
+        render_data.staging_buffers_mapped[frame] = stagingMapped;
+        render_data.staging_capacity[frame] = capacity;
+    }
+    render_data.staging_used[frame] = start + size;
+
+    // Back to back writes to the same buffer become one copy region.
+    std::vector<StagedCopy>& copies = render_data.staging_copies[frame];
+    if (!copies.empty() && copies.back().buffer == buffer && copies.back().region.srcOffset + copies.back().region.size == start &&
+        copies.back().region.dstOffset + copies.back().region.size == offset) {
+        copies.back().region.size += size;
+    } else if (size > 0) {
+        copies.push_back({buffer, {start, offset, size}});
+    }
+    staged_bytes += size;
+    return static_cast<char*>(render_data.staging_buffers_mapped[frame]) + start;
+}
 
-struct PointLightGPU {
-    float position[3];
-    float intensity;
-    float color[3];
-    float padding;
-};
+// Records this frame's staged copies into `commandBuffer`.
+void Renderer::record_uploads(VkCommandBuffer commandBuffer) {
+    size_t frame = render_data.current_frame;
+    std::vector<StagedCopy>& copies = render_data.staging_copies[frame];
+    if (copies.empty()) return;
+
+    std::vector<VkBufferCopy> regions;
+    for (size_t i = 0; i < copies.size(); i++) {
+        regions.push_back(copies[i].region);
+        if (i + 1 < copies.size() && copies[i + 1].buffer == copies[i].buffer) continue;
+        init_data.disp.cmdCopyBuffer(commandBuffer, render_data.staging_buffers[frame], copies[i].buffer, static_cast<uint32_t>(regions.size()), regions.data());
+        regions.clear();
+    }
+    copies.clear();
 
-struct SpotLightGPU {
-    float position[3];
-    float intensity;
-    float direction[3];
-    float cutOff;
-    float color[3];
-    float outerCutOff;
-};
+    // On a separate transfer queue the semaphore the graphics submit waits
+    // on orders the copies instead.
+    if (render_data.transfer_queue != render_data.graphics_queue) return;
+    memory_barrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+// Submits this frame's staged copies to the separate transfer queue, if
+// there is one and anything was staged.
+int Renderer::submit_uploads(bool& submitted) {
+    size_t frame = render_data.current_frame;
+    submitted = false;
+    if (render_data.transfer_queue == render_data.graphics_queue || render_data.staging_copies[frame].empty()) return 0;
+
+    VkCommandBuffer commandBuffer = render_data.transfer_command_buffers[frame];
+    init_data.disp.resetCommandBuffer(commandBuffer, 0);
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (init_data.disp.beginCommandBuffer(commandBuffer, &begin_info) != VK_SUCCESS) return -1;
+    record_uploads(commandBuffer);
+    if (init_data.disp.endCommandBuffer(commandBuffer) != VK_SUCCESS) return -1;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &render_data.transfer_semaphores[frame];
+    if (init_data.disp.queueSubmit(render_data.transfer_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) return -1;
+    submitted = true;
+    return 0;
+}
+
+VkDeviceSize Renderer::align_storage_offset(VkDeviceSize offset) const {
+    VkDeviceSize alignment = init_data.device.physical_device.properties.limits.minStorageBufferOffsetAlignment;
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Slots are aligned for dynamic offsets; more frames in flight only make
+// the ring longer.
+int Renderer::create_uniform_buffers() {
+    VkDeviceSize alignment = init_data.device.physical_device.properties.limits.minUniformBufferOffsetAlignment;
+    render_data.uniform_ring_stride = (sizeof(Uniforms) + alignment - 1) / alignment * alignment;
+    VkDeviceSize bufferSize = render_data.uniform_ring_stride * MAX_FRAMES_IN_FLIGHT;
+
+    if (create_buffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, render_data.uniform_ring, render_data.uniform_ring_memory) != 0) return -1;
+    void* mapped = nullptr;
+    if (init_data.disp.mapMemory(render_data.uniform_ring_memory, 0, bufferSize, 0, &mapped) != VK_SUCCESS) return -1;
+    render_data.uniform_ring_mapped = static_cast<char*>(mapped);
+    return 0;
+}
 
-struct SceneGPU {
-    SphereGPU spheres[100];
-    PointLightGPU pointLight;
-    SpotLightGPU spotLight;
-    int sphereCount;
-    float padding[3];
-    float sunDirection[3];
+// Instance transform, shared with Instance in raytracer_common.glsl (std430)
+struct InstanceGPU {
+    float position[3];
+    float invScale;
+    float axisX[3];
+    uint32_t root; // Bottom-level root node, UINT32_MAX for an empty cluster
+    float axisY[3];
+    float scale;
+    float axisZ[3];
+    float padding;
 };
+static_assert(sizeof(InstanceGPU) == 64, "InstanceGPU must match the std430 layout in raytracer_common.glsl");
+
+// Segments are allocated by upload_target on first use, so host-visible
+// scenes never allocate any.
+int Renderer::create_staging_buffers() {
+    render_data.staging_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.staging_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.staging_buffers_mapped.assign(MAX_FRAMES_IN_FLIGHT, nullptr);
+    render_data.staging_capacity.assign(MAX_FRAMES_IN_FLIGHT, 0);
+    render_data.staging_used.assign(MAX_FRAMES_IN_FLIGHT, 0);
+    render_data.staging_copies.assign(MAX_FRAMES_IN_FLIGHT, {});
+    return 0;
+}
 
+// Sphere geometry, then the material indices at a valid storage buffer offset
 int Renderer::create_scene_buffers() {
-    VkDeviceSize bufferSize = sizeof(SceneGPU);
-    render_data.scene_buffers.resize(MAX_FRAMES_IN_FLIGHT);
-    render_data.scene_buffers_memory.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.scene_material_ids_offset = align_storage_offset(sizeof(gpu::vec4) * sphere_capacity);
+    VkDeviceSize bufferSize = render_data.scene_material_ids_offset + sizeof(uint32_t) * sphere_capacity;
+    render_data.scene_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.scene_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
     render_data.scene_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.scene_dirty_spheres.assign(MAX_FRAMES_IN_FLIGHT, {});
+    render_data.scene_uploaded_version.assign(MAX_FRAMES_IN_FLIGHT, 0);
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        create_buffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, render_data.scene_buffers[i], render_data.scene_buffers_memory[i]);
-        init_data.disp.mapMemory(render_data.scene_buffers_memory[i], 0, bufferSize, 0, &render_data.scene_buffers_mapped[i]);
+        if (create_scene_data_buffer(bufferSize, render_data.scene_buffers[i], render_data.scene_buffers_memory[i], render_data.scene_buffers_mapped[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+int Renderer::create_material_buffers() {
+    VkDeviceSize bufferSize = sizeof(gpu::SphereMaterial) * material_capacity;
+    render_data.material_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.material_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.material_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.material_dirty.assign(MAX_FRAMES_IN_FLIGHT, {});
+    render_data.material_uploaded_version.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_scene_data_buffer(bufferSize, render_data.material_buffers[i], render_data.material_buffers_memory[i], render_data.material_buffers_mapped[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+int Renderer::create_bvh_buffers() {
+    // The index range must start at a valid storage buffer offset.
+    render_data.bvh_indices_offset = align_storage_offset(sizeof(BvhNode) * bvh_node_capacity(sphere_capacity));
+    render_data.bvh_wide_offset = align_storage_offset(render_data.bvh_indices_offset + sizeof(uint32_t) * sphere_capacity);
+    VkDeviceSize bufferSize = render_data.bvh_wide_offset + sizeof(WideBvhNode) * wide_bvh_node_capacity(sphere_capacity);
+
+    // New buffers hold nothing yet.
+    render_data.bvh_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.wide_bvh_uploaded_version.assign(MAX_FRAMES_IN_FLIGHT, 0);
+    render_data.bvh_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.bvh_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.bvh_dirty_nodes.assign(MAX_FRAMES_IN_FLIGHT, {});
+    render_data.bvh_dirty_indices.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_scene_data_buffer(bufferSize, render_data.bvh_buffers[i], render_data.bvh_buffers_memory[i], render_data.bvh_buffers_mapped[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+int Renderer::create_bvh_scratch_buffers() {
+    uint32_t maxBlocks = (sphere_capacity + RADIX_ITEMS - 1) / RADIX_ITEMS;
+    uint32_t maxNodes = bvh_node_capacity(sphere_capacity);
+    BvhScratchLayout& layout = bvh_scratch_layout;
+    layout.keys_a = 0;
+    layout.keys_b = align_storage_offset(layout.keys_a + sizeof(uint32_t) * sphere_capacity);
+    layout.values_b = align_storage_offset(layout.keys_b + sizeof(uint32_t) * sphere_capacity);
+    layout.histograms = align_storage_offset(layout.values_b + sizeof(uint32_t) * sphere_capacity);
+    layout.parents = align_storage_offset(layout.histograms + sizeof(uint32_t) * RADIX_BUCKETS * maxBlocks);
+    layout.state = align_storage_offset(layout.parents + sizeof(uint32_t) * maxNodes);
+    layout.size = layout.state + BVH_STATE_HEADER + sizeof(uint32_t) * maxNodes;
+
+    render_data.bvh_scratch_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.bvh_scratch_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_buffer(layout.size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, render_data.bvh_scratch_buffers[i], render_data.bvh_scratch_buffers_memory[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+int Renderer::create_grid_buffers() {
+    // Header and cellStart, then cellSpheres at a valid storage buffer offset
+    render_data.grid_spheres_offset = align_storage_offset(sizeof(GridHeader) + sizeof(uint32_t) * (grid_cell_capacity + 1));
+    VkDeviceSize bufferSize = render_data.grid_spheres_offset + sizeof(uint32_t) * grid_ref_capacity;
+
+    render_data.grid_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.grid_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.grid_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+    // Unknown contents; the first update writes at least the header.
+    render_data.grid_uploaded_version.assign(MAX_FRAMES_IN_FLIGHT, UINT64_MAX);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_scene_data_buffer(bufferSize, render_data.grid_buffers[i], render_data.grid_buffers_memory[i], render_data.grid_buffers_mapped[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+int Renderer::create_instance_buffers() {
+    InstanceLayout& layout = instance_layout;
+    layout.prims = align_storage_offset(sizeof(BvhNode) * instance_node_capacity(instance_capacity, cluster_sphere_capacity));
+    layout.instances = align_storage_offset(layout.prims + sizeof(uint32_t) * instance_prim_capacity(instance_capacity, cluster_sphere_capacity));
+    layout.spheres = align_storage_offset(layout.instances + sizeof(InstanceGPU) * instance_capacity);
+    layout.material_ids = align_storage_offset(layout.spheres + sizeof(gpu::vec4) * cluster_sphere_capacity);
+    layout.size = layout.material_ids + sizeof(uint32_t) * cluster_sphere_capacity;
+
+    render_data.instance_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.instance_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.instance_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.instance_bottom_uploaded.assign(MAX_FRAMES_IN_FLIGHT, 0);
+    render_data.instance_top_uploaded.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_scene_data_buffer(layout.size, render_data.instance_buffers[i], render_data.instance_buffers_memory[i], render_data.instance_buffers_mapped[i]) != 0) return -1;
     }
     return 0;
 }
 
 int Renderer::create_descriptor_pool() {
+    // Per frame: the main set plus the GPU BVH build's two ping-pong sets
     VkDescriptorPoolSize poolSizes[] = {
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)},
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)}
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, static_cast<uint32_t>((19 + 2 * BVH_BUILD_BINDINGS) * MAX_FRAMES_IN_FLIGHT)},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, static_cast<uint32_t>(4 * MAX_FRAMES_IN_FLIGHT)}
     };
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 2;
+    poolInfo.poolSizeCount = 3;
     poolInfo.pPoolSizes = poolSizes;
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.maxSets = static_cast<uint32_t>(3 * MAX_FRAMES_IN_FLIGHT);
 
     if (init_data.disp.createDescriptorPool(&poolInfo, nullptr, &render_data.descriptor_pool) != VK_SUCCESS) return -1;
     return 0;
@@ -494,25 +1063,98 @@ int Renderer::create_descriptor_sets() {
 
     render_data.descriptor_sets.resize(MAX_FRAMES_IN_FLIGHT);
     if (init_data.disp.allocateDescriptorSets(&allocInfo, render_data.descriptor_sets.data()) != VK_SUCCESS) return -1;
+    write_descriptor_sets();
+    return 0;
+}
 
+// Points every frame's set at the current buffers; called again whenever
+// buffers are reallocated.
+void Renderer::write_descriptor_sets() {
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        // Every set points at the ring's start; the frame's slot is the
+        // dynamic offset given at bind time.
         VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = render_data.uniform_buffers[i];
+        bufferInfo.buffer = render_data.uniform_ring;
         bufferInfo.offset = 0;
         bufferInfo.range = sizeof(Uniforms);
 
         VkDescriptorBufferInfo sceneBufferInfo{};
         sceneBufferInfo.buffer = render_data.scene_buffers[i];
         sceneBufferInfo.offset = 0;
-        sceneBufferInfo.range = sizeof(SceneGPU);
-
-        VkWriteDescriptorSet descriptorWrites[2]{};
+        sceneBufferInfo.range = sizeof(gpu::vec4) * sphere_capacity;
+
+        VkDescriptorBufferInfo materialIdsInfo{};
+        materialIdsInfo.buffer = render_data.scene_buffers[i];
+        materialIdsInfo.offset = render_data.scene_material_ids_offset;
+        materialIdsInfo.range = sizeof(uint32_t) * sphere_capacity;
+
+        VkDescriptorBufferInfo materialTableInfo{};
+        materialTableInfo.buffer = render_data.material_buffers[i];
+        materialTableInfo.offset = 0;
+        materialTableInfo.range = sizeof(gpu::SphereMaterial) * material_capacity;
+
+        VkDescriptorBufferInfo bvhNodesInfo{};
+        bvhNodesInfo.buffer = render_data.bvh_buffers[i];
+        bvhNodesInfo.offset = 0;
+        bvhNodesInfo.range = sizeof(BvhNode) * bvh_node_capacity(sphere_capacity);
+
+        VkDescriptorBufferInfo bvhIndicesInfo{};
+        bvhIndicesInfo.buffer = render_data.bvh_buffers[i];
+        bvhIndicesInfo.offset = render_data.bvh_indices_offset;
+        bvhIndicesInfo.range = sizeof(uint32_t) * sphere_capacity;
+
+        VkDescriptorBufferInfo gridCellsInfo{};
+        gridCellsInfo.buffer = render_data.grid_buffers[i];
+        gridCellsInfo.offset = 0;
+        gridCellsInfo.range = sizeof(GridHeader) + sizeof(uint32_t) * (grid_cell_capacity + 1);
+
+        VkDescriptorBufferInfo gridSpheresInfo{};
+        gridSpheresInfo.buffer = render_data.grid_buffers[i];
+        gridSpheresInfo.offset = render_data.grid_spheres_offset;
+        gridSpheresInfo.range = sizeof(uint32_t) * grid_ref_capacity;
+
+        const InstanceLayout& layout = instance_layout;
+        VkDescriptorBufferInfo instanceInfos[4] = {
+            {render_data.instance_buffers[i], 0, sizeof(BvhNode) * instance_node_capacity(instance_capacity, cluster_sphere_capacity)},
+            {render_data.instance_buffers[i], layout.prims, sizeof(uint32_t) * instance_prim_capacity(instance_capacity, cluster_sphere_capacity)},
+            {render_data.instance_buffers[i], layout.instances, sizeof(InstanceGPU) * instance_capacity},
+            {render_data.instance_buffers[i], layout.spheres, sizeof(gpu::vec4) * cluster_sphere_capacity},
+        };
+        VkDescriptorBufferInfo clusterMaterialIdsInfo = {render_data.instance_buffers[i], layout.material_ids, sizeof(uint32_t) * cluster_sphere_capacity};
+
+        VkDescriptorBufferInfo wideBvhInfo{};
+        wideBvhInfo.buffer = render_data.bvh_buffers[i];
+        wideBvhInfo.offset = render_data.bvh_wide_offset;
+        wideBvhInfo.range = sizeof(WideBvhNode) * wide_bvh_node_capacity(sphere_capacity);
+
+        VkDescriptorImageInfo tracedImageInfo = {VK_NULL_HANDLE, render_data.trace_image_views[i], VK_IMAGE_LAYOUT_GENERAL};
+
+        VkDescriptorImageInfo accumulationInfo = {VK_NULL_HANDLE, render_data.accumulation_image_view, VK_IMAGE_LAYOUT_GENERAL};
+
+        VkDescriptorImageInfo historyInfos[2] = {
+            {VK_NULL_HANDLE, render_data.history_image_views[i], VK_IMAGE_LAYOUT_GENERAL},
+            {VK_NULL_HANDLE, render_data.history_image_views[(i + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT], VK_IMAGE_LAYOUT_GENERAL},
+        };
+
+        VkDescriptorBufferInfo checkerboardStatsInfo = {render_data.checkerboard_stats_buffers[i], 0, sizeof(CheckerboardStats)};
+
+        const WavefrontLayout& wavefrontLayout = wavefront_layout;
+        VkBuffer wavefrontBuffer = render_data.wavefront_buffers[i];
+        VkDescriptorBufferInfo wavefrontInfos[5] = {
+            {wavefrontBuffer, 0, wavefrontLayout.hits},
+            {wavefrontBuffer, wavefrontLayout.hits, wavefrontLayout.shadows - wavefrontLayout.hits},
+            {wavefrontBuffer, wavefrontLayout.shadows, wavefrontLayout.radiance - wavefrontLayout.shadows},
+            {wavefrontBuffer, wavefrontLayout.radiance, wavefrontLayout.counters - wavefrontLayout.radiance},
+            {wavefrontBuffer, wavefrontLayout.counters, sizeof(WavefrontCounters)},
+        };
+
+        VkWriteDescriptorSet descriptorWrites[24]{};
 
         descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[0].dstSet = render_data.descriptor_sets[i];
         descriptorWrites[0].dstBinding = 0;
         descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         descriptorWrites[0].descriptorCount = 1;
         descriptorWrites[0].pBufferInfo = &bufferInfo;
 
@@ -524,11 +1166,397 @@ int Renderer::create_descriptor_sets() {
         descriptorWrites[1].descriptorCount = 1;
         descriptorWrites[1].pBufferInfo = &sceneBufferInfo;
 
-        init_data.disp.updateDescriptorSets(2, descriptorWrites, 0, nullptr);
+        descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[2].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].dstArrayElement = 0;
+        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[2].descriptorCount = 1;
+        descriptorWrites[2].pBufferInfo = &bvhNodesInfo;
+
+        descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[3].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[3].dstBinding = 3;
+        descriptorWrites[3].dstArrayElement = 0;
+        descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[3].descriptorCount = 1;
+        descriptorWrites[3].pBufferInfo = &bvhIndicesInfo;
+
+        descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[4].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[4].dstBinding = 4;
+        descriptorWrites[4].dstArrayElement = 0;
+        descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[4].descriptorCount = 1;
+        descriptorWrites[4].pBufferInfo = &gridCellsInfo;
+
+        descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[5].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[5].dstBinding = 5;
+        descriptorWrites[5].dstArrayElement = 0;
+        descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[5].descriptorCount = 1;
+        descriptorWrites[5].pBufferInfo = &gridSpheresInfo;
+
+        for (uint32_t b = 0; b < 4; b++) {
+            VkWriteDescriptorSet& write = descriptorWrites[6 + b];
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = render_data.descriptor_sets[i];
+            write.dstBinding = 6 + b;
+            write.dstArrayElement = 0;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write.descriptorCount = 1;
+            write.pBufferInfo = &instanceInfos[b];
+        }
+
+        descriptorWrites[10].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[10].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[10].dstBinding = 10;
+        descriptorWrites[10].dstArrayElement = 0;
+        descriptorWrites[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[10].descriptorCount = 1;
+        descriptorWrites[10].pBufferInfo = &wideBvhInfo;
+
+        descriptorWrites[11].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[11].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[11].dstBinding = 11;
+        descriptorWrites[11].dstArrayElement = 0;
+        descriptorWrites[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[11].descriptorCount = 1;
+        descriptorWrites[11].pBufferInfo = &materialIdsInfo;
+
+        descriptorWrites[12].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[12].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[12].dstBinding = 12;
+        descriptorWrites[12].dstArrayElement = 0;
+        descriptorWrites[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[12].descriptorCount = 1;
+        descriptorWrites[12].pBufferInfo = &clusterMaterialIdsInfo;
+
+        descriptorWrites[13].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[13].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[13].dstBinding = 13;
+        descriptorWrites[13].dstArrayElement = 0;
+        descriptorWrites[13].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[13].descriptorCount = 1;
+        descriptorWrites[13].pBufferInfo = &materialTableInfo;
+
+        descriptorWrites[14].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[14].dstSet = render_data.descriptor_sets[i];
+        descriptorWrites[14].dstBinding = 14;
+        descriptorWrites[14].dstArrayElement = 0;
+        descriptorWrites[14].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[14].descriptorCount = 1;
+        descriptorWrites[14].pImageInfo = &tracedImageInfo;
+
+        descriptorWrites[15] = descriptorWrites[14];
+        descriptorWrites[15].dstBinding = 15;
+        descriptorWrites[15].pImageInfo = &accumulationInfo;
+
+        for (int h = 0; h < 2; h++) {
+            descriptorWrites[16 + h] = descriptorWrites[14];
+            descriptorWrites[16 + h].dstBinding = 16 + h;
+            descriptorWrites[16 + h].pImageInfo = &historyInfos[h];
+        }
+
+        descriptorWrites[18] = descriptorWrites[13];
+        descriptorWrites[18].dstBinding = 18;
+        descriptorWrites[18].pBufferInfo = &checkerboardStatsInfo;
+
+        for (int w = 0; w < 5; w++) {
+            descriptorWrites[19 + w] = descriptorWrites[13];
+            descriptorWrites[19 + w].dstBinding = 19 + w;
+            descriptorWrites[19 + w].pBufferInfo = &wavefrontInfos[w];
+        }
+
+        init_data.disp.updateDescriptorSets(24, descriptorWrites, 0, nullptr);
+    }
+}
+
+int Renderer::create_bvh_build_descriptor_sets() {
+    std::vector<VkDescriptorSetLayout> layouts(2 * MAX_FRAMES_IN_FLIGHT, render_data.bvh_build_set_layout);
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = render_data.descriptor_pool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+    allocInfo.pSetLayouts = layouts.data();
+
+    render_data.bvh_build_sets.resize(layouts.size());
+    if (init_data.disp.allocateDescriptorSets(&allocInfo, render_data.bvh_build_sets.data()) != VK_SUCCESS) return -1;
+    write_bvh_build_descriptor_sets();
+    return 0;
+}
+
+void Renderer::write_bvh_build_descriptor_sets() {
+    const BvhScratchLayout& layout = bvh_scratch_layout;
+    VkDeviceSize keysSize = sizeof(uint32_t) * sphere_capacity;
+    VkDeviceSize nodesSize = sizeof(BvhNode) * bvh_node_capacity(sphere_capacity);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkBuffer scratch = render_data.bvh_scratch_buffers[i];
+        VkDescriptorBufferInfo keysA = {scratch, layout.keys_a, keysSize};
+        VkDescriptorBufferInfo keysB = {scratch, layout.keys_b, keysSize};
+        VkDescriptorBufferInfo valuesA = {render_data.bvh_buffers[i], render_data.bvh_indices_offset, keysSize};
+        VkDescriptorBufferInfo valuesB = {scratch, layout.values_b, keysSize};
+
+        for (int parity = 0; parity < 2; parity++) {
+            // Even passes sort A into B, odd passes B back into A, so the
+            // sorted indices end up in the BVH buffer's primIndices range.
+            VkDescriptorBufferInfo infos[BVH_BUILD_BINDINGS] = {
+                {render_data.scene_buffers[i], 0, sizeof(gpu::vec4) * sphere_capacity},
+                {render_data.bvh_buffers[i], 0, nodesSize},
+                parity == 0 ? keysA : keysB,
+                parity == 0 ? valuesA : valuesB,
+                parity == 0 ? keysB : keysA,
+                parity == 0 ? valuesB : valuesA,
+                {scratch, layout.histograms, layout.parents - layout.histograms},
+                {scratch, layout.parents, layout.state - layout.parents},
+                {scratch, layout.state, layout.size - layout.state},
+            };
+
+            VkWriteDescriptorSet descriptorWrites[BVH_BUILD_BINDINGS]{};
+            for (uint32_t b = 0; b < BVH_BUILD_BINDINGS; b++) {
+                descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[b].dstSet = render_data.bvh_build_sets[i * 2 + parity];
+                descriptorWrites[b].dstBinding = b;
+                descriptorWrites[b].dstArrayElement = 0;
+                descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrites[b].descriptorCount = 1;
+                descriptorWrites[b].pBufferInfo = &infos[b];
+            }
+            init_data.disp.updateDescriptorSets(BVH_BUILD_BINDINGS, descriptorWrites, 0, nullptr);
+        }
+    }
+}
+
+// Buffers are only replaced between frames with the device idle, so no
+// frame in flight still reads the old ones.
+int Renderer::reserve_sphere_buffers(size_t sphereCount) {
+    if (sphereCount <= sphere_capacity) return 0;
+    uint32_t capacity = static_cast<uint32_t>(std::min(std::max<size_t>(sphereCount, 2 * size_t(sphere_capacity)), max_gpu_spheres));
+
+    init_data.disp.deviceWaitIdle();
+    destroy_sphere_buffers();
+    sphere_capacity = capacity;
+    if (create_scene_buffers() != 0 || create_bvh_buffers() != 0 || create_bvh_scratch_buffers() != 0) {
+        // Whatever was created goes again, and the next frame retries.
+        destroy_sphere_buffers();
+        sphere_capacity = 0;
+        return -1;
+    }
+    write_descriptor_sets();
+    write_bvh_build_descriptor_sets();
+
+    // The new buffers are empty; dropping the CPU trees makes the next
+    // updates rebuild and upload them in full.
+    bvh.clear();
+    wide_bvh.clear();
+    std::cout << "Sphere buffers grown to " << sphere_capacity << " spheres" << std::endl;
+    return 0;
+}
+
+int Renderer::reserve_grid_buffers(size_t cellCount, size_t refCount) {
+    if (cellCount <= grid_cell_capacity && refCount <= grid_ref_capacity) return 0;
+    uint32_t cells = static_cast<uint32_t>(std::max<size_t>(cellCount, 2 * size_t(grid_cell_capacity)));
+    uint32_t refs = static_cast<uint32_t>(std::max<size_t>(refCount, 2 * size_t(grid_ref_capacity)));
+    VkDeviceSize maxRange = init_data.device.physical_device.properties.limits.maxStorageBufferRange;
+    if (sizeof(uint32_t) * (VkDeviceSize(cells) + 1) + sizeof(GridHeader) > maxRange || sizeof(uint32_t) * VkDeviceSize(refs) > maxRange) return -1;
+
+    init_data.disp.deviceWaitIdle();
+    destroy_grid_buffers();
+    grid_cell_capacity = cells;
+    grid_ref_capacity = refs;
+    if (create_grid_buffers() != 0) {
+        destroy_grid_buffers();
+        grid_cell_capacity = grid_ref_capacity = 0;
+        return -1;
+    }
+    write_descriptor_sets();
+    return 0;
+}
+
+int Renderer::reserve_material_buffers(size_t materialCount) {
+    if (materialCount <= material_capacity) return 0;
+    uint32_t capacity = static_cast<uint32_t>(std::max<size_t>(materialCount, 2 * size_t(material_capacity)));
+    if (sizeof(gpu::SphereMaterial) * VkDeviceSize(capacity) > init_data.device.physical_device.properties.limits.maxStorageBufferRange) return -1;
+
+    init_data.disp.deviceWaitIdle();
+    destroy_material_buffers();
+    material_capacity = capacity;
+    if (create_material_buffers() != 0) {
+        destroy_material_buffers();
+        material_capacity = 0;
+        return -1;
+    }
+    write_descriptor_sets();
+    return 0;
+}
+
+// Past the storage buffer range the capacity stays put and
+// update_instance_buffer draws without the instances.
+int Renderer::reserve_instance_buffers(size_t instanceCount, size_t clusterSphereCount) {
+    if (instanceCount <= instance_capacity && clusterSphereCount <= cluster_sphere_capacity) return 0;
+    auto grow = [](size_t count, uint32_t capacity) {
+        return static_cast<uint32_t>(count <= capacity ? capacity : std::max<size_t>(count, 2 * size_t(capacity)));
+    };
+    uint32_t instances = grow(instanceCount, instance_capacity);
+    uint32_t clusterSpheres = grow(clusterSphereCount, cluster_sphere_capacity);
+    if (sizeof(BvhNode) * VkDeviceSize(instance_node_capacity(instances, clusterSpheres)) > init_data.device.physical_device.properties.limits.maxStorageBufferRange) return 0;
+
+    init_data.disp.deviceWaitIdle();
+    destroy_instance_buffers();
+    instance_capacity = instances;
+    cluster_sphere_capacity = clusterSpheres;
+    if (create_instance_buffers() != 0) {
+        destroy_instance_buffers();
+        instance_capacity = cluster_sphere_capacity = 0;
+        return -1;
+    }
+    write_descriptor_sets();
+    std::cout << "Instance buffers grown to " << instance_capacity << " instances, " << cluster_sphere_capacity << " cluster spheres" << std::endl;
+    return 0;
+}
+
+void Renderer::destroy_sphere_buffers() {
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        destroy_buffer(render_data.scene_buffers[i], render_data.scene_buffers_memory[i]);
+        destroy_buffer(render_data.bvh_buffers[i], render_data.bvh_buffers_memory[i]);
+        destroy_buffer(render_data.bvh_scratch_buffers[i], render_data.bvh_scratch_buffers_memory[i]);
+    }
+}
+
+void Renderer::destroy_material_buffers() {
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        destroy_buffer(render_data.material_buffers[i], render_data.material_buffers_memory[i]);
+    }
+}
+
+void Renderer::destroy_instance_buffers() {
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        destroy_buffer(render_data.instance_buffers[i], render_data.instance_buffers_memory[i]);
+    }
+}
+
+// A device local storage image the size of the swapchain, only ever used in
+// GENERAL layout.
+int Renderer::create_storage_image(VkFormat format, VkImage& image, VkDeviceMemory& memory, VkImageView& view) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent = {init_data.swapchain.extent.width, init_data.swapchain.extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (init_data.disp.createImage(&imageInfo, nullptr, &image) != VK_SUCCESS) return -1;
+
+    VkMemoryRequirements memRequirements;
+    init_data.disp.getImageMemoryRequirements(image, &memRequirements);
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex = find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (allocInfo.memoryTypeIndex == UINT32_MAX || init_data.disp.allocateMemory(&allocInfo, nullptr, &memory) != VK_SUCCESS) return -1;
+    if (init_data.disp.bindImageMemory(image, memory, 0) != VK_SUCCESS) return -1;
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    return init_data.disp.createImageView(&viewInfo, nullptr, &view) == VK_SUCCESS ? 0 : -1;
+}
+
+// The compute tracing path's images: one per frame that it writes and the
+// composite pass reads, whose contents never outlive the frame, the
+// accumulation image shared by every frame, and the reprojection history
+// that each frame hands to the next.
+int Renderer::create_trace_images() {
+    render_data.trace_images.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.trace_images_memory.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.trace_image_views.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.history_images.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.history_images_memory.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.history_image_views.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_storage_image(TRACE_IMAGE_FORMAT, render_data.trace_images[i], render_data.trace_images_memory[i],
+                                 render_data.trace_image_views[i]) != 0) return -1;
+        // Hit distances need full float precision.
+        if (create_storage_image(ACCUMULATION_IMAGE_FORMAT, render_data.history_images[i], render_data.history_images_memory[i],
+                                 render_data.history_image_views[i]) != 0) return -1;
+    }
+    if (create_storage_image(ACCUMULATION_IMAGE_FORMAT, render_data.accumulation_image, render_data.accumulation_image_memory,
+                             render_data.accumulation_image_view) != 0) return -1;
+    accumulated_samples = 0;
+    history_valid = false;
+    return 0;
+}
+
+int Renderer::create_checkerboard_stats_buffers() {
+    render_data.checkerboard_stats_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.checkerboard_stats_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.checkerboard_stats_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_buffer(sizeof(CheckerboardStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          render_data.checkerboard_stats_buffers[i], render_data.checkerboard_stats_memory[i]) != 0) return -1;
+        if (init_data.disp.mapMemory(render_data.checkerboard_stats_memory[i], 0, sizeof(CheckerboardStats), 0,
+                                     &render_data.checkerboard_stats_mapped[i]) != VK_SUCCESS) return -1;
+        memset(render_data.checkerboard_stats_mapped[i], 0, sizeof(CheckerboardStats));
+    }
+    return 0;
+}
+
+// Sized for one batch, whatever the swapchain size; record_wavefront traces
+// larger frames in several.
+int Renderer::create_wavefront_buffers() {
+    WavefrontLayout& layout = wavefront_layout;
+    layout.hits = align_storage_offset(VkDeviceSize(2) * WAVEFRONT_PATH_BYTES * WAVEFRONT_BATCH);
+    layout.shadows = align_storage_offset(layout.hits + VkDeviceSize(WAVEFRONT_PATH_BYTES) * WAVEFRONT_BATCH);
+    layout.radiance = align_storage_offset(layout.shadows + sizeof(uint32_t) * VkDeviceSize(WAVEFRONT_LIGHTS) * WAVEFRONT_BATCH);
+    layout.counters = align_storage_offset(layout.radiance + 4 * sizeof(float) * VkDeviceSize(1 + WAVEFRONT_LIGHTS) * WAVEFRONT_BATCH);
+    layout.size = layout.counters + sizeof(WavefrontCounters);
+
+    render_data.wavefront_buffers.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    render_data.wavefront_buffers_memory.assign(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (create_buffer(layout.size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, render_data.wavefront_buffers[i], render_data.wavefront_buffers_memory[i]) != 0) return -1;
     }
     return 0;
 }
 
+void Renderer::destroy_trace_images() {
+    if (render_data.trace_images.empty()) return;
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        init_data.disp.destroyImageView(render_data.trace_image_views[i], nullptr);
+        init_data.disp.destroyImage(render_data.trace_images[i], nullptr);
+        init_data.disp.freeMemory(render_data.trace_images_memory[i], nullptr);
+        init_data.disp.destroyImageView(render_data.history_image_views[i], nullptr);
+        init_data.disp.destroyImage(render_data.history_images[i], nullptr);
+        init_data.disp.freeMemory(render_data.history_images_memory[i], nullptr);
+    }
+    render_data.history_images.clear();
+    render_data.history_images_memory.clear();
+    render_data.history_image_views.clear();
+    render_data.trace_images.clear();
+    render_data.trace_images_memory.clear();
+    render_data.trace_image_views.clear();
+    init_data.disp.destroyImageView(render_data.accumulation_image_view, nullptr);
+    init_data.disp.destroyImage(render_data.accumulation_image, nullptr);
+    init_data.disp.freeMemory(render_data.accumulation_image_memory, nullptr);
+}
+
+void Renderer::destroy_grid_buffers() {
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        destroy_buffer(render_data.grid_buffers[i], render_data.grid_buffers_memory[i]);
+    }
+}
+
 int Renderer::create_command_buffers() {
     render_data.command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
     VkCommandBufferAllocateInfo allocInfo = {};
@@ -538,6 +1566,30 @@ int Renderer::create_command_buffers() {
     allocInfo.commandBufferCount = (uint32_t)render_data.command_buffers.size();
 
     if (init_data.disp.allocateCommandBuffers(&allocInfo, render_data.command_buffers.data()) != VK_SUCCESS) return -1;
+
+    if (render_data.transfer_queue == render_data.graphics_queue) return 0;
+    render_data.transfer_command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.commandPool = render_data.transfer_command_pool;
+    if (init_data.disp.allocateCommandBuffers(&allocInfo, render_data.transfer_command_buffers.data()) != VK_SUCCESS) return -1;
+    return 0;
+}
+
+int Renderer::create_timestamp_queries() {
+    const VkPhysicalDeviceLimits& limits = init_data.device.physical_device.properties.limits;
+    if (!limits.timestampComputeAndGraphics) {
+        std::cout << "No GPU timestamps; dynamic resolution is unavailable" << std::endl;
+        return 0;
+    }
+    timestamp_period = limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+    if (init_data.disp.createQueryPool(&poolInfo, nullptr, &render_data.timestamp_pool) != VK_SUCCESS) return -1;
+    render_data.timestamps_written.assign(MAX_FRAMES_IN_FLIGHT, false);
+    render_data.frame_rates.assign(MAX_FRAMES_IN_FLIGHT, TraceRate::Full);
+    render_data.frame_scales.assign(MAX_FRAMES_IN_FLIGHT, 1.0f);
     return 0;
 }
 
@@ -545,6 +1597,7 @@ int Renderer::create_sync_objects() {
     render_data.available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
     render_data.finished_semaphore.resize(init_data.swapchain.image_count);
     render_data.in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
+    render_data.transfer_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
 
     VkSemaphoreCreateInfo semaphore_info = {};
     semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -555,7 +1608,8 @@ int Renderer::create_sync_objects() {
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         if (init_data.disp.createSemaphore(&semaphore_info, nullptr, &render_data.available_semaphores[i]) != VK_SUCCESS ||
-            init_data.disp.createFence(&fence_info, nullptr, &render_data.in_flight_fences[i]) != VK_SUCCESS) {
+            init_data.disp.createFence(&fence_info, nullptr, &render_data.in_flight_fences[i]) != VK_SUCCESS ||
+            init_data.disp.createSemaphore(&semaphore_info, nullptr, &render_data.transfer_semaphores[i]) != VK_SUCCESS) {
             return -1;
         }
     }
@@ -579,6 +1633,9 @@ int Renderer::recreate_swapchain() {
 
     if (create_swapchain() != 0) return -1;
     if (create_framebuffers() != 0) return -1;
+    destroy_trace_images();
+    if (create_trace_images() != 0) return -1;
+    write_descriptor_sets();
 
     render_data.finished_semaphore.resize(init_data.swapchain.image_count);
     VkSemaphoreCreateInfo semaphore_info = {};
@@ -589,68 +1646,508 @@ int Renderer::recreate_swapchain() {
     return 0;
 }
 
-void Renderer::update_uniform_buffer(const Camera& camera, float time, const Scene& scene) {
+// Camera and time are push constants, see record_command_buffer.
+Uniforms Renderer::update_uniform_buffer(const Scene& scene) {
     Uniforms ubo{};
-    ubo.resolution[0] = (float)init_data.swapchain.extent.width;
-    ubo.resolution[1] = (float)init_data.swapchain.extent.height;
-    ubo.time = time;
     ubo.sunEnabled = scene.sunEnabled ? 1.0f : 0.0f;
 
-    ubo.cameraPos[0] = camera.position.x;
-    ubo.cameraPos[1] = camera.position.y;
-    ubo.cameraPos[2] = camera.position.z;
+    // Point Light
+    ubo.pointLight.position[0] = scene.pointLight.position.x;
+    ubo.pointLight.position[1] = scene.pointLight.position.y;
+    ubo.pointLight.position[2] = scene.pointLight.position.z;
+    ubo.pointLight.intensity = scene.pointLight.intensity;
+    ubo.pointLight.color[0] = scene.pointLight.color.x;
+    ubo.pointLight.color[1] = scene.pointLight.color.y;
+    ubo.pointLight.color[2] = scene.pointLight.color.z;
+
+    // Spot Light
+    ubo.spotLight.position[0] = scene.spotLight.position.x;
+    ubo.spotLight.position[1] = scene.spotLight.position.y;
+    ubo.spotLight.position[2] = scene.spotLight.position.z;
+    ubo.spotLight.intensity = scene.spotLight.intensity;
+    ubo.spotLight.direction[0] = scene.spotLight.direction.x;
+    ubo.spotLight.direction[1] = scene.spotLight.direction.y;
+    ubo.spotLight.direction[2] = scene.spotLight.direction.z;
+    ubo.spotLight.cutOff = scene.spotLight.cutOff;
+    ubo.spotLight.color[0] = scene.spotLight.color.x;
+    ubo.spotLight.color[1] = scene.spotLight.color.y;
+    ubo.spotLight.color[2] = scene.spotLight.color.z;
+    ubo.spotLight.outerCutOff = scene.spotLight.outerCutOff;
+
+    // Sun Direction
+    ubo.sunDirection[0] = scene.sunDirection.x;
+    ubo.sunDirection[1] = scene.sunDirection.y;
+    ubo.sunDirection[2] = scene.sunDirection.z;
+
+    ubo.sphereCount = static_cast<int>(gpu_sphere_count(scene));
+    // The GPU build only writes binary nodes.
+    ubo.wideBvh = wide_bvh_enabled && !gpu_bvh_build ? 1 : 0;
+    ubo.instanceCount = gpu_instance_count;
+
+    memcpy(render_data.uniform_ring_mapped + render_data.current_frame * render_data.uniform_ring_stride, &ubo, sizeof(ubo));
+    return ubo;
+}
+
+// Restarts the running average when the camera, the lights or the scene
+// changed since the last frame. Reprojection follows the camera but not
+// the rest, so their changes also drop its history.
+void Renderer::update_history(const Camera& camera, const Scene& scene, const Uniforms& uniforms) {
+    HistoryKey key{};
+    key.uniforms = uniforms;
+    key.sphereVersion = scene.sphereVersion;
+    key.materialVersion = scene.materialVersion;
+    key.instanceBottomVersion = instance_bottom_version;
+    key.instanceTopVersion = instance_top_version;
+    // Both sides are value-initialized, so their padding compares equal.
+    bool sceneChanged = memcmp(&key, &history_key, sizeof(key)) != 0;
+    history_key = key;
 
     Vec3 fwd = camera.getForward();
-    ubo.cameraDir[0] = fwd.x;
-    ubo.cameraDir[1] = fwd.y;
-    ubo.cameraDir[2] = fwd.z;
+    const float* pos = last_constants.cameraPos;
+    const float* dir = last_constants.cameraDir;
+    bool cameraMoved = camera.position.x != pos[0] || camera.position.y != pos[1] || camera.position.z != pos[2] ||
+                       fwd.x != dir[0] || fwd.y != dir[1] || fwd.z != dir[2];
+    VkExtent2D extent = render_extent();
+    bool resized = extent.width != last_constants.resolution[0] || extent.height != last_constants.resolution[1];
+
+    if (!accumulate || sceneChanged || cameraMoved || resized) accumulated_samples = 0;
+    if (sceneChanged || resized) history_valid = false;
+}
+
+// The frame that last used this slot has finished, so its timestamps and
+// checkerboard stats are in. Validation frames trace in full, so their
+// time counts for neither rate.
+void Renderer::read_frame_stats() {
+    TraceRate rate = render_data.frame_rates.empty() ? TraceRate::Full : render_data.frame_rates[render_data.current_frame];
+    if (rate == TraceRate::Validation) {
+        auto* stats = static_cast<CheckerboardStats*>(render_data.checkerboard_stats_mapped[render_data.current_frame]);
+        if (stats->pixels > 0) {
+            double error = (double(stats->errorHigh) * 4294967296.0 + stats->errorLow) / 65536.0;
+            double mse = std::max(error / stats->pixels, 1e-10);
+            checkerboard_psnr = static_cast<float>(10.0 * std::log10(1.0 / mse));
+        }
+        memset(stats, 0, sizeof(CheckerboardStats));
+    }
 
-    memcpy(render_data.uniform_buffers_mapped[render_data.current_frame], &ubo, sizeof(ubo));
+    if (render_data.timestamp_pool == VK_NULL_HANDLE || !render_data.timestamps_written[render_data.current_frame]) return;
+    uint64_t ticks[2];
+    if (init_data.disp.getQueryPoolResults(render_data.timestamp_pool, 2 * render_data.current_frame, 2, sizeof(ticks), ticks,
+                                           sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) return;
+    if (rate == TraceRate::Validation) return;
+    gpu_frame_ms = static_cast<float>(double(ticks[1] - ticks[0]) * timestamp_period * 1e-6);
+    gpu_frame_scale = render_data.frame_scales[render_data.current_frame];
+    float& average = rate == TraceRate::Checkerboard ? checkerboard_ms : full_rate_ms;
+    average = average == 0.0f ? gpu_frame_ms : average + 0.1f * (gpu_frame_ms - average);
 }
 
+// Tracing time goes with the pixel count, the square of the scale. The time
+// is that of the frame MAX_FRAMES_IN_FLIGHT ago, so the scale that would
+// have met the target follows from the one that frame traced at. Each frame
+// steps part of the way there, on a 1/64 grid and only outside a band
+// around it, so the size settles instead of restarting accumulation and
+// reprojection every frame.
+void Renderer::update_render_scale() {
+    if (!dynamic_resolution || render_data.timestamp_pool == VK_NULL_HANDLE) {
+        render_scale = 1.0f;
+        return;
+    }
+    // A converging average would restart with every change, and stops
+    // tracing once it is done, which would read as headroom.
+    if (gpu_frame_ms <= 0.0f || accumulated_samples > 0) return;
+    float ratio = gpu_frame_ms / target_frame_ms;
+    if (std::abs(ratio - 1.0f) < RENDER_SCALE_DEADBAND) return;
+    float ideal = gpu_frame_scale / std::sqrt(ratio);
+    float scale = render_scale + RENDER_SCALE_DAMPING * (ideal - render_scale);
+    render_scale = std::clamp(std::round(scale * 64.0f) / 64.0f, MIN_RENDER_SCALE, 1.0f);
+}
+
+VkExtent2D Renderer::render_extent() const {
+    VkExtent2D extent = init_data.swapchain.extent;
+    if (render_scale >= 1.0f) return extent;
+    return {std::max(1u, static_cast<uint32_t>(extent.width * render_scale + 0.5f)),
+            std::max(1u, static_cast<uint32_t>(extent.height * render_scale + 0.5f))};
+}
+
+// Like the BVH nodes, changed spheres are queued for every frame in flight
+// and each buffer receives only the runs written since its last upload.
 void Renderer::update_scene_buffer(const Scene& scene) {
-    SceneGPU gpuScene{};
-    gpuScene.sphereCount = std::min((int)scene.spheres.size(), 100);
-    for (int i = 0; i < gpuScene.sphereCount; i++) {
-        gpuScene.spheres[i].center[0] = scene.spheres[i].center.x;
-        gpuScene.spheres[i].center[1] = scene.spheres[i].center.y;
-        gpuScene.spheres[i].center[2] = scene.spheres[i].center.z;
-        gpuScene.spheres[i].radius = scene.spheres[i].radius;
-        gpuScene.spheres[i].color[0] = scene.spheres[i].color.x;
-        gpuScene.spheres[i].color[1] = scene.spheres[i].color.y;
-        gpuScene.spheres[i].color[2] = scene.spheres[i].color.z;
-        gpuScene.spheres[i].roughness = scene.spheres[i].roughness;
+    uint32_t count = static_cast<uint32_t>(gpu_sphere_count(scene));
+    BvhDirtyNodes changed;
+    if (scene.spheresChanged) {
+        changed.markAll(count);
+    } else {
+        for (uint32_t i : scene.dirtySpheres) changed.mark(i);
+        for (uint32_t i : scene.reassignedSpheres) changed.mark(i);
+    }
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) render_data.scene_dirty_spheres[i].merge(changed);
+
+    size_t frame = render_data.current_frame;
+    if (render_data.scene_uploaded_version[frame] == scene.sphereVersion && render_data.scene_dirty_spheres[frame].empty()) return;
+    if (render_data.scene_uploaded_version[frame] == 0) render_data.scene_dirty_spheres[frame].markAll(count); // New buffer
+
+    // Spheres still as loaded are copied straight from the scene file.
+    const SceneFile* file = scene.unchangedSource();
+    render_data.scene_dirty_spheres[frame].forEachRun(count, [&](uint32_t first, uint32_t runCount) {
+        VkBuffer buffer = render_data.scene_buffers[frame];
+        void* mapped = render_data.scene_buffers_mapped[frame];
+        if (file) {
+            memcpy(upload_target(buffer, mapped, first * sizeof(gpu::vec4), runCount * sizeof(gpu::vec4)), file->geometry().data() + first, runCount * sizeof(gpu::vec4));
+            memcpy(upload_target(buffer, mapped, render_data.scene_material_ids_offset + first * sizeof(uint32_t), runCount * sizeof(uint32_t)),
+                   file->materialIds().data() + first, runCount * sizeof(uint32_t));
+            return;
+        }
+        gpu::vec4* geometry = static_cast<gpu::vec4*>(upload_target(buffer, mapped, first * sizeof(gpu::vec4), runCount * sizeof(gpu::vec4)));
+        for (uint32_t i = 0; i < runCount; i++) geometry[i] = gpu::sphereGeometry(scene.spheres[first + i]);
+        uint32_t* ids = static_cast<uint32_t*>(upload_target(buffer, mapped, render_data.scene_material_ids_offset + first * sizeof(uint32_t), runCount * sizeof(uint32_t)));
+        for (uint32_t i = 0; i < runCount; i++) ids[i] = gpu::sphereMaterialIndex(scene.spheres[first + i], scene.materials.size());
+    });
+    render_data.scene_dirty_spheres[frame].clear();
+    render_data.scene_uploaded_version[frame] = scene.sphereVersion;
+}
+
+// Same per-frame scheme as update_scene_buffer, so editing one material
+// uploads 16 bytes no matter how many spheres use it.
+void Renderer::update_material_buffer(const Scene& scene) {
+    uint32_t count = static_cast<uint32_t>(scene.materials.size());
+    BvhDirtyNodes changed;
+    if (scene.materialsChanged) {
+        changed.markAll(count);
+    } else {
+        for (uint32_t i : scene.dirtyMaterials) changed.mark(i);
     }
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) render_data.material_dirty[i].merge(changed);
+
+    size_t frame = render_data.current_frame;
+    if (render_data.material_uploaded_version[frame] == scene.materialVersion && render_data.material_dirty[frame].empty()) return;
+    if (render_data.material_uploaded_version[frame] == 0) render_data.material_dirty[frame].markAll(count); // New buffer
+
+    render_data.material_dirty[frame].forEachRun(count, [&](uint32_t first, uint32_t runCount) {
+        gpu::SphereMaterial* materials = static_cast<gpu::SphereMaterial*>(upload_target(render_data.material_buffers[frame], render_data.material_buffers_mapped[frame],
+                                                                                         first * sizeof(gpu::SphereMaterial), runCount * sizeof(gpu::SphereMaterial)));
+        for (uint32_t i = 0; i < runCount; i++) materials[i] = gpu::sphereMaterial(scene.materials[first + i]);
+    });
+    render_data.material_dirty[frame].clear();
+    render_data.material_uploaded_version[frame] = scene.materialVersion;
+}
 
-    // Point Light
-    gpuScene.pointLight.position[0] = scene.pointLight.position.x;
-    gpuScene.pointLight.position[1] = scene.pointLight.position.y;
-    gpuScene.pointLight.position[2] = scene.pointLight.position.z;
-    gpuScene.pointLight.intensity = scene.pointLight.intensity;
-    gpuScene.pointLight.color[0] = scene.pointLight.color.x;
-    gpuScene.pointLight.color[1] = scene.pointLight.color.y;
-    gpuScene.pointLight.color[2] = scene.pointLight.color.z;
+// Spheres past what a single storage buffer binding can address are not drawn.
+size_t Renderer::gpu_sphere_count(const Scene& scene) const {
+    return std::min(scene.spheres.size(), max_gpu_spheres);
+}
 
-    // Spot Light
-    gpuScene.spotLight.position[0] = scene.spotLight.position.x;
-    gpuScene.spotLight.position[1] = scene.spotLight.position.y;
-    gpuScene.spotLight.position[2] = scene.spotLight.position.z;
-    gpuScene.spotLight.intensity = scene.spotLight.intensity;
-    gpuScene.spotLight.direction[0] = scene.spotLight.direction.x;
-    gpuScene.spotLight.direction[1] = scene.spotLight.direction.y;
-    gpuScene.spotLight.direction[2] = scene.spotLight.direction.z;
-    gpuScene.spotLight.cutOff = scene.spotLight.cutOff;
-    gpuScene.spotLight.color[0] = scene.spotLight.color.x;
-    gpuScene.spotLight.color[1] = scene.spotLight.color.y;
-    gpuScene.spotLight.color[2] = scene.spotLight.color.z;
-    gpuScene.spotLight.outerCutOff = scene.spotLight.outerCutOff;
+void Renderer::update_grid_buffer(const Scene& scene) {
+    size_t count = gpu_sphere_count(scene);
+    std::span<const Sphere> spheres(scene.spheres.data(), count);
+    bool changed = scene.spheresChanged || !scene.dirtySpheres.empty();
+    if (changed) auto_accel = SphereGrid::choose(spheres);
 
-    // Sun Direction
-    gpuScene.sunDirection[0] = scene.sunDirection.x;
-    gpuScene.sunDirection[1] = scene.sunDirection.y;
-    gpuScene.sunDirection[2] = scene.sunDirection.z;
+    active_accel = accel_mode == AccelStructure::Auto ? auto_accel : accel_mode;
+    if (gpu_bvh_build) active_accel = AccelStructure::Bvh;
+
+    size_t frame = render_data.current_frame;
+    if (active_accel == AccelStructure::Grid && (changed || grid.empty())) {
+        grid.build(spheres);
+        grid_version++;
+    }
+    if (active_accel == AccelStructure::Grid && reserve_grid_buffers(grid.cellCount(), grid.cellSpheres.size()) != 0) {
+        active_accel = AccelStructure::Bvh; // Too large for a single binding
+    }
+    // Growing the grid buffers replaces them, so look them up after it.
+    VkBuffer buffer = render_data.grid_buffers[frame];
+    void* mapped = render_data.grid_buffers_mapped[frame];
+    if (active_accel != AccelStructure::Grid) {
+        // Dropping the grid makes switching back rebuild and upload it.
+        grid.clear();
+        if (render_data.grid_uploaded_version[frame] == 0) return;
+        GridHeader header{};
+        memcpy(upload_target(buffer, mapped, 0, sizeof(header)), &header, sizeof(header));
+        render_data.grid_uploaded_version[frame] = 0;
+        return;
+    }
 
-    memcpy(render_data.scene_buffers_mapped[render_data.current_frame], &gpuScene, sizeof(gpuScene));
+    // The grid is cheap to rebuild, so any change re-uploads all of it.
+    if (render_data.grid_uploaded_version[frame] == grid_version) return;
+    GridHeader header = grid.header();
+    char* cells = static_cast<char*>(upload_target(buffer, mapped, 0, sizeof(header) + grid.cellStart.size() * sizeof(uint32_t)));
+    memcpy(cells, &header, sizeof(header));
+    memcpy(cells + sizeof(header), grid.cellStart.data(), grid.cellStart.size() * sizeof(uint32_t));
+    size_t refBytes = grid.cellSpheres.size() * sizeof(uint32_t);
+    memcpy(upload_target(buffer, mapped, render_data.grid_spheres_offset, refBytes), grid.cellSpheres.data(), refBytes);
+    render_data.grid_uploaded_version[frame] = grid_version;
+}
+
+void Renderer::update_instance_buffer(const Scene& scene) {
+    size_t clusterSpheres = 0;
+    for (const SphereCluster& cluster : scene.clusters) clusterSpheres += cluster.spheres.size();
+    if (scene.instances.empty() || scene.instances.size() > instance_capacity || clusterSpheres > cluster_sphere_capacity) {
+        if (!scene.instances.empty() && scene.instancesChanged) {
+            std::cerr << "Instances exceed the GPU buffers, drawing without them" << std::endl;
+        }
+        instance_bvh.clear();
+        gpu_instance_count = 0;
+        return;
+    }
+
+    // Replaced clusters rebuild only their own bottom levels, but the
+    // packed bottom-level ranges shift, so all of them are uploaded again.
+    // Moved instances refit the top level and leave every bottom level in
+    // place.
+    if (scene.instancesChanged || instance_bvh.empty()) {
+        instance_bvh.build(scene);
+        instance_bottom_version++;
+        instance_top_version++;
+    } else if (!scene.dirtyClusters.empty()) {
+        instance_bvh.rebuildClusters(scene, scene.dirtyClusters);
+        instance_bottom_version++;
+        instance_top_version++;
+    } else if (!scene.dirtyInstances.empty()) {
+        BvhDirtyNodes changed;
+        instance_bvh.update(scene, scene.dirtyInstances, changed);
+        instance_top_version++;
+    }
+    gpu_instance_count = static_cast<int>(scene.instances.size());
+
+    size_t frame = render_data.current_frame;
+    VkBuffer buffer = render_data.instance_buffers[frame];
+    void* mapped = render_data.instance_buffers_mapped[frame];
+    const InstanceLayout& layout = instance_layout;
+
+    // Bottom levels are packed back to back with their child and prim
+    // indices offset to where they land; prims then index all clusters'
+    // spheres as one array.
+    std::vector<uint32_t> roots(scene.clusters.size(), UINT32_MAX);
+    uint32_t topNodes = bvh_node_capacity(instance_capacity);
+    uint32_t nodeBase = topNodes, primBase = instance_capacity, sphereBase = 0;
+    bool uploadBottom = render_data.instance_bottom_uploaded[frame] != instance_bottom_version;
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> prims;
+    std::vector<gpu::vec4> spheres;
+    std::vector<uint32_t> materialIds;
+    for (size_t c = 0; c < scene.clusters.size(); c++) {
+        const Bvh& bvh = instance_bvh.bottom[c].bvh;
+        const std::vector<Sphere>& clusterSpheres = scene.clusters[c].spheres;
+        if (!bvh.empty()) roots[c] = nodeBase;
+        if (uploadBottom) {
+            for (BvhNode node : bvh.nodes) {
+                if (Bvh::isLeaf(node)) {
+                    node.left = Bvh::LEAF_BIT | ((node.left & ~Bvh::LEAF_BIT) + primBase);
+                } else {
+                    node.left += nodeBase;
+                    node.right += nodeBase;
+                }
+                nodes.push_back(node);
+            }
+            for (uint32_t p : bvh.primIndices) prims.push_back(sphereBase + p);
+            for (const Sphere& s : clusterSpheres) {
+                spheres.push_back(gpu::sphereGeometry(s));
+                materialIds.push_back(gpu::sphereMaterialIndex(s, scene.materials.size()));
+            }
+        }
+        nodeBase += static_cast<uint32_t>(bvh.nodes.size());
+        primBase += static_cast<uint32_t>(bvh.primIndices.size());
+        sphereBase += static_cast<uint32_t>(clusterSpheres.size());
+    }
+    if (uploadBottom) {
+        memcpy(upload_target(buffer, mapped, topNodes * sizeof(BvhNode), nodes.size() * sizeof(BvhNode)), nodes.data(), nodes.size() * sizeof(BvhNode));
+        memcpy(upload_target(buffer, mapped, layout.prims + instance_capacity * sizeof(uint32_t), prims.size() * sizeof(uint32_t)), prims.data(), prims.size() * sizeof(uint32_t));
+        memcpy(upload_target(buffer, mapped, layout.spheres, spheres.size() * sizeof(gpu::vec4)), spheres.data(), spheres.size() * sizeof(gpu::vec4));
+        memcpy(upload_target(buffer, mapped, layout.material_ids, materialIds.size() * sizeof(uint32_t)), materialIds.data(), materialIds.size() * sizeof(uint32_t));
+    }
+    render_data.instance_bottom_uploaded[frame] = instance_bottom_version;
+
+    // The top level is small, so any change re-uploads all of it.
+    if (render_data.instance_top_uploaded[frame] == instance_top_version) return;
+    const Bvh& top = instance_bvh.top;
+    memcpy(upload_target(buffer, mapped, 0, top.nodes.size() * sizeof(BvhNode)), top.nodes.data(), top.nodes.size() * sizeof(BvhNode));
+    memcpy(upload_target(buffer, mapped, layout.prims, top.primIndices.size() * sizeof(uint32_t)), top.primIndices.data(), top.primIndices.size() * sizeof(uint32_t));
+    InstanceGPU* instances = static_cast<InstanceGPU*>(upload_target(buffer, mapped, layout.instances, scene.instances.size() * sizeof(InstanceGPU)));
+    for (size_t i = 0; i < scene.instances.size(); i++) {
+        const ClusterInstance& instance = scene.instances[i];
+        instances[i] = {{instance.position.x, instance.position.y, instance.position.z}, 1.0f / instance.scale,
+                        {instance.axisX.x, instance.axisX.y, instance.axisX.z}, roots[instance.cluster],
+                        {instance.axisY.x, instance.axisY.y, instance.axisY.z}, instance.scale,
+                        {instance.axisZ.x, instance.axisZ.y, instance.axisZ.z}, 0.0f};
+    }
+    render_data.instance_top_uploaded[frame] = instance_top_version;
+}
+
+void Renderer::update_bvh_buffer(const Scene& scene) {
+    if (gpu_bvh_build || active_accel == AccelStructure::Grid) {
+        // record_bvh_build writes this frame's buffer, or the shader traces
+        // the grid. Dropping the CPU tree makes switching back rebuild and
+        // upload everything.
+        bvh.clear();
+        wide_bvh.clear();
+        return;
+    }
+
+    // Covers the same spheres as update_scene_buffer. Moved spheres only
+    // refit the existing tree until its quality drops too far.
+    size_t count = gpu_sphere_count(scene);
+    std::span<const Sphere> spheres(scene.spheres.data(), count);
+
+    BvhDirtyNodes changed;
+    bool rebuild = scene.spheresChanged || bvh.primIndices.size() != count;
+    if (!rebuild && !scene.dirtySpheres.empty()) {
+        bvh.refit(spheres, scene.dirtySpheres, changed);
+        rebuild = bvh.needsRebuild();
+    }
+    if (rebuild) {
+        if (!loadSourceBvh(scene, count, bvh)) bvh.build(spheres);
+        changed.markAll(static_cast<uint32_t>(bvh.nodes.size()));
+    }
+
+    // Every frame in flight has its own buffer, so queue the changes for all
+    // of them and copy only this frame's share now.
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        render_data.bvh_dirty_nodes[i].merge(changed);
+        if (rebuild) render_data.bvh_dirty_indices[i] = static_cast<uint32_t>(bvh.primIndices.size());
+    }
+
+    size_t frame = render_data.current_frame;
+    VkBuffer buffer = render_data.bvh_buffers[frame];
+    void* mapped = render_data.bvh_buffers_mapped[frame];
+    render_data.bvh_dirty_nodes[frame].forEachRun(static_cast<uint32_t>(bvh.nodes.size()), [&](uint32_t first, uint32_t nodeCount) {
+        memcpy(upload_target(buffer, mapped, first * sizeof(BvhNode), nodeCount * sizeof(BvhNode)), bvh.nodes.data() + first, nodeCount * sizeof(BvhNode));
+    });
+    size_t indexBytes = render_data.bvh_dirty_indices[frame] * sizeof(uint32_t);
+    if (indexBytes > 0) memcpy(upload_target(buffer, mapped, render_data.bvh_indices_offset, indexBytes), bvh.primIndices.data(), indexBytes);
+    render_data.bvh_dirty_nodes[frame].clear();
+    render_data.bvh_dirty_indices[frame] = 0;
+
+    // Quantization is relative to every parent box, so any change collapses
+    // the whole tree again, which is cheap next to a rebuild.
+    if (!wide_bvh_enabled) {
+        wide_bvh.clear();
+        return;
+    }
+    if (rebuild || !changed.empty() || (wide_bvh.empty() && !bvh.empty())) {
+        wide_bvh.build(bvh);
+        wide_bvh_version++;
+    }
+    if (render_data.wide_bvh_uploaded_version[frame] == wide_bvh_version) return;
+    size_t wideBytes = wide_bvh.nodes.size() * sizeof(WideBvhNode);
+    memcpy(upload_target(buffer, mapped, render_data.bvh_wide_offset, wideBytes), wide_bvh.nodes.data(), wideBytes);
+    render_data.wide_bvh_uploaded_version[frame] = wide_bvh_version;
+}
+
+// A global memory dependency between the stages of commandBuffer
+void Renderer::memory_barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage,
+                              VkAccessFlags dstAccess) {
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = srcAccess;
+    memoryBarrier.dstAccessMask = dstAccess;
+    init_data.disp.cmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void Renderer::record_bvh_build(VkCommandBuffer commandBuffer, uint32_t sphereCount) {
+    if (sphereCount == 0) return;
+
+    size_t frame = render_data.current_frame;
+    VkBuffer scratch = render_data.bvh_scratch_buffers[frame];
+    const BvhScratchLayout& layout = bvh_scratch_layout;
+
+    // Reset the centroid bounds (min to the largest encoding, max to 0) and
+    // the arrival counters.
+    init_data.disp.cmdFillBuffer(commandBuffer, scratch, layout.state, 3 * sizeof(uint32_t), 0xFFFFFFFFu);
+    init_data.disp.cmdFillBuffer(commandBuffer, scratch, layout.state + 3 * sizeof(uint32_t), layout.size - layout.state - 3 * sizeof(uint32_t), 0);
+
+    memory_barrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    BvhBuildParams params{};
+    params.sphereCount = sphereCount;
+    params.blockCount = (sphereCount + RADIX_ITEMS - 1) / RADIX_ITEMS;
+
+    // Every stage reads what the previous one wrote.
+    auto dispatch = [&](BvhBuildStage stage, int parity, uint32_t groupCount) {
+        init_data.disp.cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, render_data.bvh_build_pipelines[stage]);
+        init_data.disp.cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, render_data.bvh_build_pipeline_layout, 0, 1, &render_data.bvh_build_sets[frame * 2 + parity], 0, nullptr);
+        init_data.disp.cmdPushConstants(commandBuffer, render_data.bvh_build_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+        init_data.disp.cmdDispatch(commandBuffer, groupCount, 1, 1);
+        memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    };
+
+    uint32_t sphereGroups = (sphereCount + 63) / 64;
+    uint32_t blockGroups = (params.blockCount + 63) / 64;
+    dispatch(BVH_BUILD_CENTROIDS, 0, sphereGroups);
+    dispatch(BVH_BUILD_MORTON, 0, sphereGroups);
+    for (uint32_t shift = 0; shift < 32; shift += RADIX_BITS) {
+        int parity = (shift / RADIX_BITS) % 2;
+        params.shift = shift;
+        dispatch(BVH_BUILD_RADIX_COUNT, parity, blockGroups);
+        dispatch(BVH_BUILD_RADIX_SCAN, parity, 1);
+        dispatch(BVH_BUILD_RADIX_SCATTER, parity, blockGroups);
+    }
+    dispatch(BVH_BUILD_EMIT, 0, sphereGroups);
+    dispatch(BVH_BUILD_BOUNDS, 0, sphereGroups);
+
+    // The ray tracing pass reads the finished nodes and indices.
+    memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+// Traces the frame in batches of WAVEFRONT_BATCH pixels. Each batch's
+// primary rays are generated into a queue; every bounce then intersects the
+// queue, shades the hits into the next bounce's queue and the shadow queue,
+// and traces the shadow rays. wavefront_args turns the queue lengths into
+// the arguments of the indirect dispatches that follow it. The descriptor
+// set must be bound.
+void Renderer::record_wavefront(VkCommandBuffer commandBuffer, VkExtent2D extent, FrameConstants constants) {
+    VkBuffer buffer = render_data.wavefront_buffers[render_data.current_frame];
+    const WavefrontLayout& layout = wavefront_layout;
+
+    // Every stage reads what the previous one wrote, dispatch arguments
+    // included.
+    const VkPipelineStageFlags queueStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    const VkAccessFlags queueAccess = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    auto pushConstants = [&]() {
+        init_data.disp.cmdPushConstants(commandBuffer, render_data.pipeline_layout, TRACE_STAGES, 0, sizeof(constants), &constants);
+    };
+    auto dispatch = [&](WavefrontStage stage, uint32_t groupCount) {
+        init_data.disp.cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, render_data.wavefront_pipelines[stage]);
+        init_data.disp.cmdDispatch(commandBuffer, groupCount, 1, 1);
+        memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, queueStages, queueAccess);
+    };
+    auto dispatchIndirect = [&](WavefrontStage stage, VkDeviceSize argsOffset) {
+        init_data.disp.cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, render_data.wavefront_pipelines[stage]);
+        init_data.disp.cmdDispatchIndirect(commandBuffer, buffer, layout.counters + argsOffset);
+        memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, queueStages, queueAccess);
+    };
+
+    uint32_t pixels = extent.width * extent.height;
+    for (uint32_t batchStart = 0; batchStart < pixels; batchStart += WAVEFRONT_BATCH) {
+        uint32_t batchPixels = std::min(WAVEFRONT_BATCH, pixels - batchStart);
+        uint32_t batchGroups = (batchPixels + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+
+        // The generated queue is full; the previous batch is done with the
+        // counters and queues.
+        WavefrontCounters counters{};
+        counters.intersectArgs = {batchGroups, 1, 1};
+        counters.shadowArgs = {0, 1, 1};
+        counters.rayLaunch = batchPixels;
+        if (batchStart > 0) memory_barrier(commandBuffer, queueStages, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        init_data.disp.cmdUpdateBuffer(commandBuffer, buffer, layout.counters, sizeof(counters), &counters);
+        memory_barrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, queueStages, queueAccess);
+
+        constants.batchStart = batchStart;
+        constants.bounce = 0;
+        pushConstants();
+        dispatch(WAVEFRONT_GENERATE, batchGroups);
+        for (uint32_t bounce = 0; bounce < WAVEFRONT_BOUNCES; bounce++) {
+            if (bounce > 0) {
+                constants.bounce = bounce;
+                pushConstants();
+            }
+            dispatchIndirect(WAVEFRONT_INTERSECT, offsetof(WavefrontCounters, intersectArgs));
+            dispatchIndirect(WAVEFRONT_SHADE, offsetof(WavefrontCounters, intersectArgs));
+            dispatch(WAVEFRONT_ARGS, 1);
+            dispatchIndirect(WAVEFRONT_SHADOW, offsetof(WavefrontCounters, shadowArgs));
+        }
+        dispatch(WAVEFRONT_RESOLVE, batchGroups);
+    }
 }
 
 int Renderer::record_command_buffer(uint32_t imageIndex, const Camera& camera, float time, const Scene& scene) {
@@ -660,6 +2157,131 @@ int Renderer::record_command_buffer(uint32_t imageIndex, const Camera& camera, f
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
     if (init_data.disp.beginCommandBuffer(commandBuffer, &begin_info) != VK_SUCCESS) return -1;
+    uint32_t firstQuery = 2 * render_data.current_frame;
+    if (render_data.timestamp_pool != VK_NULL_HANDLE) {
+        init_data.disp.cmdResetQueryPool(commandBuffer, render_data.timestamp_pool, firstQuery, 2);
+        init_data.disp.cmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, render_data.timestamp_pool, firstQuery);
+    }
+
+    if (render_data.transfer_queue == render_data.graphics_queue) record_uploads(commandBuffer);
+    if (gpu_bvh_build) {
+        record_bvh_build(commandBuffer, static_cast<uint32_t>(gpu_sphere_count(scene)));
+    }
+
+    uint32_t uniformOffset = static_cast<uint32_t>(render_data.current_frame * render_data.uniform_ring_stride);
+    VkDescriptorSet descriptorSet = render_data.descriptor_sets[render_data.current_frame];
+    FrameConstants constants{};
+    constants.cameraPos[0] = camera.position.x;
+    constants.cameraPos[1] = camera.position.y;
+    constants.cameraPos[2] = camera.position.z;
+    constants.time = time;
+    Vec3 fwd = camera.getForward();
+    constants.cameraDir[0] = fwd.x;
+    constants.cameraDir[1] = fwd.y;
+    constants.cameraDir[2] = fwd.z;
+    // The compute path may trace fewer pixels than the swapchain has, see
+    // render_extent(); the composite pass upscales them.
+    VkExtent2D traceExtent = render_extent();
+    constants.resolution[0] = (float)traceExtent.width;
+    constants.resolution[1] = (float)traceExtent.height;
+    constants.displayResolution[0] = (float)init_data.swapchain.extent.width;
+    constants.displayResolution[1] = (float)init_data.swapchain.extent.height;
+    constants.sampleIndex = accumulated_samples;
+    constants.accumulate = accumulate ? 1 : 0;
+    // Accumulation takes over while the view is still, and restarts as
+    // soon as it moves, so reprojection only runs without it.
+    bool reprojecting = reproject && !accumulate;
+    constants.reproject = reprojecting ? 1 : 0;
+    constants.historyValid = history_valid ? 1 : 0;
+    memcpy(constants.previousCameraPos, last_constants.cameraPos, sizeof(constants.previousCameraPos));
+    memcpy(constants.previousCameraDir, last_constants.cameraDir, sizeof(constants.previousCameraDir));
+    constants.frameIndex = frame_index++;
+    bool checkerboarding = checkerboard && !accumulate;
+    bool validating = checkerboarding && constants.frameIndex % CHECKERBOARD_VALIDATION_PERIOD == 0;
+    constants.checkerboard = checkerboarding ? 1 : 0;
+    constants.validate = validating ? 1 : 0;
+
+    // The wavefront kernels only take over plain frames.
+    bool wavefronting = wavefront && !accumulate && !reprojecting && !checkerboarding;
+
+    // Both need storage images, so they always take the compute path.
+    bool computePath = compute_trace || accumulate || reproject || checkerboard || wavefront || traceExtent.width != init_data.swapchain.extent.width ||
+                       traceExtent.height != init_data.swapchain.extent.height;
+    if (computePath && accumulated_samples < MAX_ACCUMULATED_SAMPLES) {
+        VkImageMemoryBarrier imageBarriers[4]{};
+        for (VkImageMemoryBarrier& imageBarrier : imageBarriers) {
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        }
+        // The previous composite read of this frame's image finished before
+        // the frame's fence signaled. The accumulation image was last
+        // written and read by the previous frame, and is discarded on a
+        // restart.
+        imageBarriers[0].image = render_data.trace_images[render_data.current_frame];
+        imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarriers[1].image = render_data.accumulation_image;
+        if (accumulated_samples > 0) imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        // This frame's history was last read by the frame after it; the
+        // previous frame's was written by it, unless it is not valid.
+        imageBarriers[2].image = render_data.history_images[render_data.current_frame];
+        imageBarriers[2].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarriers[3].image = render_data.history_images[(render_data.current_frame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT];
+        if (history_valid) imageBarriers[3].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarriers[3].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarriers[3].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        init_data.disp.cmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 4, imageBarriers);
+
+        init_data.disp.cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, render_data.pipeline_layout, 0, 1, &descriptorSet, 1, &uniformOffset);
+        if (wavefronting) {
+            record_wavefront(commandBuffer, traceExtent, constants);
+        } else {
+            init_data.disp.cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, render_data.trace_pipeline);
+            init_data.disp.cmdPushConstants(commandBuffer, render_data.pipeline_layout, TRACE_STAGES, 0, sizeof(constants), &constants);
+            init_data.disp.cmdDispatch(commandBuffer, (traceExtent.width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE,
+                                       (traceExtent.height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE, 1);
+        }
+        if (accumulate) accumulated_samples++;
+        history_valid = reprojecting || checkerboarding;
+
+        if (checkerboarding) {
+            // The checkerboard pass reads the traced half of the history.
+            VkImageMemoryBarrier historyBarrier = imageBarriers[2];
+            historyBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            historyBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            historyBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            init_data.disp.cmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                                              0, nullptr, 0, nullptr, 1, &historyBarrier);
+            init_data.disp.cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, render_data.checkerboard_pipeline);
+            init_data.disp.cmdDispatch(commandBuffer, (traceExtent.width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE,
+                                       (traceExtent.height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE, 1);
+            if (validating) {
+                memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+            }
+        }
+
+        // The composite pass reads what the tiles wrote.
+        for (VkImageMemoryBarrier& imageBarrier : imageBarriers) {
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        }
+        init_data.disp.cmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                                          0, nullptr, 0, nullptr, 2, imageBarriers);
+    } else {
+        history_valid = false;
+    }
+    last_constants = constants;
+    if (!render_data.frame_rates.empty()) {
+        render_data.frame_rates[render_data.current_frame] = validating ? TraceRate::Validation : checkerboarding ? TraceRate::Checkerboard : TraceRate::Full;
+        render_data.frame_scales[render_data.current_frame] = render_scale;
+    }
 
     VkRenderPassBeginInfo render_pass_info = {};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -687,14 +2309,20 @@ int Renderer::record_command_buffer(uint32_t imageIndex, const Camera& camera, f
     init_data.disp.cmdSetScissor(commandBuffer, 0, 1, &scissor);
 
     init_data.disp.cmdBeginRenderPass(commandBuffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-    init_data.disp.cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, render_data.graphics_pipeline);
-    init_data.disp.cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, render_data.pipeline_layout, 0, 1, &render_data.descriptor_sets[render_data.current_frame], 0, nullptr);
+    // The fragment path traces here; the compute one only copies its image.
+    init_data.disp.cmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, computePath ? render_data.composite_pipeline : render_data.graphics_pipeline);
+    init_data.disp.cmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, render_data.pipeline_layout, 0, 1, &descriptorSet, 1, &uniformOffset);
+    init_data.disp.cmdPushConstants(commandBuffer, render_data.pipeline_layout, TRACE_STAGES, 0, sizeof(constants), &constants);
     init_data.disp.cmdDraw(commandBuffer, 3, 1, 0, 0);
 
     // Draw ImGui
     ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
 
     init_data.disp.cmdEndRenderPass(commandBuffer);
+    if (render_data.timestamp_pool != VK_NULL_HANDLE) {
+        init_data.disp.cmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, render_data.timestamp_pool, firstQuery + 1);
+        render_data.timestamps_written[render_data.current_frame] = true;
+    }
 
     if (init_data.disp.endCommandBuffer(commandBuffer) != VK_SUCCESS) return -1;
     return 0;
@@ -740,19 +2368,110 @@ int Renderer::draw(Camera& camera, float time, Scene& scene) {
 
         ImGui::Separator();
         ImGui::Text("Scene");
+        const char* accelModes[] = {"Auto", "BVH", "Grid"};
+        int accelIndex = static_cast<int>(accel_mode);
+        if (ImGui::Combo("Acceleration", &accelIndex, accelModes, IM_ARRAYSIZE(accelModes))) {
+            accel_mode = static_cast<AccelStructure>(accelIndex);
+        }
+        ImGui::Checkbox("GPU BVH Build", &gpu_bvh_build);
+        ImGui::Checkbox("Wide BVH", &wide_bvh_enabled);
+        ImGui::Checkbox("Compute Tracing", &compute_trace);
+        ImGui::Checkbox("Accumulate", &accumulate);
+        if (accumulate) ImGui::Text("Samples: %u", accumulated_samples);
+        ImGui::Checkbox("Reprojection", &reproject);
+        ImGui::Checkbox("Checkerboard", &checkerboard);
+        ImGui::Checkbox("Wavefront", &wavefront);
+        if (full_rate_ms > 0.0f || checkerboard_ms > 0.0f) {
+            ImGui::Text("GPU full rate %.2f ms, checkerboard %.2f ms", full_rate_ms, checkerboard_ms);
+        }
+        if (checkerboard_psnr > 0.0f) ImGui::Text("Checkerboard reconstruction: %.1f dB PSNR", checkerboard_psnr);
+        if (render_data.timestamp_pool != VK_NULL_HANDLE) {
+            ImGui::Checkbox("Dynamic Resolution", &dynamic_resolution);
+            if (dynamic_resolution) ImGui::SliderFloat("Target ms", &target_frame_ms, 4.0f, 50.0f);
+            VkExtent2D traced = render_extent();
+            ImGui::Text("GPU %.2f ms, tracing %ux%u (%.0f%%)", gpu_frame_ms, traced.width, traced.height, render_scale * 100.0f);
+        }
+        if (active_accel == AccelStructure::Grid) {
+            ImGui::Text("Grid: %ux%ux%u cells, %zu references", grid.dims[0], grid.dims[1], grid.dims[2], grid.cellSpheres.size());
+        } else if (gpu_bvh_build) {
+            ImGui::Text("BVH: built on the GPU each frame");
+        } else {
+            ImGui::Text("BVH: %zu nodes, SAH cost %.1f", bvh.nodes.size(), bvh.sahCost());
+            if (wide_bvh_enabled) ImGui::Text("Wide BVH: %zu nodes", wide_bvh.nodes.size());
+        }
+        if (device_local_scene) ImGui::Text("Staged: %.1f KiB last frame", staged_bytes / 1024.0);
         if (ImGui::Button("Add Sphere")) {
-            scene.spheres.push_back({{0, 5, 0}, 1.0f, {1, 1, 1}});
+            // Loaded scenes have their own material table, so the white
+            // material is added rather than assumed.
+            if (added_sphere_material == UINT32_MAX) added_sphere_material = scene.addMaterial({{1.0f, 1.0f, 1.0f}, 0.0f});
+            scene.addSphere({{0, 5, 0}, 1.0f, added_sphere_material});
         }
         
+        if (ImGui::Button("Add Molecule")) {
+            if (molecule_cluster == UINT32_MAX) {
+                // Six atoms around a larger one, shared by every molecule
+                SphereCluster molecule;
+                uint32_t core = scene.addMaterial({{0.9f, 0.2f, 0.2f}, 0.3f});
+                uint32_t atom = scene.addMaterial({{0.9f, 0.9f, 0.9f}, 0.5f});
+                molecule.spheres.push_back({{0, 0, 0}, 0.6f, core});
+                Vec3 offsets[] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+                for (Vec3 offset : offsets) molecule.spheres.push_back({offset * 0.8f, 0.35f, atom});
+                molecule_cluster = static_cast<uint32_t>(scene.clusters.size());
+                scene.clusters.push_back(molecule);
+            }
+            ClusterInstance instance;
+            instance.cluster = molecule_cluster;
+            instance.position = camera.position + camera.getForward() * 5.0f;
+            scene.instances.push_back(instance);
+            scene.instancesChanged = true;
+        }
+
+        for (int i = 0; i < scene.instances.size(); i++) {
+            ImGui::PushID(-1 - i);
+            if (ImGui::TreeNode("Instance")) {
+                bool moved = ImGui::DragFloat3("Position", &scene.instances[i].position.x, 0.1f);
+                moved |= ImGui::DragFloat("Scale", &scene.instances[i].scale, 0.01f, 0.01f, 100.0f);
+                if (moved) scene.dirtyInstances.push_back(i);
+                if (ImGui::Button("Remove")) {
+                    scene.instances.erase(scene.instances.begin() + i);
+                    scene.instancesChanged = true;
+                    ImGui::TreePop();
+                    ImGui::PopID();
+                    continue;
+                }
+                ImGui::TreePop();
+            }
+            ImGui::PopID();
+        }
+
+        if (ImGui::TreeNode("Materials")) {
+            for (int i = 0; i < scene.materials.size(); i++) {
+                ImGui::PushID(i);
+                ImGui::Text("Material %d", i);
+                bool edited = ImGui::ColorEdit3("Color", &scene.materials[i].color.x);
+                edited |= ImGui::SliderFloat("Roughness", &scene.materials[i].roughness, 0.0f, 1.0f);
+                if (edited) scene.materialEdited(i);
+                ImGui::PopID();
+            }
+            if (ImGui::Button("Add Material")) {
+                scene.addMaterial({{1, 1, 1}, 0.5f});
+            }
+            ImGui::TreePop();
+        }
+
         for (int i = 0; i < scene.spheres.size(); i++) {
             ImGui::PushID(i);
             if (ImGui::TreeNode("Sphere")) {
-                ImGui::DragFloat3("Center", &scene.spheres[i].center.x, 0.1f);
-                ImGui::DragFloat("Radius", &scene.spheres[i].radius, 0.1f);
-                ImGui::ColorEdit3("Color", &scene.spheres[i].color.x);
-                ImGui::SliderFloat("Roughness", &scene.spheres[i].roughness, 0.0f, 1.0f);
+                bool moved = ImGui::DragFloat3("Center", &scene.spheres[i].center.x, 0.1f);
+                moved |= ImGui::DragFloat("Radius", &scene.spheres[i].radius, 0.1f);
+                if (moved) scene.sphereMoved(i);
+                int material = static_cast<int>(scene.spheres[i].material);
+                if (ImGui::InputInt("Material", &material) && !scene.materials.empty()) {
+                    scene.spheres[i].material = static_cast<uint32_t>(std::clamp(material, 0, static_cast<int>(scene.materials.size()) - 1));
+                    scene.sphereReassigned(i);
+                }
                 if (ImGui::Button("Remove")) {
-                    scene.spheres.erase(scene.spheres.begin() + i);
+                    scene.removeSphere(i);
                     ImGui::TreePop();
                     ImGui::PopID();
                     continue;
@@ -768,6 +2487,21 @@ int Renderer::draw(Camera& camera, float time, Scene& scene) {
     ImGui::Render();
 
     init_data.disp.waitForFences(1, &render_data.in_flight_fences[render_data.current_frame], VK_TRUE, UINT64_MAX);
+    read_frame_stats();
+    update_render_scale();
+    // This frame's staging segment is free again.
+    render_data.staging_used[render_data.current_frame] = 0;
+    render_data.staging_copies[render_data.current_frame].clear();
+    staged_bytes = 0;
+    if (scene.spheres.size() > max_gpu_spheres && !sphere_limit_warned) {
+        std::cerr << "Scene has " << scene.spheres.size() << " spheres, drawing the first " << max_gpu_spheres << std::endl;
+        sphere_limit_warned = true;
+    }
+    if (reserve_sphere_buffers(gpu_sphere_count(scene)) != 0) return -1;
+    if (reserve_material_buffers(scene.materials.size()) != 0) return -1;
+    size_t clusterSpheres = 0;
+    for (const SphereCluster& cluster : scene.clusters) clusterSpheres += cluster.spheres.size();
+    if (reserve_instance_buffers(scene.instances.size(), clusterSpheres) != 0) return -1;
 
     uint32_t image_index = 0;
     VkResult result = init_data.disp.acquireNextImageKHR(init_data.swapchain, UINT64_MAX, render_data.available_semaphores[render_data.current_frame], VK_NULL_HANDLE, &image_index);
@@ -781,15 +2515,48 @@ int Renderer::draw(Camera& camera, float time, Scene& scene) {
     init_data.disp.resetFences(1, &render_data.in_flight_fences[render_data.current_frame]);
     init_data.disp.resetCommandBuffer(render_data.command_buffers[render_data.current_frame], 0);
     
-    update_uniform_buffer(camera, time, scene);
+    update_instance_buffer(scene);
+    Uniforms uniforms = update_uniform_buffer(scene);
+    update_history(camera, scene, uniforms);
     update_scene_buffer(scene);
+    update_material_buffer(scene);
+    update_grid_buffer(scene);
+    update_bvh_buffer(scene);
+    // Writes that missed the staging ring are redone in full the next time
+    // this frame's buffers come around; the frame itself still goes out so
+    // its fence signals.
+    int status = 0;
+    if (staging_failed) {
+        size_t frame = render_data.current_frame;
+        render_data.scene_uploaded_version[frame] = 0;
+        render_data.material_uploaded_version[frame] = 0;
+        render_data.grid_uploaded_version[frame] = UINT64_MAX;
+        render_data.instance_bottom_uploaded[frame] = 0;
+        render_data.instance_top_uploaded[frame] = 0;
+        render_data.wide_bvh_uploaded_version[frame] = 0;
+        render_data.bvh_dirty_nodes[frame].markAll(static_cast<uint32_t>(bvh.nodes.size()));
+        render_data.bvh_dirty_indices[frame] = static_cast<uint32_t>(bvh.primIndices.size());
+        staging_failed = false;
+        status = -1;
+    }
+    scene.dirtySpheres.clear();
+    scene.reassignedSpheres.clear();
+    scene.spheresChanged = false;
+    scene.dirtyMaterials.clear();
+    scene.materialsChanged = false;
+    scene.dirtyInstances.clear();
+    scene.dirtyClusters.clear();
+    scene.instancesChanged = false;
     record_command_buffer(image_index, camera, time, scene);
 
+    bool uploaded = false;
+    if (submit_uploads(uploaded) != 0) return -1;
+
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    VkSemaphore wait_semaphores[] = {render_data.available_semaphores[render_data.current_frame]};
-    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
+    VkSemaphore wait_semaphores[] = {render_data.available_semaphores[render_data.current_frame], render_data.transfer_semaphores[render_data.current_frame]};
+    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT};
+    submitInfo.waitSemaphoreCount = uploaded ? 2 : 1;
     submitInfo.pWaitSemaphores = wait_semaphores;
     submitInfo.pWaitDstStageMask = wait_stages;
     submitInfo.commandBufferCount = 1;
@@ -817,7 +2584,7 @@ int Renderer::draw(Camera& camera, float time, Scene& scene) {
     }
 
     render_data.current_frame = (render_data.current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
-    return 0;
+    return status;
 }
 
 void Renderer::resize() {
@@ -836,25 +2603,52 @@ void Renderer::cleanup() {
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         init_data.disp.destroySemaphore(render_data.available_semaphores[i], nullptr);
         init_data.disp.destroyFence(render_data.in_flight_fences[i], nullptr);
-        init_data.disp.destroyBuffer(render_data.uniform_buffers[i], nullptr);
-        init_data.disp.freeMemory(render_data.uniform_buffers_memory[i], nullptr);
-        init_data.disp.destroyBuffer(render_data.scene_buffers[i], nullptr);
-        init_data.disp.freeMemory(render_data.scene_buffers_memory[i], nullptr);
+    }
+    init_data.disp.destroyBuffer(render_data.uniform_ring, nullptr);
+    init_data.disp.freeMemory(render_data.uniform_ring_memory, nullptr);
+    destroy_sphere_buffers();
+    destroy_material_buffers();
+    destroy_instance_buffers();
+    destroy_grid_buffers();
+    destroy_trace_images();
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        init_data.disp.destroyBuffer(render_data.checkerboard_stats_buffers[i], nullptr);
+        init_data.disp.freeMemory(render_data.checkerboard_stats_memory[i], nullptr);
+        init_data.disp.destroyBuffer(render_data.wavefront_buffers[i], nullptr);
+        init_data.disp.freeMemory(render_data.wavefront_buffers_memory[i], nullptr);
+    }
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        init_data.disp.destroySemaphore(render_data.transfer_semaphores[i], nullptr);
+        init_data.disp.destroyBuffer(render_data.staging_buffers[i], nullptr);
+        init_data.disp.freeMemory(render_data.staging_buffers_memory[i], nullptr);
     }
     for (auto semaphore : render_data.finished_semaphore) {
         init_data.disp.destroySemaphore(semaphore, nullptr);
     }
 
+    init_data.disp.destroyQueryPool(render_data.timestamp_pool, nullptr);
     init_data.disp.destroyDescriptorPool(render_data.descriptor_pool, nullptr);
     init_data.disp.destroyDescriptorSetLayout(render_data.descriptor_set_layout, nullptr);
     init_data.disp.destroyCommandPool(render_data.command_pool, nullptr);
+    init_data.disp.destroyCommandPool(render_data.transfer_command_pool, nullptr);
 
     for (auto framebuffer : render_data.framebuffers) {
         init_data.disp.destroyFramebuffer(framebuffer, nullptr);
     }
 
     init_data.disp.destroyPipeline(render_data.graphics_pipeline, nullptr);
+    init_data.disp.destroyPipeline(render_data.composite_pipeline, nullptr);
+    init_data.disp.destroyPipeline(render_data.trace_pipeline, nullptr);
+    init_data.disp.destroyPipeline(render_data.checkerboard_pipeline, nullptr);
+    for (auto pipeline : render_data.wavefront_pipelines) {
+        init_data.disp.destroyPipeline(pipeline, nullptr);
+    }
     init_data.disp.destroyPipelineLayout(render_data.pipeline_layout, nullptr);
+    for (auto pipeline : render_data.bvh_build_pipelines) {
+        init_data.disp.destroyPipeline(pipeline, nullptr);
+    }
+    init_data.disp.destroyPipelineLayout(render_data.bvh_build_pipeline_layout, nullptr);
+    init_data.disp.destroyDescriptorSetLayout(render_data.bvh_build_set_layout, nullptr);
     init_data.disp.destroyRenderPass(render_data.render_pass, nullptr);
 
     init_data.swapchain.destroy_image_views(render_data.swapchain_image_views);
@@ -2,6 +2,11 @@
 #include "Types.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "Bvh.h"
+#include "Grid.h"
+#include "Instances.h"
+#include "WideBvh.h"
+#include "SceneLayout.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_vulkan.h>
 #include <vector>
@@ -20,6 +25,36 @@ public:
     void cleanup();
     int draw(Camera& camera, float time, Scene& scene);
     void resize();
+    // Build the BVH with compute shaders each frame instead of on the CPU.
+    void set_gpu_bvh_build(bool enabled) { gpu_bvh_build = enabled; }
+    // Trace the quantized 4-wide BVH (the default) or the binary one.
+    void set_wide_bvh(bool enabled) { wide_bvh_enabled = enabled; }
+    // Trace in a compute pass into a storage image, then composite it under
+    // ImGui, instead of in the fragment shader (the default).
+    void set_compute_trace(bool enabled) { compute_trace = enabled; }
+    // Average jittered samples while the camera and scene hold still; uses
+    // the compute path.
+    void set_accumulation(bool enabled) { accumulate = enabled; }
+    // While the camera moves, reuse the previous frame's shading wherever
+    // the same surface is still visible; uses the compute path.
+    void set_reprojection(bool enabled) { reproject = enabled; }
+    // Trace half the pixels each frame in an alternating checkerboard and
+    // reconstruct the rest; uses the compute path.
+    void set_checkerboard(bool enabled) { checkerboard = enabled; }
+    // Trace in stages queued from one to the next, each its own compute
+    // dispatch sized from the queue lengths, instead of one kernel per
+    // pixel; uses the compute path. Accumulation, reprojection and
+    // checkerboarding still use the single kernel.
+    void set_wavefront(bool enabled) { wavefront = enabled; }
+    // Trace at a fraction of the swapchain size, adjusted every frame so the
+    // GPU frame time meets `targetMs`, and upscale it; 0 traces at full
+    // size. Uses the compute path.
+    void set_dynamic_resolution(float targetMs) {
+        dynamic_resolution = targetMs > 0.0f;
+        if (dynamic_resolution) target_frame_ms = targetMs;
+    }
+    // Grid or BVH, or Auto (the default) to let SphereGrid::choose() decide.
+    void set_accel_structure(AccelStructure accel) { accel_mode = accel; }
 
 private:
     struct Init {
@@ -32,9 +67,23 @@ private:
         vkb::Swapchain swapchain;
     } init_data;
 
+    enum class TraceRate {
+        Full,
+        Checkerboard,
+        Validation, // Checkerboard frame traced in full to measure the reconstruction
+    };
+
+    struct StagedCopy {
+        VkBuffer buffer;
+        VkBufferCopy region; // srcOffset into the frame's staging segment
+    };
+
     struct RenderData {
         VkQueue graphics_queue;
         VkQueue present_queue;
+        VkQueue transfer_queue; // graphics_queue when there is no separate one
+        uint32_t graphics_family = 0;
+        uint32_t transfer_family = 0;
 
         std::vector<VkImage> swapchain_images;
         std::vector<VkImageView> swapchain_image_views;
@@ -44,52 +93,277 @@ private:
         VkDescriptorSetLayout descriptor_set_layout;
         VkPipelineLayout pipeline_layout;
         VkPipeline graphics_pipeline;
+        VkPipeline composite_pipeline; // Draws the compute path's image
+        VkPipeline trace_pipeline;
+        VkPipeline checkerboard_pipeline; // Fills in the pixels a checkerboard frame skipped
+        std::vector<VkPipeline> wavefront_pipelines; // One per WavefrontStage
+
+        // Compute tracing output, one per frame, sized to the swapchain
+        std::vector<VkImage> trace_images;
+        std::vector<VkDeviceMemory> trace_images_memory;
+        std::vector<VkImageView> trace_image_views;
+        // Running average of the accumulation mode, kept across frames
+        VkImage accumulation_image;
+        VkDeviceMemory accumulation_image_memory;
+        VkImageView accumulation_image_view;
+        // Color and hit distance for reprojection; frame i writes image i
+        // and reads the other one.
+        std::vector<VkImage> history_images;
+        std::vector<VkDeviceMemory> history_images_memory;
+        std::vector<VkImageView> history_image_views;
 
         VkCommandPool command_pool;
         std::vector<VkCommandBuffer> command_buffers;
+        // Per-frame uploads on a separate transfer queue; the graphics
+        // submit waits on the frame's semaphore when anything was copied.
+        VkCommandPool transfer_command_pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> transfer_command_buffers;
+        std::vector<VkSemaphore> transfer_semaphores;
+
+        // Staging ring: one persistently mapped segment per frame in flight,
+        // refilled once the frame's fence signals, and the copies into
+        // device-local buffers staged for the frame so far.
+        std::vector<VkBuffer> staging_buffers;
+        std::vector<VkDeviceMemory> staging_buffers_memory;
+        std::vector<void*> staging_buffers_mapped;
+        std::vector<VkDeviceSize> staging_capacity;
+        std::vector<VkDeviceSize> staging_used;
+        std::vector<std::vector<StagedCopy>> staging_copies;
 
         std::vector<VkSemaphore> available_semaphores;
         std::vector<VkSemaphore> finished_semaphore;
         std::vector<VkFence> in_flight_fences;
         size_t current_frame = 0;
 
-        std::vector<VkBuffer> uniform_buffers;
-        std::vector<VkDeviceMemory> uniform_buffers_memory;
-        std::vector<void*> uniform_buffers_mapped;
+        // One persistently mapped buffer of Uniforms, a slot per frame in
+        // flight, bound with the frame's slot as the dynamic offset
+        VkBuffer uniform_ring;
+        VkDeviceMemory uniform_ring_memory;
+        char* uniform_ring_mapped = nullptr;
+        VkDeviceSize uniform_ring_stride = 0;
 
         std::vector<VkBuffer> scene_buffers;
         std::vector<VkDeviceMemory> scene_buffers_memory;
         std::vector<void*> scene_buffers_mapped;
+        VkDeviceSize scene_material_ids_offset = 0; // Sphere geometry first, then the material indices
+        // Spheres each frame's buffer still needs, one bit per sphere
+        std::vector<BvhDirtyNodes> scene_dirty_spheres;
+        std::vector<uint64_t> scene_uploaded_version; // Scene::sphereVersion in each frame's buffer, 0 for none
+
+        // Scene::materials, indexed by scene and cluster spheres alike
+        std::vector<VkBuffer> material_buffers;
+        std::vector<VkDeviceMemory> material_buffers_memory;
+        std::vector<void*> material_buffers_mapped;
+        std::vector<BvhDirtyNodes> material_dirty;
+        std::vector<uint64_t> material_uploaded_version; // Scene::materialVersion in each frame's buffer, 0 for none
+
+        // BVH nodes followed by primIndices at bvh_indices_offset and wide
+        // nodes at bvh_wide_offset, bound as three storage buffer ranges of
+        // the same buffer.
+        std::vector<VkBuffer> bvh_buffers;
+        std::vector<VkDeviceMemory> bvh_buffers_memory;
+        std::vector<void*> bvh_buffers_mapped;
+        VkDeviceSize bvh_indices_offset = 0;
+        VkDeviceSize bvh_wide_offset = 0;
+        std::vector<uint64_t> wide_bvh_uploaded_version; // wide_bvh_version in each frame's buffer, 0 for none
+        // Changes not yet copied into each frame's BVH buffer
+        std::vector<BvhDirtyNodes> bvh_dirty_nodes;
+        std::vector<uint32_t> bvh_dirty_indices;
+
+        // GPU BVH build: one compute pipeline per stage, per-frame scratch
+        // and two descriptor sets per frame for the radix sort ping-pong.
+        VkDescriptorSetLayout bvh_build_set_layout;
+        VkPipelineLayout bvh_build_pipeline_layout;
+        std::vector<VkPipeline> bvh_build_pipelines;
+        std::vector<VkBuffer> bvh_scratch_buffers;
+        std::vector<VkDeviceMemory> bvh_scratch_buffers_memory;
+        std::vector<VkDescriptorSet> bvh_build_sets; // frame * 2 + ping-pong parity
+
+        // Grid header and cellStart, then cellSpheres at grid_spheres_offset
+        std::vector<VkBuffer> grid_buffers;
+        std::vector<VkDeviceMemory> grid_buffers_memory;
+        std::vector<void*> grid_buffers_mapped;
+        VkDeviceSize grid_spheres_offset = 0;
+        std::vector<uint64_t> grid_uploaded_version; // grid_version in each frame's buffer, 0 for none, UINT64_MAX before the first upload
+
+        // Instance nodes, prims, transforms, cluster spheres and their
+        // material indices as five ranges of one buffer, see instance_layout.
+        std::vector<VkBuffer> instance_buffers;
+        std::vector<VkDeviceMemory> instance_buffers_memory;
+        std::vector<void*> instance_buffers_mapped;
+        // Versions in each frame's buffer, 0 for none
+        std::vector<uint64_t> instance_bottom_uploaded;
+        std::vector<uint64_t> instance_top_uploaded;
+
+        // Start and end of each frame's commands, VK_NULL_HANDLE when the
+        // graphics queue has no timestamps
+        VkQueryPool timestamp_pool = VK_NULL_HANDLE;
+        std::vector<bool> timestamps_written;
+        std::vector<TraceRate> frame_rates; // How each frame traced, to file its time under
+        std::vector<float> frame_scales;    // render_scale each frame traced at
+
+        // CheckerboardStats of checkerboard.comp, read back after validation frames
+        std::vector<VkBuffer> checkerboard_stats_buffers;
+        std::vector<VkDeviceMemory> checkerboard_stats_memory;
+        std::vector<void*> checkerboard_stats_mapped;
+
+        // Ray, hit and shadow queues, radiance and counters of the wavefront
+        // kernels, one buffer per frame, see wavefront_layout
+        std::vector<VkBuffer> wavefront_buffers;
+        std::vector<VkDeviceMemory> wavefront_buffers_memory;
 
         VkDescriptorPool descriptor_pool;
         VkDescriptorPool imgui_descriptor_pool;
         std::vector<VkDescriptorSet> descriptor_sets;
     } render_data;
 
+    Bvh bvh;
+    bool gpu_bvh_build = false;
+    WideBvh wide_bvh;
+    bool wide_bvh_enabled = true;
+    bool compute_trace = false;
+    bool accumulate = false;
+    uint32_t accumulated_samples = 0; // In the accumulation image; 0 restarts it
+    bool reproject = false;
+    bool history_valid = false; // The last frame wrote its history image for this scene
+    uint32_t frame_index = 0;
+    FrameConstants last_constants{}; // Pushed by the last recorded frame
+    bool dynamic_resolution = false;
+    float target_frame_ms = 16.7f;
+    float render_scale = 1.0f;     // Traced fraction of the swapchain size on each axis
+    float gpu_frame_ms = 0.0f;     // Last measured, 0 before the first
+    float gpu_frame_scale = 1.0f;  // render_scale of the frame gpu_frame_ms measured
+    float timestamp_period = 0.0f; // Nanoseconds per timestamp tick
+    bool checkerboard = false;
+    bool wavefront = false;
+    // Averaged GPU frame times of either rate, and the reconstruction
+    // quality measured by the last validation frame; 0 until measured
+    float full_rate_ms = 0.0f;
+    float checkerboard_ms = 0.0f;
+    float checkerboard_psnr = 0.0f;
+    // What the accumulated and history images were traced with, apart
+    // from the camera; see update_history
+    struct HistoryKey {
+        Uniforms uniforms;
+        uint64_t sphereVersion, materialVersion, instanceBottomVersion, instanceTopVersion;
+    } history_key{};
+    uint64_t wide_bvh_version = 0; // Bumped whenever wide_bvh is collapsed again
+    SphereGrid grid;
+    uint64_t grid_version = 0; // Bumped on every grid build
+    AccelStructure accel_mode = AccelStructure::Auto;
+    AccelStructure auto_accel = AccelStructure::Bvh; // SphereGrid::choose() for the current spheres
+    AccelStructure active_accel = AccelStructure::Bvh; // What this frame traces
+    TwoLevelBvh instance_bvh;
+    uint64_t instance_bottom_version = 0; // Bumped when the clusters are rebuilt
+    uint64_t instance_top_version = 0;    // Bumped when instances move
+    int gpu_instance_count = 0;           // Instances the shader traces, 0 when they do not fit
+    uint32_t molecule_cluster = UINT32_MAX; // Scene::clusters entry of "Add Molecule", once added
+    uint32_t added_sphere_material = UINT32_MAX; // Scene::materials entry of "Add Sphere", once added
+
+    // Spheres and grid entries the current buffers have room for, grown by
+    // reserve_sphere_buffers and reserve_grid_buffers.
+    uint32_t sphere_capacity = 0;
+    uint32_t grid_cell_capacity = 0;
+    uint32_t grid_ref_capacity = 0;
+    uint32_t material_capacity = 0;
+    // Instances and cluster spheres the instance buffers have room for,
+    // grown by reserve_instance_buffers.
+    uint32_t instance_capacity = 0;
+    uint32_t cluster_sphere_capacity = 0;
+    size_t max_gpu_spheres = 0; // Most spheres the device's storage buffer range allows
+    bool sphere_limit_warned = false;
+    // Scene and acceleration buffers are device local and filled through
+    // the staging ring; otherwise host visible and written in place.
+    bool device_local_scene = false;
+    size_t staged_bytes = 0; // Staged by the frame being recorded
+    // Set when a staging segment could not grow; the frame's writes that did
+    // not fit land in staging_discard and draw reports the failure.
+    bool staging_failed = false;
+    std::vector<char> staging_discard;
+
+    // Offsets of the ranges inside each instance buffer
+    struct InstanceLayout {
+        VkDeviceSize prims, instances, spheres, material_ids, size;
+    } instance_layout;
+
+    // Offsets of the GPU build's arrays inside each scratch buffer
+    struct BvhScratchLayout {
+        VkDeviceSize keys_a, keys_b, values_b, histograms, parents, state, size;
+    } bvh_scratch_layout;
+
+    // Offsets of the ranges inside each wavefront buffer
+    struct WavefrontLayout {
+        VkDeviceSize hits, shadows, radiance, counters, size;
+    } wavefront_layout;
+
     int device_initialization();
     int create_swapchain();
     int get_queues();
     int create_render_pass();
     int create_descriptor_set_layout();
     int create_graphics_pipeline();
+    int create_trace_pipeline();
     int create_framebuffers();
     int create_command_pool();
     int create_uniform_buffers();
+    int create_staging_buffers();
     int create_scene_buffers();
+    int create_material_buffers();
+    int create_bvh_buffers();
+    int create_bvh_build_pipelines();
+    int create_bvh_scratch_buffers();
+    int create_bvh_build_descriptor_sets();
+    int create_grid_buffers();
+    int create_instance_buffers();
+    int create_trace_images();
+    int create_checkerboard_stats_buffers();
+    int create_wavefront_buffers();
+    int create_storage_image(VkFormat format, VkImage& image, VkDeviceMemory& memory, VkImageView& view);
     int create_descriptor_pool();
     int create_descriptor_sets();
+    void write_descriptor_sets();
+    void write_bvh_build_descriptor_sets();
+    int reserve_sphere_buffers(size_t sphereCount);
+    int reserve_grid_buffers(size_t cellCount, size_t refCount);
+    int reserve_material_buffers(size_t materialCount);
+    int reserve_instance_buffers(size_t instanceCount, size_t clusterSphereCount);
+    void destroy_sphere_buffers();
+    void destroy_grid_buffers();
+    void destroy_material_buffers();
+    void destroy_instance_buffers();
+    void destroy_trace_images();
     int create_command_buffers();
     int create_sync_objects();
+    int create_timestamp_queries();
     int recreate_swapchain();
     
     // ImGui
     int init_imgui();
     
     int record_command_buffer(uint32_t imageIndex, const Camera& camera, float time, const Scene& scene);
-    void update_uniform_buffer(const Camera& camera, float time, const Scene& scene);
+    Uniforms update_uniform_buffer(const Scene& scene);
+    void update_history(const Camera& camera, const Scene& scene, const Uniforms& uniforms);
+    void read_frame_stats();
+    void update_render_scale();
+    VkExtent2D render_extent() const;
     void update_scene_buffer(const Scene& scene);
+    void update_material_buffer(const Scene& scene);
+    void update_grid_buffer(const Scene& scene);
+    void update_instance_buffer(const Scene& scene);
+    void update_bvh_buffer(const Scene& scene);
+    size_t gpu_sphere_count(const Scene& scene) const;
+    void memory_barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+    void record_bvh_build(VkCommandBuffer commandBuffer, uint32_t sphereCount);
+    void record_wavefront(VkCommandBuffer commandBuffer, VkExtent2D extent, FrameConstants constants);
     
     std::vector<char> readFile(const std::string& filename);
     VkShaderModule createShaderModule(const std::vector<char>& code);
-    void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    uint32_t find_memory_type(uint32_t typeBits, VkMemoryPropertyFlags properties) const;
+    int create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void destroy_buffer(VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    int create_scene_data_buffer(VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& bufferMemory, void*& mapped);
+    void* upload_target(VkBuffer buffer, void* mapped, VkDeviceSize offset, VkDeviceSize size);
+    void record_uploads(VkCommandBuffer commandBuffer);
+    int submit_uploads(bool& submitted);
+    VkDeviceSize align_storage_offset(VkDeviceSize offset) const;
 };
@@ -1,12 +1,58 @@
 #pragma once
 #include "Types.h"
+#include "Camera.h"
+#include <cmath>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
+class SceneFile;
+
+struct Material {
+    Vec3 color;
+    float roughness;
+};
+
 struct Sphere {
     Vec3 center;
     float radius;
-    Vec3 color;
-    float roughness;
+    uint32_t material = 0; // Index into Scene::materials
+};
+
+// A group of spheres in its own local space, e.g. a molecule. It is stored
+// once and placed any number of times through ClusterInstance.
+struct SphereCluster {
+    std::vector<Sphere> spheres;
+};
+
+// One placement of a cluster: local positions are rotated, scaled uniformly
+// and translated, so its spheres stay spheres.
+struct ClusterInstance {
+    uint32_t cluster = 0;
+    Vec3 position = {0.0f, 0.0f, 0.0f};
+    float scale = 1.0f;
+    // Local axes in world space, orthonormal
+    Vec3 axisX = {1.0f, 0.0f, 0.0f};
+    Vec3 axisY = {0.0f, 1.0f, 0.0f};
+    Vec3 axisZ = {0.0f, 0.0f, 1.0f};
+
+    Vec3 toWorld(Vec3 p) const { return position + (axisX * p.x + axisY * p.y + axisZ * p.z) * scale; }
+    Vec3 toLocal(Vec3 p) const {
+        Vec3 q = p - position;
+        return Vec3{dot(axisX, q), dot(axisY, q), dot(axisZ, q)} * (1.0f / scale);
+    }
+    Vec3 directionToLocal(Vec3 d) const { return {dot(axisX, d), dot(axisY, d), dot(axisZ, d)}; }
+
+    // Rotation by `angle` radians around the normalized `axis`.
+    void setRotation(Vec3 axis, float angle) {
+        float c = std::cos(angle), s = std::sin(angle), t = 1.0f - c;
+        auto rotate = [&](Vec3 v) {
+            return v * c + cross(axis, v) * s + axis * (dot(axis, v) * t);
+        };
+        axisX = rotate({1.0f, 0.0f, 0.0f});
+        axisY = rotate({0.0f, 1.0f, 0.0f});
+        axisZ = rotate({0.0f, 0.0f, 1.0f});
+    }
 };
 
 struct PointLight {
@@ -27,17 +73,91 @@ struct SpotLight {
 
 struct Scene {
     std::vector<Sphere> spheres;
+    // Shared by spheres and cluster spheres through their material index
+    std::vector<Material> materials;
     PointLight pointLight;
     SpotLight spotLight;
     bool sunEnabled = true;
     Vec3 sunDirection = {0.5f, 1.0f, -0.5f};
+
+    // Spheres whose center or radius changed since the last frame; the
+    // renderer refits the BVH for these instead of rebuilding it.
+    std::vector<uint32_t> dirtySpheres;
+    // Spheres given another material since the last frame; only their GPU
+    // copies are rewritten.
+    std::vector<uint32_t> reassignedSpheres;
+    // Set when spheres are added or removed, which needs a full rebuild and
+    // upload. Edits that bypass the helpers below must set it too.
+    bool spheresChanged = true;
+    // Bumped on every change to `spheres`, so unchanged frames skip the
+    // upload entirely.
+    uint64_t sphereVersion = 1;
+
+    // Materials edited since the last frame, and whether any were added or
+    // removed; tracked like the spheres above.
+    std::vector<uint32_t> dirtyMaterials;
+    bool materialsChanged = true;
+    uint64_t materialVersion = 1;
+
+    // File the spheres were loaded from, see loadScene(). Its sections stay
+    // mapped, and while sphereVersion is still sourceVersion they match
+    // `spheres`, so renderers may copy from them directly.
+    std::shared_ptr<const SceneFile> source;
+    uint64_t sourceVersion = 0;
+    const SceneFile* unchangedSource() const { return source && sourceVersion == sphereVersion ? source.get() : nullptr; }
+
+    // Instanced geometry, traced next to `spheres` through a two-level BVH.
+    std::vector<SphereCluster> clusters;
+    std::vector<ClusterInstance> instances;
+    // Instances that moved since the last frame; only the top level is refit.
+    std::vector<uint32_t> dirtyInstances;
+    // Clusters whose spheres were replaced since the last frame; their
+    // bottom levels are rebuilt without touching the other clusters.
+    std::vector<uint32_t> dirtyClusters;
+    // Set when clusters are added or removed, or instances added or removed.
+    bool instancesChanged = true;
     
+    // Editing helpers that keep the change tracking above up to date.
+    void addSphere(const Sphere& sphere) {
+        spheres.push_back(sphere);
+        spheresChanged = true;
+        sphereVersion++;
+    }
+    void removeSphere(uint32_t i) {
+        spheres.erase(spheres.begin() + i);
+        spheresChanged = true;
+        sphereVersion++;
+    }
+    void sphereMoved(uint32_t i) {
+        dirtySpheres.push_back(i);
+        sphereVersion++;
+    }
+    void sphereReassigned(uint32_t i) {
+        reassignedSpheres.push_back(i);
+        sphereVersion++;
+    }
+    uint32_t addMaterial(const Material& material) {
+        materials.push_back(material);
+        materialsChanged = true;
+        materialVersion++;
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+    void materialEdited(uint32_t i) {
+        dirtyMaterials.push_back(i);
+        materialVersion++;
+    }
+
     Scene() {
         // Default scene
-        spheres.push_back({{0.0f, 0.0f, 0.0f}, 1.0f, {1.0f, 0.0f, 0.0f}, 0.5f}); // Red sphere
-        spheres.push_back({{2.0f, 0.0f, 0.0f}, 1.0f, {0.0f, 1.0f, 0.0f}, 0.2f}); // Green sphere
-        spheres.push_back({{-2.0f, 0.0f, 0.0f}, 1.0f, {0.0f, 0.0f, 1.0f}, 0.8f}); // Blue sphere
-        spheres.push_back({{0.0f, -101.0f, 0.0f}, 100.0f, {0.5f, 0.5f, 0.5f}, 1.0f}); // Floor
+        materials.push_back({{1.0f, 0.0f, 0.0f}, 0.5f}); // Red
+        materials.push_back({{0.0f, 1.0f, 0.0f}, 0.2f}); // Green
+        materials.push_back({{0.0f, 0.0f, 1.0f}, 0.8f}); // Blue
+        materials.push_back({{0.5f, 0.5f, 0.5f}, 1.0f}); // Floor
+        materials.push_back({{1.0f, 1.0f, 1.0f}, 0.0f}); // White
+        spheres.push_back({{0.0f, 0.0f, 0.0f}, 1.0f, 0});      // Red sphere
+        spheres.push_back({{2.0f, 0.0f, 0.0f}, 1.0f, 1});      // Green sphere
+        spheres.push_back({{-2.0f, 0.0f, 0.0f}, 1.0f, 2});     // Blue sphere
+        spheres.push_back({{0.0f, -101.0f, 0.0f}, 100.0f, 3}); // Floor
 
         pointLight = {{0.0f, 5.0f, 0.0f}, 1.0f, {1.0f, 1.0f, 1.0f}, 0.0f};
         spotLight = {{0.0f, 5.0f, 2.0f}, 2.0f, {0.0f, -1.0f, 0.0f}, 0.9f, {1.0f, 1.0f, 0.0f}, 0.8f};
@@ -0,0 +1,306 @@
+#include "SceneFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <tuple>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t alignSection(uint64_t offset) { return (offset + 15) & ~uint64_t(15); }
+
+SceneFile::~SceneFile() {
+    if (data) munmap(const_cast<void*>(data), size);
+}
+
+bool SceneFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open scene file " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SceneFileHeader)) {
+        std::cerr << path << " is not a scene file" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Cannot map scene file " << path << std::endl;
+        size = 0;
+        return false;
+    }
+    data = mapping;
+
+    const SceneFileHeader& h = header();
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION) {
+        std::cerr << path << " is not a version " << VERSION << " scene file" << std::endl;
+        return false;
+    }
+    auto fits = [&](uint64_t offset, uint64_t bytes) {
+        return offset % 16 == 0 && offset >= sizeof(SceneFileHeader) && offset <= size && bytes <= size - offset;
+    };
+    bool valid = fits(h.geometryOffset, uint64_t(h.sphereCount) * sizeof(gpu::vec4)) &&
+                 fits(h.materialIdsOffset, uint64_t(h.sphereCount) * sizeof(uint32_t)) &&
+                 fits(h.materialsOffset, uint64_t(h.materialCount) * sizeof(gpu::SphereMaterial)) &&
+                 fits(h.lightsOffset, sizeof(SceneFileLights)) && (h.materialCount > 0 || h.sphereCount == 0);
+    if (valid && hasBvh()) {
+        // A binary tree over n spheres has between 1 and 2n - 1 nodes.
+        valid = h.bvhNodeCount >= 1 && uint64_t(h.bvhNodeCount) < 2 * uint64_t(h.sphereCount) &&
+                fits(h.bvhNodesOffset, uint64_t(h.bvhNodeCount) * sizeof(BvhNode)) && fits(h.bvhIndicesOffset, uint64_t(h.sphereCount) * sizeof(uint32_t));
+    }
+    if (valid && hasChunks()) {
+        valid = fits(h.chunksOffset, uint64_t(h.chunkCount) * sizeof(SceneFileChunk)) &&
+                fits(h.proxyGeometryOffset, uint64_t(h.proxyCount) * sizeof(gpu::vec4)) &&
+                fits(h.proxyMaterialIdsOffset, uint64_t(h.proxyCount) * sizeof(uint32_t));
+        for (size_t i = 0; valid && i < h.chunkCount; i++) {
+            const SceneFileChunk& chunk = chunks()[i];
+            valid = chunk.firstSphere <= h.sphereCount && chunk.sphereCount <= h.sphereCount - chunk.firstSphere &&
+                    chunk.firstProxy <= h.proxyCount && chunk.proxyCount <= h.proxyCount - chunk.firstProxy;
+        }
+    }
+    // Material indices are checked where they are copied out.
+    if (!valid) {
+        std::cerr << "Scene file " << path << " is truncated or corrupt" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void SceneFile::release(const void* bytes, size_t count) const {
+    // Only whole pages inside the range, which may share its first and last
+    // pages with data still in use
+    uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t first = (reinterpret_cast<uintptr_t>(bytes) + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t last = (reinterpret_cast<uintptr_t>(bytes) + count) & ~(pageSize - 1);
+    if (last > first) madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+}
+
+// Everything a file holds, in the order of the sections
+struct SceneFileContents {
+    std::vector<gpu::vec4> geometry;
+    std::vector<uint32_t> materialIds;
+    std::vector<gpu::SphereMaterial> materials;
+    SceneFileLights lights;
+    const Bvh* bvh = nullptr;
+    std::vector<SceneFileChunk> chunks;
+    std::vector<gpu::vec4> proxyGeometry;
+    std::vector<uint32_t> proxyMaterialIds;
+};
+
+// Spheres in `order`, materials and lights of `scene`
+static SceneFileContents contentsOf(const Scene& scene, std::span<const uint32_t> order) {
+    SceneFileContents c;
+    size_t materialCount = scene.materials.size();
+    c.geometry.resize(order.size());
+    c.materialIds.resize(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        c.geometry[i] = gpu::sphereGeometry(scene.spheres[order[i]]);
+        c.materialIds[i] = gpu::sphereMaterialIndex(scene.spheres[order[i]], materialCount);
+    }
+    for (const Material& m : scene.materials) c.materials.push_back(gpu::sphereMaterial(m));
+
+    const Scene& s = scene;
+    c.lights = {
+        {{s.pointLight.position.x, s.pointLight.position.y, s.pointLight.position.z}, s.pointLight.intensity,
+         {s.pointLight.color.x, s.pointLight.color.y, s.pointLight.color.z}, 0.0f},
+        {{s.spotLight.position.x, s.spotLight.position.y, s.spotLight.position.z}, s.spotLight.intensity,
+         {s.spotLight.direction.x, s.spotLight.direction.y, s.spotLight.direction.z}, s.spotLight.cutOff,
+         {s.spotLight.color.x, s.spotLight.color.y, s.spotLight.color.z}, s.spotLight.outerCutOff},
+        {s.sunDirection.x, s.sunDirection.y, s.sunDirection.z}, s.sunEnabled ? 1u : 0u,
+    };
+    return c;
+}
+
+static bool writeContents(const std::string& path, const SceneFileContents& c) {
+    uint32_t sphereCount = static_cast<uint32_t>(c.geometry.size());
+    bool withBvh = c.bvh && !c.bvh->empty() && c.bvh->primIndices.size() == sphereCount;
+    bool withChunks = !c.chunks.empty();
+
+    SceneFileHeader h{};
+    memcpy(h.magic, SceneFile::MAGIC, sizeof(SceneFile::MAGIC));
+    h.version = SceneFile::VERSION;
+    h.flags = (withBvh ? SceneFile::HAS_BVH : 0) | (withChunks ? SceneFile::HAS_CHUNKS : 0);
+    h.sphereCount = sphereCount;
+    h.materialCount = static_cast<uint32_t>(c.materials.size());
+    h.bvhNodeCount = withBvh ? static_cast<uint32_t>(c.bvh->nodes.size()) : 0;
+    h.chunkCount = static_cast<uint32_t>(c.chunks.size());
+    h.proxyCount = static_cast<uint32_t>(c.proxyGeometry.size());
+    h.geometryOffset = alignSection(sizeof(SceneFileHeader));
+    h.materialIdsOffset = alignSection(h.geometryOffset + uint64_t(sphereCount) * sizeof(gpu::vec4));
+    h.materialsOffset = alignSection(h.materialIdsOffset + uint64_t(sphereCount) * sizeof(uint32_t));
+    h.lightsOffset = alignSection(h.materialsOffset + uint64_t(h.materialCount) * sizeof(gpu::SphereMaterial));
+    h.bvhNodesOffset = alignSection(h.lightsOffset + sizeof(SceneFileLights));
+    h.bvhIndicesOffset = alignSection(h.bvhNodesOffset + uint64_t(h.bvhNodeCount) * sizeof(BvhNode));
+    h.chunksOffset = alignSection(h.bvhIndicesOffset + (withBvh ? uint64_t(sphereCount) * sizeof(uint32_t) : 0));
+    h.proxyGeometryOffset = alignSection(h.chunksOffset + uint64_t(h.chunkCount) * sizeof(SceneFileChunk));
+    h.proxyMaterialIdsOffset = alignSection(h.proxyGeometryOffset + uint64_t(h.proxyCount) * sizeof(gpu::vec4));
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    uint64_t written = 0;
+    auto put = [&](uint64_t offset, const void* bytes, size_t count) {
+        static const char zeros[16] = {};
+        file.write(zeros, static_cast<std::streamsize>(offset - written));
+        file.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(count));
+        written = offset + count;
+    };
+    put(0, &h, sizeof(h));
+    put(h.geometryOffset, c.geometry.data(), c.geometry.size() * sizeof(gpu::vec4));
+    put(h.materialIdsOffset, c.materialIds.data(), c.materialIds.size() * sizeof(uint32_t));
+    put(h.materialsOffset, c.materials.data(), c.materials.size() * sizeof(gpu::SphereMaterial));
+    put(h.lightsOffset, &c.lights, sizeof(c.lights));
+    if (withBvh) {
+        put(h.bvhNodesOffset, c.bvh->nodes.data(), c.bvh->nodes.size() * sizeof(BvhNode));
+        put(h.bvhIndicesOffset, c.bvh->primIndices.data(), c.bvh->primIndices.size() * sizeof(uint32_t));
+    }
+    if (withChunks) {
+        put(h.chunksOffset, c.chunks.data(), c.chunks.size() * sizeof(SceneFileChunk));
+        put(h.proxyGeometryOffset, c.proxyGeometry.data(), c.proxyGeometry.size() * sizeof(gpu::vec4));
+        put(h.proxyMaterialIdsOffset, c.proxyMaterialIds.data(), c.proxyMaterialIds.size() * sizeof(uint32_t));
+    }
+    return static_cast<bool>(file);
+}
+
+bool SceneFile::write(const std::string& path, const Scene& scene, const Bvh* bvh) {
+    std::vector<uint32_t> order(scene.spheres.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    SceneFileContents contents = contentsOf(scene, order);
+    contents.bvh = bvh;
+    return writeContents(path, contents);
+}
+
+// Proxies are one sphere per occupied octant of a chunk, holding the same
+// volume as the spheres in it at their volume-weighted center, in the
+// material covering the most volume there.
+bool SceneFile::writeChunked(const std::string& path, const Scene& scene, float chunkSize) {
+    struct Cell {
+        int32_t x, y, z;
+        auto operator<=>(const Cell&) const = default;
+    };
+    auto cellOf = [&](const Sphere& s) {
+        return Cell{static_cast<int32_t>(std::floor(s.center.x / chunkSize)), static_cast<int32_t>(std::floor(s.center.y / chunkSize)),
+                    static_cast<int32_t>(std::floor(s.center.z / chunkSize))};
+    };
+    std::vector<uint32_t> order(scene.spheres.size());
+    std::vector<Cell> cells(scene.spheres.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+        cells[i] = cellOf(scene.spheres[i]);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return std::tie(cells[a].z, cells[a].y, cells[a].x) < std::tie(cells[b].z, cells[b].y, cells[b].x);
+    });
+    SceneFileContents contents = contentsOf(scene, order);
+
+    uint32_t first = 0;
+    while (first < order.size()) {
+        Cell cell = cells[order[first]];
+        uint32_t end = first;
+        while (end < order.size() && cells[order[end]] == cell) end++;
+
+        SceneFileChunk chunk{};
+        chunk.firstSphere = first;
+        chunk.sphereCount = end - first;
+        chunk.firstProxy = static_cast<uint32_t>(contents.proxyGeometry.size());
+        for (int a = 0; a < 3; a++) {
+            chunk.boundsMin[a] = 1e30f;
+            chunk.boundsMax[a] = -1e30f;
+        }
+        Vec3 middle = Vec3{cell.x + 0.5f, cell.y + 0.5f, cell.z + 0.5f} * chunkSize;
+        struct Octant {
+            Vec3 weightedCenter = {0.0f, 0.0f, 0.0f};
+            double volume = 0.0;
+            std::vector<std::pair<uint32_t, double>> materialVolume;
+        } octants[MAX_CHUNK_PROXIES];
+        for (uint32_t i = first; i < end; i++) {
+            const Sphere& s = scene.spheres[order[i]];
+            float center[3] = {s.center.x, s.center.y, s.center.z};
+            for (int a = 0; a < 3; a++) {
+                chunk.boundsMin[a] = std::min(chunk.boundsMin[a], center[a] - s.radius);
+                chunk.boundsMax[a] = std::max(chunk.boundsMax[a], center[a] + s.radius);
+            }
+            Octant& octant = octants[(s.center.x >= middle.x ? 1 : 0) | (s.center.y >= middle.y ? 2 : 0) | (s.center.z >= middle.z ? 4 : 0)];
+            double volume = double(s.radius) * s.radius * s.radius;
+            octant.weightedCenter = octant.weightedCenter + s.center * static_cast<float>(volume);
+            octant.volume += volume;
+            uint32_t material = contents.materialIds[i];
+            auto it = std::find_if(octant.materialVolume.begin(), octant.materialVolume.end(), [&](const auto& m) { return m.first == material; });
+            if (it == octant.materialVolume.end()) octant.materialVolume.push_back({material, volume});
+            else it->second += volume;
+        }
+        for (const Octant& octant : octants) {
+            if (octant.materialVolume.empty()) continue;
+            Vec3 center = octant.volume > 0.0 ? octant.weightedCenter * static_cast<float>(1.0 / octant.volume) : middle;
+            float radius = static_cast<float>(std::cbrt(octant.volume));
+            auto dominant = std::max_element(octant.materialVolume.begin(), octant.materialVolume.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+            contents.proxyGeometry.push_back({center.x, center.y, center.z, radius});
+            contents.proxyMaterialIds.push_back(dominant->first);
+        }
+        chunk.proxyCount = static_cast<uint32_t>(contents.proxyGeometry.size()) - chunk.firstProxy;
+        contents.chunks.push_back(chunk);
+        first = end;
+    }
+    return writeContents(path, contents);
+}
+
+bool loadScene(const std::string& path, Scene& scene) {
+    auto file = std::make_shared<SceneFile>();
+    if (!file->open(path)) return false;
+
+    // Scene keeps spheres as an array of structs for editing, the one copy
+    // that is not a plain memcpy.
+    // The renderers upload the material indices as they are, so they must
+    // all be valid.
+    std::span<const gpu::vec4> geometry = file->geometry();
+    std::span<const uint32_t> materialIds = file->materialIds();
+    uint32_t materialCount = file->header().materialCount;
+    std::vector<Sphere> spheres(geometry.size());
+    for (size_t i = 0; i < geometry.size(); i++) {
+        if (materialIds[i] >= materialCount) {
+            std::cerr << "Scene file " << path << " has invalid material indices" << std::endl;
+            return false;
+        }
+        spheres[i] = {{geometry[i].x, geometry[i].y, geometry[i].z}, geometry[i].w, materialIds[i]};
+    }
+    scene.spheres = std::move(spheres);
+    loadSceneSettings(*file, scene);
+
+    scene.dirtySpheres.clear();
+    scene.reassignedSpheres.clear();
+    scene.spheresChanged = true;
+    scene.sphereVersion++;
+    scene.source = std::move(file);
+    scene.sourceVersion = scene.sphereVersion;
+    return true;
+}
+
+void loadSceneSettings(const SceneFile& file, Scene& scene) {
+    scene.materials.clear();
+    for (const gpu::SphereMaterial& m : file.materials()) scene.materials.push_back({{m.color.x, m.color.y, m.color.z}, m.roughness});
+    scene.dirtyMaterials.clear();
+    scene.materialsChanged = true;
+    scene.materialVersion++;
+
+    const SceneFileLights& lights = file.lights();
+    const PointLightGPU& point = lights.pointLight;
+    const SpotLightGPU& spot = lights.spotLight;
+    scene.pointLight = {{point.position[0], point.position[1], point.position[2]}, point.intensity, {point.color[0], point.color[1], point.color[2]}, 0.0f};
+    scene.spotLight = {{spot.position[0], spot.position[1], spot.position[2]}, spot.intensity, {spot.direction[0], spot.direction[1], spot.direction[2]}, spot.cutOff,
+                       {spot.color[0], spot.color[1], spot.color[2]}, spot.outerCutOff};
+    scene.sunDirection = {lights.sunDirection[0], lights.sunDirection[1], lights.sunDirection[2]};
+    scene.sunEnabled = lights.sunEnabled != 0;
+}
+
+bool loadSourceBvh(const Scene& scene, size_t sphereCount, Bvh& bvh) {
+    const SceneFile* file = scene.unchangedSource();
+    if (!file || !file->hasBvh() || sphereCount != file->header().sphereCount) return false;
+    return bvh.adopt(file->bvhNodes(), file->bvhIndices(), sphereCount);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include "Bvh.h"
+#include "Scene.h"
+#include "SceneLayout.h"
+#include "Types.h"
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Binary scene file: this header, then sections at 16 byte aligned offsets
+// whose contents are laid out exactly like the renderer's GPU buffers, so
+// loading is a mapping and a copy instead of a parse. Little endian.
+struct SceneFileHeader {
+    char magic[8];         // SceneFile::MAGIC
+    uint32_t version;      // SceneFile::VERSION
+    uint32_t flags;        // SceneFile::HAS_BVH, SceneFile::HAS_CHUNKS
+    uint32_t sphereCount;
+    uint32_t materialCount;
+    uint32_t bvhNodeCount; // 0 without the BVH sections
+    uint32_t chunkCount;   // 0 without the chunk sections
+    uint64_t geometryOffset;    // gpu::vec4[sphereCount]
+    uint64_t materialIdsOffset; // uint32_t[sphereCount]
+    uint64_t materialsOffset;   // gpu::SphereMaterial[materialCount]
+    uint64_t lightsOffset;      // SceneFileLights
+    uint64_t bvhNodesOffset;    // BvhNode[bvhNodeCount]
+    uint64_t bvhIndicesOffset;  // uint32_t[sphereCount], the BVH's primIndices
+    uint32_t proxyCount;
+    uint32_t padding;
+    uint64_t chunksOffset;           // SceneFileChunk[chunkCount]
+    uint64_t proxyGeometryOffset;    // gpu::vec4[proxyCount]
+    uint64_t proxyMaterialIdsOffset; // uint32_t[proxyCount]
+};
+static_assert(sizeof(SceneFileHeader) == 112, "SceneFileHeader is part of the file format");
+
+// One cell of a chunked file. Its spheres are a contiguous range of the
+// sphere sections, so a chunk loads with one read per section. The proxy
+// spheres stand in for it coarsely while it is not loaded.
+struct SceneFileChunk {
+    float boundsMin[3];
+    uint32_t firstSphere;
+    float boundsMax[3];
+    uint32_t sphereCount;
+    uint32_t firstProxy;
+    uint32_t proxyCount;
+    uint32_t padding[2];
+};
+static_assert(sizeof(SceneFileChunk) == 48, "SceneFileChunk is part of the file format");
+
+// Lights as they are laid out in Uniforms
+struct SceneFileLights {
+    PointLightGPU pointLight;
+    SpotLightGPU spotLight;
+    float sunDirection[3];
+    uint32_t sunEnabled;
+};
+static_assert(sizeof(SceneFileLights) == 96, "SceneFileLights is part of the file format");
+
+// A scene file mapped read-only. Sections are views into the mapping and
+// stay valid as long as the SceneFile does.
+class SceneFile {
+public:
+    static constexpr char MAGIC[8] = {'R', 'A', 'Y', 'S', 'C', 'E', 'N', 'E'};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t HAS_BVH = 1;
+    static constexpr uint32_t HAS_CHUNKS = 2;
+    // Proxy spheres per chunk, one per occupied octant
+    static constexpr uint32_t MAX_CHUNK_PROXIES = 8;
+
+    SceneFile() = default;
+    ~SceneFile();
+    SceneFile(const SceneFile&) = delete;
+    SceneFile& operator=(const SceneFile&) = delete;
+
+    // Maps `path` and checks the header and section bounds; prints why and
+    // returns false when the file cannot be used. Nothing past the header
+    // and the chunk table is read until it is used.
+    bool open(const std::string& path);
+
+    const SceneFileHeader& header() const { return *static_cast<const SceneFileHeader*>(data); }
+    std::span<const gpu::vec4> geometry() const { return section<gpu::vec4>(header().geometryOffset, header().sphereCount); }
+    std::span<const uint32_t> materialIds() const { return section<uint32_t>(header().materialIdsOffset, header().sphereCount); }
+    std::span<const gpu::SphereMaterial> materials() const { return section<gpu::SphereMaterial>(header().materialsOffset, header().materialCount); }
+    const SceneFileLights& lights() const { return section<SceneFileLights>(header().lightsOffset, 1)[0]; }
+    bool hasBvh() const { return (header().flags & HAS_BVH) != 0; }
+    std::span<const BvhNode> bvhNodes() const { return section<BvhNode>(header().bvhNodesOffset, hasBvh() ? header().bvhNodeCount : 0); }
+    std::span<const uint32_t> bvhIndices() const { return section<uint32_t>(header().bvhIndicesOffset, hasBvh() ? header().sphereCount : 0); }
+    bool hasChunks() const { return (header().flags & HAS_CHUNKS) != 0; }
+    std::span<const SceneFileChunk> chunks() const { return section<SceneFileChunk>(header().chunksOffset, hasChunks() ? header().chunkCount : 0); }
+    std::span<const gpu::vec4> proxyGeometry() const { return section<gpu::vec4>(header().proxyGeometryOffset, hasChunks() ? header().proxyCount : 0); }
+    std::span<const uint32_t> proxyMaterialIds() const { return section<uint32_t>(header().proxyMaterialIdsOffset, hasChunks() ? header().proxyCount : 0); }
+
+    // Lets the OS drop the pages of the `count` bytes at `bytes` once they
+    // have been copied out; they are read from disk again on the next access.
+    void release(const void* bytes, size_t count) const;
+
+    // Writes the spheres, materials and lights of `scene`, plus `bvh` as
+    // the prebuilt acceleration structure when given.
+    static bool write(const std::string& path, const Scene& scene, const Bvh* bvh = nullptr);
+    // Writes `scene` split into cubic chunks of edge `chunkSize`, for
+    // SceneStreamer. Spheres are grouped by chunk, so their order changes.
+    static bool writeChunked(const std::string& path, const Scene& scene, float chunkSize);
+
+private:
+    const void* data = nullptr;
+    size_t size = 0;
+
+    template <typename T>
+    std::span<const T> section(uint64_t offset, size_t count) const {
+        return {reinterpret_cast<const T*>(static_cast<const char*>(data) + offset), count};
+    }
+};
+
+// Replaces the spheres, materials and lights of `scene` with those of the
+// file at `path`, which becomes the scene's source. Clusters and instances
+// are kept. Chunked files load whole; SceneStreamer loads them piecewise.
+bool loadScene(const std::string& path, Scene& scene);
+// Just the materials and lights of `file`.
+void loadSceneSettings(const SceneFile& file, Scene& scene);
+
+// Adopts the source file's prebuilt BVH when `scene` still matches it and
+// the first `sphereCount` spheres are all of them. Returns false when
+// there is none to use, so the caller builds its own.
+bool loadSourceBvh(const Scene& scene, size_t sphereCount, Bvh& bvh);
@@ -0,0 +1,224 @@
+#include "SceneGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Spheres per block of work, each with its own random stream
+const uint32_t GENERATOR_BLOCK = 4096;
+// Dart throwing passes over every Poisson disk cell; later passes mostly
+// fill the gaps the earlier ones left.
+const int POISSON_PASSES = 6;
+const double POISSON_FILL = 0.5;
+
+// splitmix64. Fully specified, unlike the standard distributions, so the
+// same seed gives the same scene everywhere.
+struct GeneratorRng {
+    uint64_t state;
+
+    GeneratorRng(uint64_t seed, uint64_t stream) : state(seed ^ (stream * 0xD1B54A32D192ED03ull)) { next(); }
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    float uniform() { return static_cast<float>(next() >> 40) * (1.0f / 16777216.0f); }
+    float uniform(float lo, float hi) { return lo + (hi - lo) * uniform(); }
+    uint32_t below(uint32_t n) { return static_cast<uint32_t>((next() >> 32) * n >> 32); }
+    // Box-Muller, one of the pair
+    float normal() {
+        float u = std::max(uniform(), 1e-7f);
+        return std::sqrt(-2.0f * std::log(u)) * std::cos(6.2831853f * uniform());
+    }
+};
+
+// Independent random streams of one generation
+enum GeneratorStream : uint64_t {
+    STREAM_MATERIALS = 0,
+    STREAM_CLUSTERS = 1,
+    STREAM_SELECT = 2,
+    STREAM_BLOCKS = 1 << 20,         // Plus the block index
+    STREAM_DARTS = uint64_t(1) << 40, // Plus the pass, cell class and block
+};
+
+static Sphere randomSphere(GeneratorRng& rng, Vec3 center, float maxRadius, const SceneGeneratorSettings& settings) {
+    float hi = std::min(settings.maxRadius, maxRadius);
+    float lo = std::min(settings.minRadius, hi);
+    return {center, rng.uniform(lo, hi), rng.below(settings.materialCount)};
+}
+
+static void generateUniform(const SceneGeneratorSettings& settings, std::vector<Sphere>& spheres, JobSystem* jobs) {
+    float e = settings.extent;
+    forEachChunk(jobs, settings.sphereCount, GENERATOR_BLOCK, [&](uint32_t begin, uint32_t end, unsigned) {
+        GeneratorRng rng(settings.seed, STREAM_BLOCKS + begin / GENERATOR_BLOCK);
+        for (uint32_t i = begin; i < end; i++) {
+            Vec3 center = {rng.uniform(-e, e), rng.uniform(-e, e), rng.uniform(-e, e)};
+            spheres[i] = randomSphere(rng, center, settings.maxRadius, settings);
+        }
+    });
+}
+
+static void generateClustered(const SceneGeneratorSettings& settings, std::vector<Sphere>& spheres, JobSystem* jobs) {
+    float e = settings.extent;
+    std::vector<Vec3> centers(std::max(settings.clusterCount, 1u));
+    GeneratorRng clusterRng(settings.seed, STREAM_CLUSTERS);
+    for (Vec3& c : centers) c = {clusterRng.uniform(-e, e), clusterRng.uniform(-e, e), clusterRng.uniform(-e, e)};
+
+    float sigma = settings.clusterSpread * e;
+    forEachChunk(jobs, settings.sphereCount, GENERATOR_BLOCK, [&](uint32_t begin, uint32_t end, unsigned) {
+        GeneratorRng rng(settings.seed, STREAM_BLOCKS + begin / GENERATOR_BLOCK);
+        for (uint32_t i = begin; i < end; i++) {
+            Vec3 c = centers[rng.below(static_cast<uint32_t>(centers.size()))];
+            Vec3 center = {std::clamp(c.x + sigma * rng.normal(), -e, e), std::clamp(c.y + sigma * rng.normal(), -e, e),
+                           std::clamp(c.z + sigma * rng.normal(), -e, e)};
+            spheres[i] = randomSphere(rng, center, settings.maxRadius, settings);
+        }
+    });
+}
+
+// Row-major cells of the smallest cube that holds them all, filled in order.
+static void generateGrid(const SceneGeneratorSettings& settings, std::vector<Sphere>& spheres, JobSystem* jobs) {
+    uint32_t n = std::max(1u, static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(settings.sphereCount)))));
+    while (uint64_t(n) * n * n < settings.sphereCount) n++;
+    float spacing = 2.0f * settings.extent / n;
+    forEachChunk(jobs, settings.sphereCount, GENERATOR_BLOCK, [&](uint32_t begin, uint32_t end, unsigned) {
+        GeneratorRng rng(settings.seed, STREAM_BLOCKS + begin / GENERATOR_BLOCK);
+        for (uint32_t i = begin; i < end; i++) {
+            Vec3 center = Vec3{(i % n) + 0.5f, (i / n % n) + 0.5f, (i / n / n) + 0.5f} * spacing - Vec3{1.0f, 1.0f, 1.0f} * settings.extent;
+            spheres[i] = randomSphere(rng, center, 0.5f * spacing, settings);
+        }
+    });
+}
+
+// Parallel dart throwing on a grid of cells of edge d, holding at most one
+// point each, so only the 26 neighbors of a dart's cell need checking. Cells
+// whose coordinates agree mod 2 are at least d apart and never see each
+// other's writes, so each of the 8 classes is filled in parallel. Returns
+// the points in cell order.
+static std::vector<Vec3> poissonPoints(const SceneGeneratorSettings& settings, float d, JobSystem* jobs) {
+    float e = settings.extent;
+    uint32_t n = std::max(1u, static_cast<uint32_t>(std::ceil(2.0f * e / d)));
+    // An empty cell of padding on every side spares the bounds checks.
+    size_t m = n + 2;
+    const float EMPTY = -1e30f;
+    std::vector<Vec3> cells(m * m * m, Vec3{EMPTY, EMPTY, EMPTY});
+    float d2 = d * d;
+
+    // Face neighbors first, since they reject the most darts
+    std::vector<ptrdiff_t> neighbors;
+    for (int ring = 1; ring <= 3; ring++) {
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (std::abs(dx) + std::abs(dy) + std::abs(dz) == ring) neighbors.push_back((ptrdiff_t(dz) * ptrdiff_t(m) + dy) * ptrdiff_t(m) + dx);
+                }
+            }
+        }
+    }
+
+    uint32_t classSize = (n + 1) / 2;
+    for (int pass = 0; pass < POISSON_PASSES; pass++) {
+        for (uint32_t cls = 0; cls < 8; cls++) {
+            uint32_t count = classSize * classSize * classSize;
+            forEachChunk(jobs, count, GENERATOR_BLOCK, [&](uint32_t begin, uint32_t end, unsigned) {
+                GeneratorRng rng(settings.seed, STREAM_DARTS + (uint64_t(pass * 8 + cls) << 24) + begin / GENERATOR_BLOCK);
+                for (uint32_t k = begin; k < end; k++) {
+                    uint32_t x = (cls & 1) + 2 * (k % classSize), y = (cls >> 1 & 1) + 2 * (k / classSize % classSize), z = (cls >> 2) + 2 * (k / classSize / classSize);
+                    Vec3 dart = {(x + rng.uniform()) * d - e, (y + rng.uniform()) * d - e, (z + rng.uniform()) * d - e};
+                    if (x >= n || y >= n || z >= n || dart.x > e || dart.y > e || dart.z > e) continue;
+                    size_t cell = ((z + 1) * m + y + 1) * m + x + 1;
+                    if (cells[cell].x != EMPTY) continue;
+                    bool accepted = true;
+                    for (ptrdiff_t neighbor : neighbors) {
+                        Vec3 delta = cells[cell + neighbor] - dart;
+                        if (dot(delta, delta) < d2) {
+                            accepted = false;
+                            break;
+                        }
+                    }
+                    if (accepted) cells[cell] = dart;
+                }
+            });
+        }
+    }
+
+    std::vector<Vec3> points;
+    for (const Vec3& p : cells) {
+        if (p.x != EMPTY) points.push_back(p);
+    }
+    return points;
+}
+
+// Samples with a spacing that gives well over the sphere count, then keeps
+// a random subset, which is still spaced at least that far apart.
+static void generatePoissonDisk(const SceneGeneratorSettings& settings, std::vector<Sphere>& spheres, JobSystem* jobs) {
+    if (settings.sphereCount == 0) return;
+    // The passes fill about POISSON_FILL of the cells; aim for 1.25 times the count.
+    double volume = 8.0 * double(settings.extent) * settings.extent * settings.extent;
+    float d = static_cast<float>(std::cbrt(POISSON_FILL * volume / (1.25 * settings.sphereCount)));
+    std::vector<Vec3> points = poissonPoints(settings, d, jobs);
+    while (points.size() < settings.sphereCount) {
+        d *= 0.9f;
+        points = poissonPoints(settings, d, jobs);
+    }
+
+    GeneratorRng select(settings.seed, STREAM_SELECT);
+    for (uint32_t i = 0; i < settings.sphereCount; i++) {
+        std::swap(points[i], points[i + select.below(static_cast<uint32_t>(points.size() - i))]);
+    }
+    forEachChunk(jobs, settings.sphereCount, GENERATOR_BLOCK, [&](uint32_t begin, uint32_t end, unsigned) {
+        GeneratorRng rng(settings.seed, STREAM_BLOCKS + begin / GENERATOR_BLOCK);
+        for (uint32_t i = begin; i < end; i++) spheres[i] = randomSphere(rng, points[i], 0.5f * d, settings);
+    });
+}
+
+void generateScene(const SceneGeneratorSettings& settings, Scene& scene, JobSystem* jobs) {
+    SceneGeneratorSettings s = settings;
+    s.materialCount = std::max(s.materialCount, 1u);
+    s.maxRadius = std::max(s.maxRadius, s.minRadius);
+
+    GeneratorRng materialRng(s.seed, STREAM_MATERIALS);
+    scene.materials.clear();
+    for (uint32_t m = 0; m < s.materialCount; m++) {
+        Vec3 color = {materialRng.uniform(0.1f, 1.0f), materialRng.uniform(0.1f, 1.0f), materialRng.uniform(0.1f, 1.0f)};
+        scene.materials.push_back({color, materialRng.uniform()});
+    }
+    scene.dirtyMaterials.clear();
+    scene.materialsChanged = true;
+    scene.materialVersion++;
+
+    std::vector<Sphere> spheres(s.sphereCount);
+    switch (s.distribution) {
+        case SphereDistribution::Uniform: generateUniform(s, spheres, jobs); break;
+        case SphereDistribution::Clustered: generateClustered(s, spheres, jobs); break;
+        case SphereDistribution::Grid: generateGrid(s, spheres, jobs); break;
+        case SphereDistribution::PoissonDisk: generatePoissonDisk(s, spheres, jobs); break;
+    }
+    scene.spheres = std::move(spheres);
+    scene.dirtySpheres.clear();
+    scene.reassignedSpheres.clear();
+    scene.spheresChanged = true;
+    scene.sphereVersion++;
+    scene.source.reset();
+}
+
+bool parseSphereDistribution(const std::string& name, SphereDistribution& distribution) {
+    for (SphereDistribution d : {SphereDistribution::Uniform, SphereDistribution::Clustered, SphereDistribution::Grid, SphereDistribution::PoissonDisk}) {
+        if (name == sphereDistributionName(d)) {
+            distribution = d;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* sphereDistributionName(SphereDistribution distribution) {
+    switch (distribution) {
+        case SphereDistribution::Uniform: return "uniform";
+        case SphereDistribution::Clustered: return "clustered";
+        case SphereDistribution::Grid: return "grid";
+        case SphereDistribution::PoissonDisk: return "poisson";
+    }
+    return "uniform";
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "JobSystem.h"
+#include "Scene.h"
+#include <cstdint>
+#include <string>
+
+enum class SphereDistribution {
+    Uniform,     // Independent uniform centers
+    Clustered,   // Gaussian blobs around random cluster centers
+    Grid,        // One sphere per cell of a cubic grid
+    PoissonDisk, // Random centers no closer than their largest allowed diameter
+};
+
+struct SceneGeneratorSettings {
+    uint32_t sphereCount = 1024;
+    SphereDistribution distribution = SphereDistribution::Uniform;
+    uint64_t seed = 1;
+    float extent = 50.0f; // Centers lie in [-extent, extent] on every axis
+    float minRadius = 0.2f;
+    float maxRadius = 1.5f;
+    uint32_t materialCount = 16;
+    uint32_t clusterCount = 64;    // Clustered only
+    float clusterSpread = 0.1f;    // Clustered only: blob deviation as a fraction of extent
+};
+
+// Replaces the spheres and materials of `scene` with a generated set. The
+// result depends only on `settings`: the work is split into fixed blocks
+// with their own random streams, so it is the same for any thread count
+// and standard library. Grid and Poisson disk radii are capped so spheres
+// never overlap.
+void generateScene(const SceneGeneratorSettings& settings, Scene& scene, JobSystem* jobs = nullptr);
+
+// "uniform", "clustered", "grid" or "poisson"; false for anything else.
+bool parseSphereDistribution(const std::string& name, SphereDistribution& distribution);
+const char* sphereDistributionName(SphereDistribution distribution);
@@ -0,0 +1,26 @@
+#pragma once
+#include "Scene.h"
+#include <algorithm>
+
+// C++ side of shaders/scene_layout.glsl: the GLSL vector types it uses, then
+// the shared declarations themselves.
+namespace gpu {
+struct vec3 {
+    float x, y, z;
+};
+struct vec4 {
+    float x, y, z, w;
+};
+
+#include "shaders/scene_layout.glsl"
+
+inline vec4 sphereGeometry(const Sphere& s) { return {s.center.x, s.center.y, s.center.z, s.radius}; }
+inline SphereMaterial sphereMaterial(const Material& m) { return {{m.color.x, m.color.y, m.color.z}, m.roughness}; }
+// Out of range indices fall back to the last material rather than reading
+// past the table.
+inline uint32_t sphereMaterialIndex(const Sphere& s, size_t materialCount) {
+    return std::min<uint32_t>(s.material, static_cast<uint32_t>(std::max<size_t>(materialCount, 1) - 1));
+}
+} // namespace gpu
+
+static_assert(sizeof(gpu::vec4) == 16 && sizeof(gpu::SphereMaterial) == 16, "Sphere and material arrays must match their std430 layout");
@@ -0,0 +1,199 @@
+#include "SceneStreamer.h"
+#include <algorithm>
+#include <iostream>
+
+SceneStreamer::~SceneStreamer() {
+    close();
+}
+
+void SceneStreamer::close() {
+    if (loader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        requestCv.notify_all();
+        loader.join();
+    }
+    stopping = false;
+    requests.clear();
+    loads.clear();
+    chunks.clear();
+    file.reset();
+}
+
+bool SceneStreamer::open(const std::string& path, size_t budgetBytes, Scene& scene) {
+    close();
+    auto mapped = std::make_shared<SceneFile>();
+    if (!mapped->open(path)) return false;
+    if (!mapped->hasChunks()) {
+        std::cerr << path << " is not a chunked scene file" << std::endl;
+        return false;
+    }
+    file = std::move(mapped);
+    budget = budgetBytes;
+    frame = 0;
+    loadedChunkCount = 0;
+    loadedByteCount = 0;
+
+    scene.spheres.clear();
+    scene.dirtySpheres.clear();
+    scene.reassignedSpheres.clear();
+    scene.spheresChanged = true;
+    scene.sphereVersion++;
+    scene.source.reset();
+    loadSceneSettings(*file, scene);
+
+    std::span<const SceneFileChunk> fileChunks = file->chunks();
+    std::span<const gpu::vec4> proxyGeometry = file->proxyGeometry();
+    std::span<const uint32_t> proxyMaterialIds = file->proxyMaterialIds();
+    uint32_t lastMaterial = file->header().materialCount - 1;
+    clusterBase = static_cast<uint32_t>(scene.clusters.size());
+    chunks.resize(fileChunks.size());
+    byDistance.resize(fileChunks.size());
+    for (uint32_t c = 0; c < fileChunks.size(); c++) {
+        const SceneFileChunk& chunk = fileChunks[c];
+        for (uint32_t p = chunk.firstProxy; p < chunk.firstProxy + chunk.proxyCount; p++) {
+            const gpu::vec4& g = proxyGeometry[p];
+            chunks[c].proxies.push_back({{g.x, g.y, g.z}, g.w, std::min(proxyMaterialIds[p], lastMaterial)});
+        }
+        SphereCluster cluster;
+        cluster.spheres = chunks[c].proxies;
+        scene.clusters.push_back(std::move(cluster));
+        ClusterInstance instance;
+        instance.cluster = clusterBase + c;
+        scene.instances.push_back(instance);
+        byDistance[c] = c;
+    }
+    scene.instancesChanged = true;
+
+    loader = std::thread(&SceneStreamer::loaderMain, this);
+    std::cout << "Streaming " << chunks.size() << " chunks of " << path << " within " << budget / (1024 * 1024) << " MiB" << std::endl;
+    return true;
+}
+
+size_t SceneStreamer::chunkBytes(uint32_t chunk) const {
+    return size_t(file->chunks()[chunk].sphereCount) * BYTES_PER_SPHERE;
+}
+
+std::vector<Sphere> SceneStreamer::readChunk(uint32_t chunk) const {
+    const SceneFileChunk& range = file->chunks()[chunk];
+    std::span<const gpu::vec4> geometry = file->geometry().subspan(range.firstSphere, range.sphereCount);
+    std::span<const uint32_t> materialIds = file->materialIds().subspan(range.firstSphere, range.sphereCount);
+    uint32_t lastMaterial = file->header().materialCount - 1;
+    std::vector<Sphere> spheres(range.sphereCount);
+    for (size_t i = 0; i < spheres.size(); i++) {
+        spheres[i] = {{geometry[i].x, geometry[i].y, geometry[i].z}, geometry[i].w, std::min(materialIds[i], lastMaterial)};
+    }
+    // The copy is all that is used from now on, and the file is read again
+    // if the chunk is evicted and wanted back.
+    file->release(geometry.data(), geometry.size_bytes());
+    file->release(materialIds.data(), materialIds.size_bytes());
+    return spheres;
+}
+
+void SceneStreamer::loaderMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        requestCv.wait(lock, [&] { return stopping || !requests.empty(); });
+        if (stopping) return;
+        uint32_t chunk = requests.front();
+        requests.pop_front();
+        lock.unlock();
+        Load load{chunk, readChunk(chunk)};
+        lock.lock();
+        loads.push_back(std::move(load));
+        loadCv.notify_all();
+    }
+}
+
+void SceneStreamer::update(Vec3 eye, Scene& scene) {
+    stream(eye, scene);
+}
+
+void SceneStreamer::finish(Vec3 eye, Scene& scene) {
+    while (stream(eye, scene) > 0) {
+        std::unique_lock<std::mutex> lock(mutex);
+        loadCv.wait(lock, [&] { return !loads.empty(); });
+    }
+}
+
+size_t SceneStreamer::stream(Vec3 eye, Scene& scene) {
+    if (!file) return 0;
+    frame++;
+
+    // Nearest chunks first, by distance from the eye to their boxes, until
+    // the budget is spent. Chunks too big for what is left are skipped so
+    // smaller ones further out still get their turn.
+    std::span<const SceneFileChunk> fileChunks = file->chunks();
+    std::vector<float> distance(fileChunks.size());
+    for (uint32_t c = 0; c < fileChunks.size(); c++) {
+        const SceneFileChunk& chunk = fileChunks[c];
+        float p[3] = {eye.x, eye.y, eye.z};
+        float squared = 0.0f;
+        for (int a = 0; a < 3; a++) {
+            float d = std::max({chunk.boundsMin[a] - p[a], 0.0f, p[a] - chunk.boundsMax[a]});
+            squared += d * d;
+        }
+        distance[c] = squared;
+    }
+    // Nearly sorted from the last frame, so this is cheap while the camera moves.
+    std::stable_sort(byDistance.begin(), byDistance.end(), [&](uint32_t a, uint32_t b) { return distance[a] < distance[b]; });
+    size_t wantedBytes = 0;
+    for (uint32_t c : byDistance) {
+        size_t bytes = chunkBytes(c);
+        if (wantedBytes + bytes > budget) continue;
+        wantedBytes += bytes;
+        chunks[c].lastWanted = frame;
+    }
+
+    std::vector<Load> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.swap(loads);
+        // Requests not started yet are replaced by this frame's.
+        for (uint32_t c : requests) chunks[c].requested = false;
+        requests.clear();
+        for (const Load& load : finished) chunks[load.chunk].requested = false;
+        for (uint32_t c : byDistance) {
+            Chunk& chunk = chunks[c];
+            if (chunk.lastWanted == frame && !chunk.loaded && !chunk.requested) {
+                chunk.requested = true;
+                requests.push_back(c);
+            }
+        }
+    }
+    requestCv.notify_one();
+
+    // Loads that are still wanted take the place of the least recently
+    // wanted loaded chunks that are not.
+    for (Load& load : finished) {
+        Chunk& chunk = chunks[load.chunk];
+        if (chunk.lastWanted != frame || chunk.loaded) continue;
+        size_t bytes = chunkBytes(load.chunk);
+        while (loadedByteCount + bytes > budget) {
+            uint32_t victim = UINT32_MAX;
+            for (uint32_t c = 0; c < chunks.size(); c++) {
+                if (chunks[c].loaded && chunks[c].lastWanted != frame && (victim == UINT32_MAX || chunks[c].lastWanted < chunks[victim].lastWanted)) victim = c;
+            }
+            if (victim == UINT32_MAX) break;
+            chunks[victim].loaded = false;
+            scene.clusters[clusterBase + victim].spheres = chunks[victim].proxies;
+            scene.dirtyClusters.push_back(clusterBase + victim);
+            loadedChunkCount--;
+            loadedByteCount -= chunkBytes(victim);
+        }
+        if (loadedByteCount + bytes > budget) continue;
+        chunk.loaded = true;
+        scene.clusters[clusterBase + load.chunk].spheres = std::move(load.spheres);
+        scene.dirtyClusters.push_back(clusterBase + load.chunk);
+        loadedChunkCount++;
+        loadedByteCount += bytes;
+    }
+
+    size_t missing = 0;
+    for (const Chunk& chunk : chunks) {
+        if (chunk.lastWanted == frame && !chunk.loaded) missing++;
+    }
+    return missing;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "Scene.h"
+#include "SceneFile.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams the chunks of a chunked scene file (SceneFile::writeChunked) in
+// and out of a scene by distance from the camera. Every chunk is a cluster
+// with one identity instance, so the two-level BVH's top level spans the
+// whole file; a chunk that is not loaded holds its proxy spheres instead.
+// Chunks are copied out of the mapping on a background thread, and loaded
+// chunks are kept until the memory budget needs their room, least recently
+// wanted first.
+class SceneStreamer {
+public:
+    // Estimated memory a loaded sphere takes: the CPU copy, its cluster BVH
+    // share and SoA copy, and its GPU geometry, material index and BVH share.
+    static constexpr size_t BYTES_PER_SPHERE = sizeof(Sphere) + 2 * (2 * sizeof(BvhNode) + sizeof(uint32_t)) +
+                                               5 * sizeof(float) + sizeof(gpu::vec4) + sizeof(uint32_t);
+
+    SceneStreamer() = default;
+    ~SceneStreamer();
+    SceneStreamer(const SceneStreamer&) = delete;
+    SceneStreamer& operator=(const SceneStreamer&) = delete;
+
+    // Maps `path`, which must be chunked, and replaces the spheres,
+    // materials and lights of `scene` with its chunks, all as proxies to
+    // begin with. At most `budgetBytes` of chunks are loaded at once.
+    bool open(const std::string& path, size_t budgetBytes, Scene& scene);
+    bool isOpen() const { return file != nullptr; }
+
+    // Call once a frame before drawing: requests the chunks nearest `eye`
+    // that fit the budget and swaps in those loaded since the last call.
+    void update(Vec3 eye, Scene& scene);
+    // Like update(), but blocks until every chunk it wants is loaded.
+    void finish(Vec3 eye, Scene& scene);
+
+    size_t chunkCount() const { return chunks.size(); }
+    size_t loadedChunks() const { return loadedChunkCount; }
+    size_t loadedBytes() const { return loadedByteCount; }
+
+private:
+    struct Chunk {
+        uint64_t lastWanted = 0; // Last update() that wanted it loaded
+        bool requested = false;  // Queued or being copied out by the loader
+        bool loaded = false;
+        std::vector<Sphere> proxies;
+    };
+    struct Load {
+        uint32_t chunk;
+        std::vector<Sphere> spheres;
+    };
+
+    std::shared_ptr<const SceneFile> file;
+    size_t budget = 0;
+    uint32_t clusterBase = 0; // Scene::clusters index of chunk 0
+    std::vector<Chunk> chunks;
+    std::vector<uint32_t> byDistance;
+    uint64_t frame = 0;
+    size_t loadedChunkCount = 0;
+    size_t loadedByteCount = 0;
+
+    // Shared with the loader thread
+    std::thread loader;
+    std::mutex mutex;
+    std::condition_variable requestCv;
+    std::condition_variable loadCv;
+    std::deque<uint32_t> requests; // Nearest first
+    std::vector<Load> loads;       // Copied out, not yet in the scene
+    bool stopping = false;
+
+    // update() that returns how many wanted chunks are still not loaded
+    size_t stream(Vec3 eye, Scene& scene);
+    void loaderMain();
+    std::vector<Sphere> readChunk(uint32_t chunk) const;
+    size_t chunkBytes(uint32_t chunk) const;
+    void close();
+};
@@ -0,0 +1,198 @@
+#include "SphereKernels.h"
+#include "SceneLayout.h"
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__)
+#define RAYGAME_X86 1
+#include <immintrin.h>
+#endif
+
+void SphereSoA::build(const std::vector<Sphere>& spheres, size_t materialCount) {
+    std::vector<uint32_t> order(spheres.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    build(spheres, order, materialCount);
+}
+
+void SphereSoA::build(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order, size_t materialCount) {
+    count = static_cast<uint32_t>(order.size());
+    uint32_t padded = (count + SPHERE_LANES - 1) / SPHERE_LANES * SPHERE_LANES;
+
+    // Padding lanes get radiusSq = -inf so that h = b * b - c is never positive.
+    centerX.assign(padded, 0.0f);
+    centerY.assign(padded, 0.0f);
+    centerZ.assign(padded, 0.0f);
+    radiusSq.assign(padded, -std::numeric_limits<float>::infinity());
+    material.assign(padded, 0);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const Sphere& s = spheres[order[i]];
+        centerX[i] = s.center.x;
+        centerY[i] = s.center.y;
+        centerZ[i] = s.center.z;
+        radiusSq[i] = s.radius * s.radius;
+        material[i] = gpu::sphereMaterialIndex(s, materialCount);
+    }
+}
+
+void SphereSoA::gather(const SphereSoA& source, const std::vector<uint32_t>& lanes) {
+    count = static_cast<uint32_t>(lanes.size());
+    uint32_t padded = (count + SPHERE_LANES - 1) / SPHERE_LANES * SPHERE_LANES;
+
+    centerX.assign(padded, 0.0f);
+    centerY.assign(padded, 0.0f);
+    centerZ.assign(padded, 0.0f);
+    radiusSq.assign(padded, -std::numeric_limits<float>::infinity());
+    material.assign(padded, 0);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t lane = lanes[i];
+        centerX[i] = source.centerX[lane];
+        centerY[i] = source.centerY[lane];
+        centerZ[i] = source.centerZ[lane];
+        radiusSq[i] = source.radiusSq[lane];
+        material[i] = source.material[lane];
+    }
+}
+
+static SphereHit intersectScalar(const SphereSoA& s, Vec3 o, Vec3 d, float tMax) {
+    SphereHit best;
+    best.t = tMax;
+    for (uint32_t i = 0; i < s.count; i++) {
+        float ocx = o.x - s.centerX[i];
+        float ocy = o.y - s.centerY[i];
+        float ocz = o.z - s.centerZ[i];
+        float b = ocx * d.x + ocy * d.y + ocz * d.z;
+        float c = ocx * ocx + ocy * ocy + ocz * ocz - s.radiusSq[i];
+        float h = b * b - c;
+        if (h > 0.0f) {
+            float t = -b - std::sqrt(h);
+            if (t > 0.001f && t < best.t) {
+                best.t = t;
+                best.lane = static_cast<int32_t>(i);
+            }
+        }
+    }
+    return best;
+}
+
+#ifdef RAYGAME_X86
+
+// Picks the smallest t across lanes; ties go to the lowest lane so every
+// kernel agrees with the in-order scalar loop.
+template <int N>
+static SphereHit reduceLanes(const float* t, const int32_t* lane, float tMax) {
+    SphereHit best;
+    best.t = tMax;
+    for (int i = 0; i < N; i++) {
+        if (lane[i] >= 0 && (t[i] < best.t || (t[i] == best.t && lane[i] < best.lane))) {
+            best.t = t[i];
+            best.lane = lane[i];
+        }
+    }
+    return best;
+}
+
+static SphereHit intersectSse(const SphereSoA& s, Vec3 o, Vec3 d, float tMax) {
+    const __m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z);
+    const __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+    const __m128 tMin = _mm_set1_ps(0.001f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 bestT = _mm_set1_ps(tMax);
+    __m128i bestLane = _mm_set1_epi32(-1);
+    __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i step = _mm_set1_epi32(4);
+
+    for (uint32_t i = 0; i < s.paddedCount(); i += 4) {
+        __m128 ocx = _mm_sub_ps(ox, _mm_load_ps(&s.centerX[i]));
+        __m128 ocy = _mm_sub_ps(oy, _mm_load_ps(&s.centerY[i]));
+        __m128 ocz = _mm_sub_ps(oz, _mm_load_ps(&s.centerZ[i]));
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), _mm_load_ps(&s.radiusSq[i]));
+        __m128 h = _mm_sub_ps(_mm_mul_ps(b, b), c);
+        __m128 t = _mm_sub_ps(_mm_sub_ps(zero, b), _mm_sqrt_ps(_mm_max_ps(h, zero)));
+
+        __m128 mask = _mm_and_ps(_mm_cmpgt_ps(h, zero), _mm_and_ps(_mm_cmpgt_ps(t, tMin), _mm_cmplt_ps(t, bestT)));
+        __m128i maski = _mm_castps_si128(mask);
+        bestT = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, bestT));
+        bestLane = _mm_or_si128(_mm_and_si128(maski, lane), _mm_andnot_si128(maski, bestLane));
+        lane = _mm_add_epi32(lane, step);
+    }
+
+    alignas(16) float t[4];
+    alignas(16) int32_t lanes[4];
+    _mm_store_ps(t, bestT);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), bestLane);
+    return reduceLanes<4>(t, lanes, tMax);
+}
+
+__attribute__((target("avx2")))
+static SphereHit intersectAvx2(const SphereSoA& s, Vec3 o, Vec3 d, float tMax) {
+    const __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z);
+    const __m256 dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z);
+    const __m256 tMin = _mm256_set1_ps(0.001f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 bestT = _mm256_set1_ps(tMax);
+    __m256i bestLane = _mm256_set1_epi32(-1);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+
+    for (uint32_t i = 0; i < s.paddedCount(); i += 8) {
+        __m256 ocx = _mm256_sub_ps(ox, _mm256_load_ps(&s.centerX[i]));
+        __m256 ocy = _mm256_sub_ps(oy, _mm256_load_ps(&s.centerY[i]));
+        __m256 ocz = _mm256_sub_ps(oz, _mm256_load_ps(&s.centerZ[i]));
+        // Plain mul/add rather than FMA keeps results bit-identical to the
+        // scalar loop, which the BVH leaves and packet paths rely on.
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+        __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+        __m256 c = _mm256_sub_ps(oc2, _mm256_load_ps(&s.radiusSq[i]));
+        __m256 h = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+        __m256 t = _mm256_sub_ps(_mm256_sub_ps(zero, b), _mm256_sqrt_ps(_mm256_max_ps(h, zero)));
+
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(h, zero, _CMP_GT_OQ),
+                                    _mm256_and_ps(_mm256_cmp_ps(t, tMin, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+        bestT = _mm256_blendv_ps(bestT, t, mask);
+        bestLane = _mm256_blendv_epi8(bestLane, lane, _mm256_castps_si256(mask));
+        lane = _mm256_add_epi32(lane, step);
+    }
+
+    alignas(32) float t[8];
+    alignas(32) int32_t lanes[8];
+    _mm256_store_ps(t, bestT);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), bestLane);
+    return reduceLanes<8>(t, lanes, tMax);
+}
+
+#endif
+
+SimdLevel detectSimdLevel() {
+#ifdef RAYGAME_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+    return SimdLevel::Sse;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx2: return "AVX2";
+        case SimdLevel::Sse: return "SSE";
+        default: return "Scalar";
+    }
+}
+
+SphereHit intersectSpheres(SimdLevel level, const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) {
+#ifdef RAYGAME_X86
+    if (level == SimdLevel::Avx2) return intersectAvx2(spheres, origin, direction, tMax);
+    if (level == SimdLevel::Sse) return intersectSse(spheres, origin, direction, tMax);
+#endif
+    return intersectScalar(spheres, origin, direction, tMax);
+}
+
+static const SimdLevel bestSimdLevel = detectSimdLevel();
+
+SphereHit intersectSpheres(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) {
+    return intersectSpheres(bestSimdLevel, spheres, origin, direction, tMax);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Camera.h"
+#include "Scene.h"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, 32>>;
+
+// Structure-of-arrays copy of Scene::spheres for the SIMD kernels. Arrays are
+// padded to a multiple of SPHERE_LANES with spheres that can never be hit.
+struct SphereSoA {
+    static constexpr uint32_t SPHERE_LANES = 8;
+
+    AlignedVector<float> centerX;
+    AlignedVector<float> centerY;
+    AlignedVector<float> centerZ;
+    AlignedVector<float> radiusSq;
+    // Index into Scene::materials to shade with, clamped to the table like
+    // the GPU's gpu::sphereMaterialIndex
+    AlignedVector<uint32_t> material;
+    uint32_t count = 0;
+
+    void build(const std::vector<Sphere>& spheres, size_t materialCount);
+    // Lane i holds spheres[order[i]], e.g. in Bvh::primIndices order.
+    void build(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order, size_t materialCount);
+    // Copies the given lanes of another SoA, keeping their order.
+    void gather(const SphereSoA& source, const std::vector<uint32_t>& lanes);
+    uint32_t paddedCount() const { return static_cast<uint32_t>(centerX.size()); }
+};
+
+struct SphereHit {
+    int32_t lane = -1; // Position in the SoA arrays, -1 on a miss
+    float t = 0.0f;
+};
+
+enum class SimdLevel { Scalar, Sse, Avx2 };
+
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// Closest hit along a normalized ray with 0.001 < t < tMax, using the same
+// near-root-only test as traceScene in raytracer.frag.
+SphereHit intersectSpheres(SimdLevel level, const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax);
+
+// Same as above with the best kernel for this CPU, chosen once at startup.
+SphereHit intersectSpheres(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax);
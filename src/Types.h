@@ -3,12 +3,53 @@
 #include <vulkan/vulkan.h>
 #include <VkBootstrap.h>
 
-struct Uniforms {
-    float resolution[2];
-    float time;
-    float sunEnabled;
+struct PointLightGPU {
+    float position[3];
+    float intensity;
+    float color[3];
+    float padding;
+};
+
+struct SpotLightGPU {
+    float position[3];
+    float intensity;
+    float direction[3];
+    float cutOff;
+    float color[3];
+    float outerCutOff;
+};
+
+// Matches FrameConstants in frame_constants.glsl (push constants, std430).
+// Pushed with every draw, so the camera needs no buffer at all.
+struct FrameConstants {
     float cameraPos[3];
-    float padding2;
+    float time;
     float cameraDir[3];
-    float padding3;
+    uint32_t sampleIndex;
+    float resolution[2];
+    uint32_t accumulate;
+    uint32_t reproject;
+    float previousCameraPos[3];
+    uint32_t historyValid;
+    float previousCameraDir[3];
+    uint32_t frameIndex;
+    float displayResolution[2];
+    uint32_t checkerboard;
+    uint32_t validate;
+    uint32_t batchStart;
+    uint32_t bounce;
+};
+static_assert(sizeof(FrameConstants) == 104, "FrameConstants must match the push constant block in frame_constants.glsl");
+
+// Matches Uniforms in raytracer_common.glsl (std140)
+struct Uniforms {
+    PointLightGPU pointLight;
+    SpotLightGPU spotLight;
+    float sunDirection[3];
+    float sunEnabled;
+    int sphereCount;
+    int wideBvh;
+    int instanceCount;
+    int padding;
 };
+static_assert(sizeof(Uniforms) == 112, "Uniforms must match the std140 layout in raytracer_common.glsl");
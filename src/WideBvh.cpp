@@ -0,0 +1,237 @@
+#include "WideBvh.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+
+#if defined(__x86_64__)
+#define RAYGAME_X86 1
+#include <immintrin.h>
+#endif
+
+static float surfaceArea(const BvhNode& node) {
+    float dx = node.boundsMax[0] - node.boundsMin[0];
+    float dy = node.boundsMax[1] - node.boundsMin[1];
+    float dz = node.boundsMax[2] - node.boundsMin[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// Power of two step as a float, from its biased exponent
+static float stepSize(uint32_t biasedExponent) {
+    return std::bit_cast<float>(biasedExponent << 23);
+}
+
+// Smallest power of two step whose 255 multiples cover [lo, hi].
+static uint32_t stepExponent(float lo, float hi) {
+    int exponent = 0;
+    std::frexp((hi - lo) / 255.0f, &exponent);
+    uint32_t biased = static_cast<uint32_t>(std::clamp(exponent + 127, 1, 254));
+    while (biased < 254 && lo + 255.0f * stepSize(biased) < hi) biased++;
+    return biased;
+}
+
+static float decode(float origin, float step, uint32_t q) {
+    return origin + static_cast<float>(q) * step;
+}
+
+// Rounds outwards, then corrects for the rounding of the decode itself.
+static uint32_t quantizeMin(float value, float origin, float step) {
+    uint32_t q = static_cast<uint32_t>(std::clamp(std::floor((value - origin) / step), 0.0f, 255.0f));
+    while (q > 0 && decode(origin, step, q) > value) q--;
+    return q;
+}
+
+static uint32_t quantizeMax(float value, float origin, float step) {
+    uint32_t q = static_cast<uint32_t>(std::clamp(std::ceil((value - origin) / step), 0.0f, 255.0f));
+    while (q < 255 && decode(origin, step, q) < value) q++;
+    return q;
+}
+
+#if RAYGAME_X86
+// Four packed bytes as four floats, SSE2 only.
+static __m128 unpackBytes(uint32_t bytes) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(bytes)), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+#endif
+
+// Each wide node takes the place of a binary node and its descendants down
+// to four subtrees, always opening the child with the largest surface area.
+void WideBvh::build(const Bvh& bvh) {
+    nodes.clear();
+    if (bvh.empty()) return;
+
+    struct Pending {
+        uint32_t wide, binary;
+    };
+    std::vector<Pending> pending = {{0, 0}};
+    nodes.emplace_back();
+    while (!pending.empty()) {
+        Pending p = pending.back();
+        pending.pop_back();
+
+        const BvhNode& parent = bvh.nodes[p.binary];
+        uint32_t slots[WIDTH];
+        uint32_t slotCount = 0;
+        if (Bvh::isLeaf(parent)) {
+            slots[slotCount++] = p.binary;
+        } else {
+            slots[slotCount++] = parent.left;
+            slots[slotCount++] = parent.right;
+        }
+        while (slotCount < WIDTH) {
+            int open = -1;
+            float openArea = -1.0f;
+            for (uint32_t k = 0; k < slotCount; k++) {
+                const BvhNode& child = bvh.nodes[slots[k]];
+                if (!Bvh::isLeaf(child) && surfaceArea(child) > openArea) {
+                    open = static_cast<int>(k);
+                    openArea = surfaceArea(child);
+                }
+            }
+            if (open < 0) break;
+            const BvhNode& child = bvh.nodes[slots[open]];
+            slots[open] = child.left;
+            slots[slotCount++] = child.right;
+        }
+
+        WideBvhNode node{};
+        float step[3];
+        for (int a = 0; a < 3; a++) {
+            node.origin[a] = parent.boundsMin[a];
+            uint32_t exponent = stepExponent(parent.boundsMin[a], parent.boundsMax[a]);
+            node.exponents |= exponent << (8 * a);
+            step[a] = stepSize(exponent);
+        }
+        for (uint32_t k = 0; k < slotCount; k++) {
+            const BvhNode& child = bvh.nodes[slots[k]];
+            for (int a = 0; a < 3; a++) {
+                node.childMin[a] |= quantizeMin(child.boundsMin[a], node.origin[a], step[a]) << (8 * k);
+                node.childMax[a] |= quantizeMax(child.boundsMax[a], node.origin[a], step[a]) << (8 * k);
+            }
+            if (Bvh::isLeaf(child)) {
+                node.children[k] = child.left & ~Bvh::LEAF_BIT;
+                assert(child.right > 0 && child.right < INTERIOR);
+                node.counts |= child.right << (8 * k);
+            } else {
+                node.children[k] = static_cast<uint32_t>(nodes.size());
+                node.counts |= INTERIOR << (8 * k);
+                pending.push_back({node.children[k], slots[k]});
+                nodes.emplace_back();
+            }
+        }
+        nodes[p.wide] = node;
+    }
+}
+
+// Children are tested in one pass per node and visited nearest first:
+// leaves right away, inner nodes through the stack, which keeps their entry
+// distance to skip them once a closer hit is found.
+SphereHit WideBvh::intersect(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) const {
+    SphereHit best;
+    best.t = tMax;
+    if (nodes.empty()) return best;
+
+    const float o[3] = {origin.x, origin.y, origin.z};
+    const float invDir[3] = {safeInverse(direction.x), safeInverse(direction.y), safeInverse(direction.z)};
+    uint32_t stack[STACK_SIZE];
+    float stackDist[STACK_SIZE];
+    uint32_t sp = 0;
+    stack[sp] = 0;
+    stackDist[sp++] = 0.0f;
+    while (sp > 0) {
+        sp--;
+        if (stackDist[sp] >= best.t) continue;
+        const WideBvhNode& node = nodes[stack[sp]];
+
+        // Slab test of all four children. Entry and exit distances are
+        // affine in the quantized bounds, so each axis needs one multiply-add
+        // per bound.
+        float tNear[WIDTH], tFar[WIDTH];
+#if RAYGAME_X86
+        __m128 nearest = _mm_setzero_ps(), farthest = _mm_set1_ps(best.t);
+        for (int a = 0; a < 3; a++) {
+            __m128 scale = _mm_set1_ps(stepSize((node.exponents >> (8 * a)) & 0xFF) * invDir[a]);
+            __m128 base = _mm_set1_ps((node.origin[a] - o[a]) * invDir[a]);
+            __m128 t0 = _mm_add_ps(base, _mm_mul_ps(unpackBytes(node.childMin[a]), scale));
+            __m128 t1 = _mm_add_ps(base, _mm_mul_ps(unpackBytes(node.childMax[a]), scale));
+            nearest = _mm_max_ps(nearest, _mm_min_ps(t0, t1));
+            farthest = _mm_min_ps(farthest, _mm_max_ps(t0, t1));
+        }
+        _mm_storeu_ps(tNear, nearest);
+        _mm_storeu_ps(tFar, farthest);
+#else
+        for (uint32_t k = 0; k < WIDTH; k++) {
+            tNear[k] = 0.0f;
+            tFar[k] = best.t;
+        }
+        for (int a = 0; a < 3; a++) {
+            float scale = stepSize((node.exponents >> (8 * a)) & 0xFF) * invDir[a];
+            float base = (node.origin[a] - o[a]) * invDir[a];
+            for (uint32_t k = 0; k < WIDTH; k++) {
+                float t0 = base + static_cast<float>((node.childMin[a] >> (8 * k)) & 0xFF) * scale;
+                float t1 = base + static_cast<float>((node.childMax[a] >> (8 * k)) & 0xFF) * scale;
+                tNear[k] = std::max(tNear[k], std::min(t0, t1));
+                tFar[k] = std::min(tFar[k], std::max(t0, t1));
+            }
+        }
+#endif
+
+        // Entry distances of the children hit, insertion sorted
+        float dist[WIDTH];
+        uint32_t order[WIDTH];
+        uint32_t hitCount = 0;
+        for (uint32_t k = 0; k < WIDTH; k++) {
+            if (((node.counts >> (8 * k)) & 0xFF) == 0 || tNear[k] > tFar[k]) continue;
+            uint32_t i = hitCount++;
+            while (i > 0 && dist[i - 1] > tNear[k]) {
+                dist[i] = dist[i - 1];
+                order[i] = order[i - 1];
+                i--;
+            }
+            dist[i] = tNear[k];
+            order[i] = k;
+        }
+
+        uint32_t inner[WIDTH];
+        float innerDist[WIDTH];
+        uint32_t innerCount = 0;
+        for (uint32_t i = 0; i < hitCount; i++) {
+            if (dist[i] >= best.t) break;
+            uint32_t k = order[i];
+            uint32_t count = (node.counts >> (8 * k)) & 0xFF;
+            if (count == INTERIOR) {
+                inner[innerCount] = node.children[k];
+                innerDist[innerCount++] = dist[i];
+                continue;
+            }
+            uint32_t first = node.children[k];
+            for (uint32_t lane = first; lane < first + count; lane++) {
+                float ocx = origin.x - spheres.centerX[lane];
+                float ocy = origin.y - spheres.centerY[lane];
+                float ocz = origin.z - spheres.centerZ[lane];
+                float b = ocx * direction.x + ocy * direction.y + ocz * direction.z;
+                float c = ocx * ocx + ocy * ocy + ocz * ocz - spheres.radiusSq[lane];
+                float h = b * b - c;
+                if (h > 0.0f) {
+                    float t = -b - std::sqrt(h);
+                    if (t > 0.001f && t < best.t) {
+                        best.t = t;
+                        best.lane = static_cast<int32_t>(lane);
+                    }
+                }
+            }
+        }
+
+        // Farthest pushed first so the nearest is popped next. Should the
+        // stack run out, the farthest children are the ones left out.
+        uint32_t pushCount = std::min(innerCount, STACK_SIZE - sp);
+        while (pushCount > 0) {
+            pushCount--;
+            stack[sp] = inner[pushCount];
+            stackDist[sp++] = innerDist[pushCount];
+        }
+    }
+    return best;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "Bvh.h"
+#include "SphereKernels.h"
+#include <cstdint>
+#include <vector>
+
+// Node layout shared with WideBvhNode in raytracer.frag (std430, 64 bytes).
+// Child boxes are stored as 8-bit steps from the node's origin, one step size
+// per axis. Steps are powers of two, so decoding is exact on CPU and GPU and
+// the decoded boxes always contain the children.
+struct WideBvhNode {
+    float origin[3];      // Minimum corner of the node's box
+    uint32_t exponents;   // Biased float exponent of the step, byte a for axis a
+    uint32_t childMin[3]; // Per axis: quantized minimum of child k in byte k
+    uint32_t counts;      // Byte k: 0 for an unused slot, INTERIOR, or the sphere count of a leaf
+    uint32_t childMax[3]; // Per axis: quantized maximum of child k in byte k
+    uint32_t padding;
+    uint32_t children[4]; // Interior: node index. Leaf: first entry in the binary BVH's primIndices
+};
+static_assert(sizeof(WideBvhNode) == 64, "WideBvhNode must match the std430 layout in raytracer.frag");
+
+// Four-wide BVH collapsed from a binary one. A node holds four quantized
+// child boxes in the space two full-precision binary nodes take, and the
+// tree has about a quarter as many nodes, so it takes half the memory.
+// Leaves keep the binary BVH's primIndices ranges, so its SphereSoA and
+// primIndices are used as is.
+class WideBvh {
+public:
+    static constexpr uint32_t WIDTH = 4;
+    static constexpr uint32_t INTERIOR = 0xFF;
+    static constexpr uint32_t STACK_SIZE = Bvh::STACK_SIZE;
+    static_assert(Bvh::MAX_LEAF_SIZE < INTERIOR, "Leaf counts must fit a counts byte without reading as INTERIOR");
+
+    std::vector<WideBvhNode> nodes; // Root is nodes[0]
+
+    // Rebuilds from `bvh`; needed again after every build or refit of it.
+    void build(const Bvh& bvh);
+    void clear() { nodes.clear(); }
+    bool empty() const { return nodes.empty(); }
+
+    // Closest hit, same contract as Bvh::intersect() for the BVH this was
+    // built from.
+    SphereHit intersect(const SphereSoA& spheres, Vec3 origin, Vec3 direction, float tMax) const;
+};
@@ -2,7 +2,15 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <string>
+#include <cstring>
+#include <cstdio>
 #include "Renderer.h"
+#include "CpuRenderer.h"
+#include "Benchmark.h"
+#include "SceneFile.h"
+#include "SceneStreamer.h"
+#include "SceneGenerator.h"
 #include "Camera.h"
 #include "imgui.h"
 #include "backends/imgui_impl_sdl2.h"
@@ -29,7 +37,209 @@ void destroy_window_sdl(SDL_Window* window) {
     SDL_Quit();
 }
 
-int main() {
+struct Options {
+    bool cpu = false;
+    uint32_t width = 1024;
+    uint32_t height = 768;
+    unsigned threads = 0;
+    bool packets = true;
+    std::string output = "render.ppm";
+    std::string bench;
+    uint32_t sphereCount = 1024;
+    bool gpuBvh = false;
+    bool wideBvh = true;
+    bool computeTrace = false;
+    bool accumulate = false;
+    bool reproject = false;
+    bool checkerboard = false;
+    bool wavefront = false;
+    float targetMs = 0.0f;
+    AccelStructure accel = AccelStructure::Auto;
+    std::string scene;
+    std::string writeScene;
+    bool generate = false;
+    SceneGeneratorSettings generator;
+    float chunkSize = 0.0f;
+    size_t streamBudget = size_t(1024) << 20;
+};
+
+void print_usage() {
+    std::cout << "Usage: RayGame [--cpu] [--size WxH] [--threads N] [--no-packets] [--output file.ppm] [--bench NAME [--spheres N]] [--gpu-bvh] [--binary-bvh] [--compute] [--accumulate] [--reproject] [--checkerboard] [--wavefront] [--dynamic-res MS] [--accel auto|bvh|grid] [--scene FILE] [--stream-budget MB] [--generate DIST [--spheres N] [--seed S] [--radius MIN:MAX] [--materials N]] [--write-scene FILE [--chunk-size S]]\n"
+              << "  --cpu          Render one frame on the CPU (no GPU or window needed)\n"
+              << "  --size WxH     CPU render resolution (default 1024x768)\n"
+              << "  --threads N    CPU worker threads (default: all cores)\n"
+              << "  --no-packets   Trace CPU primary rays one at a time instead of in 8x8 packets\n"
+              << "  --output FILE  Where to write the CPU render (default render.ppm)\n"
+              << "  --bench NAME   Run a CPU microbenchmark (kernels, packets, refit, build, grid, instances, wide, scenefile, streaming, generate)\n"
+              << "  --spheres N    Sphere count for --bench and --generate (default 1024)\n"
+              << "  --gpu-bvh      Build the BVH with compute shaders every frame\n"
+              << "  --binary-bvh   Trace the binary BVH instead of the quantized 4-wide one\n"
+              << "  --compute      Trace in a compute pass instead of the fragment shader\n"
+              << "  --accumulate   Average jittered samples while the view holds still (uses the compute pass)\n"
+              << "  --reproject    Reuse the last frame's shading while the camera moves (uses the compute pass)\n"
+              << "  --checkerboard Trace half the pixels each frame and reconstruct the rest (uses the compute pass)\n"
+              << "  --wavefront    Trace in queued generate, intersect and shade kernels (uses the compute pass)\n"
+              << "  --dynamic-res MS    Scale the traced resolution to meet a GPU frame time (uses the compute pass)\n"
+              << "  --accel MODE   Acceleration structure: auto (default), bvh or grid\n"
+              << "  --scene FILE   Load spheres, materials and lights from a binary scene file; chunked files are streamed\n"
+              << "  --stream-budget MB  Memory for streamed chunks (default 1024)\n"
+              << "  --generate DIST     Generate the scene instead: uniform, clustered, grid or poisson spheres\n"
+              << "  --seed S       Generator seed (default 1); the same seed always gives the same scene\n"
+              << "  --radius MIN:MAX    Generated sphere radii (default 0.2:1.5)\n"
+              << "  --materials N  Generated material count (default 16)\n"
+              << "  --write-scene FILE  Write the scene with a prebuilt BVH to FILE and exit\n"
+              << "  --chunk-size S Write a chunked file with cubic chunks of edge S for streaming instead" << std::endl;
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--cpu") == 0) {
+            options.cpu = true;
+        } else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%ux%u", &options.width, &options.height) != 2 || options.width == 0 || options.height == 0) return false;
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%u", &options.threads) != 1) return false;
+        } else if (strcmp(argv[i], "--no-packets") == 0) {
+            options.packets = false;
+        } else if (strcmp(argv[i], "--output") == 0 && hasValue) {
+            options.output = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && hasValue) {
+            options.bench = argv[++i];
+        } else if (strcmp(argv[i], "--spheres") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%u", &options.sphereCount) != 1) return false;
+        } else if (strcmp(argv[i], "--gpu-bvh") == 0) {
+            options.gpuBvh = true;
+        } else if (strcmp(argv[i], "--binary-bvh") == 0) {
+            options.wideBvh = false;
+        } else if (strcmp(argv[i], "--compute") == 0) {
+            options.computeTrace = true;
+        } else if (strcmp(argv[i], "--accumulate") == 0) {
+            options.accumulate = true;
+        } else if (strcmp(argv[i], "--reproject") == 0) {
+            options.reproject = true;
+        } else if (strcmp(argv[i], "--checkerboard") == 0) {
+            options.checkerboard = true;
+        } else if (strcmp(argv[i], "--wavefront") == 0) {
+            options.wavefront = true;
+        } else if (strcmp(argv[i], "--dynamic-res") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%f", &options.targetMs) != 1 || options.targetMs <= 0.0f) return false;
+        } else if (strcmp(argv[i], "--scene") == 0 && hasValue) {
+            options.scene = argv[++i];
+        } else if (strcmp(argv[i], "--write-scene") == 0 && hasValue) {
+            options.writeScene = argv[++i];
+        } else if (strcmp(argv[i], "--generate") == 0 && hasValue) {
+            options.generate = true;
+            if (!parseSphereDistribution(argv[++i], options.generator.distribution)) return false;
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            unsigned long long seed = 0;
+            if (sscanf(argv[++i], "%llu", &seed) != 1) return false;
+            options.generator.seed = seed;
+        } else if (strcmp(argv[i], "--radius") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%f:%f", &options.generator.minRadius, &options.generator.maxRadius) != 2) return false;
+            if (!(options.generator.minRadius > 0.0f) || options.generator.maxRadius < options.generator.minRadius) return false;
+        } else if (strcmp(argv[i], "--materials") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%u", &options.generator.materialCount) != 1 || options.generator.materialCount == 0) return false;
+        } else if (strcmp(argv[i], "--chunk-size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%f", &options.chunkSize) != 1 || !(options.chunkSize > 0.0f)) return false;
+        } else if (strcmp(argv[i], "--stream-budget") == 0 && hasValue) {
+            unsigned megabytes = 0;
+            if (sscanf(argv[++i], "%u", &megabytes) != 1) return false;
+            options.streamBudget = size_t(megabytes) << 20;
+        } else if (strcmp(argv[i], "--accel") == 0 && hasValue) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "auto") == 0) options.accel = AccelStructure::Auto;
+            else if (strcmp(mode, "bvh") == 0) options.accel = AccelStructure::Bvh;
+            else if (strcmp(mode, "grid") == 0) options.accel = AccelStructure::Grid;
+            else return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The default scene, the one from --scene or the one --generate makes.
+// Chunked files are opened in `streamer` when given one and loaded whole
+// otherwise.
+bool load_scene(const Options& options, Scene& scene, SceneStreamer* streamer = nullptr) {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (options.generate) {
+        SceneGeneratorSettings settings = options.generator;
+        settings.sphereCount = options.sphereCount;
+        JobSystem jobs(options.threads);
+        generateScene(settings, scene, &jobs);
+        std::cout << "Generated " << scene.spheres.size() << " " << sphereDistributionName(settings.distribution) << " spheres (seed " << settings.seed << ") in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+        return true;
+    }
+    if (options.scene.empty()) return true;
+    if (streamer) {
+        SceneFile file;
+        if (!file.open(options.scene)) return false;
+        if (file.hasChunks()) return streamer->open(options.scene, options.streamBudget, scene);
+    }
+    if (!loadScene(options.scene, scene)) return false;
+    std::cout << "Loaded " << scene.spheres.size() << " spheres from " << options.scene << " in "
+              << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+    return true;
+}
+
+int run_write_scene(const Options& options) {
+    Scene scene;
+    if (!load_scene(options, scene)) return -1;
+    bool written = false;
+    if (options.chunkSize > 0.0f) {
+        written = SceneFile::writeChunked(options.writeScene, scene, options.chunkSize);
+    } else {
+        Bvh bvh;
+        bvh.build(scene.spheres);
+        written = SceneFile::write(options.writeScene, scene, &bvh);
+    }
+    if (!written) {
+        std::cerr << "Failed to write " << options.writeScene << std::endl;
+        return -1;
+    }
+    std::cout << "Wrote " << options.writeScene << std::endl;
+    return 0;
+}
+
+int run_cpu_render(const Options& options) {
+    Camera camera;
+    Scene scene;
+    SceneStreamer streamer;
+    if (!load_scene(options, scene, &streamer)) return -1;
+    streamer.finish(camera.position, scene);
+    CpuRenderer renderer(options.threads);
+    renderer.setPacketTracing(options.packets);
+    renderer.setAccelStructure(options.accel);
+    renderer.setWideBvh(options.wideBvh);
+
+    std::vector<uint32_t> pixels;
+    CpuRenderStats stats = renderer.render(camera, scene, options.width, options.height, pixels);
+
+    std::cout << "CPU render " << options.width << "x" << options.height << " on " << renderer.threadCount() << " threads: "
+              << stats.seconds * 1000.0 << " ms, " << stats.rays << " rays, "
+              << stats.raysPerSecond() / 1e6 << " Mrays/s" << std::endl;
+
+    if (!CpuRenderer::writePpm(options.output, options.width, options.height, pixels)) {
+        std::cerr << "Failed to write " << options.output << std::endl;
+        return -1;
+    }
+    std::cout << "Wrote " << options.output << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return -1;
+    }
+    if (!options.bench.empty()) return run_benchmark(options.bench, options.sphereCount);
+    if (!options.writeScene.empty()) return run_write_scene(options);
+    if (options.cpu) return run_cpu_render(options);
+
     SDL_Window* window = create_window_sdl("Vulkan Ray Tracer");
     if (!window) return -1;
 
@@ -38,9 +248,24 @@ int main() {
         std::cerr << "Failed to initialize renderer" << std::endl;
         return -1;
     }
+    renderer.set_gpu_bvh_build(options.gpuBvh);
+    renderer.set_accel_structure(options.accel);
+    renderer.set_wide_bvh(options.wideBvh);
+    renderer.set_compute_trace(options.computeTrace);
+    renderer.set_accumulation(options.accumulate);
+    renderer.set_reprojection(options.reproject);
+    renderer.set_checkerboard(options.checkerboard);
+    renderer.set_wavefront(options.wavefront);
+    renderer.set_dynamic_resolution(options.targetMs);
 
     Camera camera;
     Scene scene;
+    SceneStreamer streamer;
+    if (!load_scene(options, scene, &streamer)) {
+        renderer.cleanup();
+        destroy_window_sdl(window);
+        return -1;
+    }
     bool quit = false;
     bool resize_requested = false;
     bool minimized = false;
@@ -115,6 +340,7 @@ int main() {
         auto currentTime = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
+        streamer.update(camera.position, scene);
         if (renderer.draw(camera, time, scene) != 0) {
             // Handle error
         }
@@ -124,6 +350,10 @@ int main() {
         float delta = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastTime).count();
         if (delta >= 1.0f) {
             std::string title = "Vulkan Ray Tracer - FPS: " + std::to_string(frameCount) + " | Sun: " + (scene.sunEnabled ? "ON" : "OFF") + " (Press L, ESC to capture mouse)";
+            if (streamer.isOpen()) {
+                title += " | Chunks: " + std::to_string(streamer.loadedChunks()) + "/" + std::to_string(streamer.chunkCount()) + " (" +
+                         std::to_string(streamer.loadedBytes() >> 20) + " MiB)";
+            }
             SDL_SetWindowTitle(window, title.c_str());
             frameCount = 0;
             lastTime = currentTime;
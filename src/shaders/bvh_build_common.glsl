@@ -0,0 +1,63 @@
+// Shared declarations for the GPU BVH build (bvh_*.comp). Bindings match
+// create_bvh_build_layout() in Renderer.cpp; the node layout matches
+// BvhNode in Bvh.h and raytracer.frag.
+
+// Sphere geometry only: center in xyz, radius in w (see scene_layout.glsl)
+layout(std430, binding = 0) readonly buffer SceneBuffer {
+    vec4 spheres[];
+} scene;
+
+struct BvhNode {
+    vec3 boundsMin;
+    uint left;  // Interior: left child index. Leaf: BVH_LEAF_BIT | first entry in primIndices
+    vec3 boundsMax;
+    uint right; // Interior: right child index. Leaf: number of spheres
+};
+
+// Bottom-up bounds read nodes written by other invocations, hence coherent.
+layout(std430, binding = 1) coherent buffer BvhNodes {
+    BvhNode nodes[];
+} bvh;
+
+// Radix sort ping-pong: the sorted result ends up in the source pair, whose
+// values are the BVH's primIndices.
+layout(std430, binding = 2) buffer SrcKeys { uint srcKeys[]; };
+layout(std430, binding = 3) buffer SrcValues { uint srcValues[]; };
+layout(std430, binding = 4) buffer DstKeys { uint dstKeys[]; };
+layout(std430, binding = 5) buffer DstValues { uint dstValues[]; };
+
+// Per-thread digit counts, bucket-major, turned into scatter offsets by
+// bvh_radix_scan.comp.
+layout(std430, binding = 6) buffer Histograms { uint histograms[]; };
+
+layout(std430, binding = 7) buffer Parents { uint parents[]; };
+
+layout(std430, binding = 8) buffer BuildState {
+    uint centroidMin[3]; // Order-preserving float encoding, see floatToOrdered
+    uint centroidMax[3];
+    uint padding[2];
+    uint arrivals[];     // Children that finished their bounds, per node
+} state;
+
+layout(push_constant) uniform BuildParams {
+    uint sphereCount;
+    uint shift;      // Radix sort digit position
+    uint blockCount; // Radix sort threads, RADIX_ITEMS keys each
+} params;
+
+#define BVH_LEAF_BIT 0x80000000u
+#define BVH_NO_PARENT 0xFFFFFFFFu
+
+#define RADIX_BITS 4
+#define RADIX_BUCKETS 16
+#define RADIX_ITEMS 64 // Keys per radix sort thread, must match Renderer.cpp
+
+// Maps floats to uints with the same ordering so atomicMin/atomicMax work.
+uint floatToOrdered(float f) {
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0u ? ~u : (u | 0x80000000u);
+}
+
+float orderedToFloat(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0u ? (u & 0x7FFFFFFFu) : ~u);
+}
@@ -0,0 +1,29 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "frame_constants.glsl"
+
+// Shows the compute tracing path's image, upscaled when it was traced at a
+// lower resolution; ImGui is drawn on top in the same render pass.
+layout (location = 0) out vec4 outColor;
+
+layout(binding = 14, rgba16f) uniform readonly image2D tracedImage;
+layout(binding = 15, rgba32f) uniform readonly image2D accumulationImage;
+
+// Display color of a traced pixel, clamped to the traced area
+vec3 tracedPixel(ivec2 pixel) {
+    pixel = clamp(pixel, ivec2(0), ivec2(frame.resolution) - 1);
+    if (frame.accumulate != 0u) return pow(imageLoad(accumulationImage, pixel).rgb, vec3(1.0/2.2));
+    return imageLoad(tracedImage, pixel).rgb;
+}
+
+void main() {
+    // Bilinear between the four nearest traced pixel centers; at full
+    // resolution that is exactly one of them.
+    vec2 position = gl_FragCoord.xy * frame.resolution / frame.displayResolution - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+    vec3 top = mix(tracedPixel(base), tracedPixel(base + ivec2(1, 0)), f.x);
+    vec3 bottom = mix(tracedPixel(base + ivec2(0, 1)), tracedPixel(base + ivec2(1, 1)), f.x);
+    outColor = vec4(mix(top, bottom, f.y), 1.0);
+}
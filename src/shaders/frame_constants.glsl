@@ -0,0 +1,20 @@
+// Camera and time, pushed with every draw and dispatch. Matches
+// FrameConstants in Types.h.
+layout(push_constant) uniform FrameConstants {
+    vec3 cameraPos;
+    float time;
+    vec3 cameraDir;
+    uint sampleIndex; // Samples already averaged into the accumulation image
+    vec2 resolution;
+    uint accumulate;  // Jitter and average into the accumulation image
+    uint reproject;   // Reuse the previous frame's shading through the history images
+    vec3 previousCameraPos;
+    uint historyValid; // The previous frame wrote historyIn with this scene
+    vec3 previousCameraDir;
+    uint frameIndex;
+    vec2 displayResolution; // Swapchain size; resolution is the traced size
+    uint checkerboard; // Trace half the pixels, checkerboard.comp fills in the rest
+    uint validate;     // Trace them all and measure the reconstruction instead
+    uint batchStart;   // Wavefront kernels: first pixel of the batch
+    uint bounce;       // Wavefront kernels: the bounce being traced
+} frame;
@@ -0,0 +1,26 @@
+// Per-pixel history the compute passes hand from one frame to the next, for
+// reprojection and checkerboard reconstruction. Needs raytracer_common.glsl.
+
+// Linear color and primary hit distance of this frame and the previous one
+layout(binding = 16, rgba32f) uniform image2D historyOut;
+layout(binding = 17, rgba32f) uniform readonly image2D historyIn;
+
+// Largest relative depth mismatch still taken for the same surface
+#define DEPTH_TOLERANCE 0.02
+#define SKY_DISTANCE 1e30
+
+// The previous frame's history where it saw `point`; false when that was
+// off screen or something else covered it (disoccluded).
+bool reprojectHistory(vec3 point, float tolerance, out vec4 history) {
+    vec2 previousUV = projectToScreen(frame.previousCameraPos, frame.previousCameraDir, point);
+    ivec2 previousPixel = ivec2(floor(previousUV * frame.resolution));
+    if (any(lessThan(previousPixel, ivec2(0))) || any(greaterThanEqual(previousPixel, ivec2(frame.resolution)))) return false;
+    history = imageLoad(historyIn, previousPixel);
+    float expected = distance(point, frame.previousCameraPos);
+    return abs(history.a - expected) <= tolerance * expected;
+}
+
+// Pixels traced this frame in checkerboard mode
+bool checkerboardTraced(ivec2 pixel) {
+    return ((pixel.x + pixel.y + int(frame.frameIndex)) & 1) == 0;
+}
@@ -0,0 +1,685 @@
+// Bindings and the tracer shared by the fragment and compute tracing paths,
+// which call tracePixel() once per pixel, and the wavefront kernels, which
+// split the same shading into stages.
+#include "frame_constants.glsl"
+#include "scene_layout.glsl"
+
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+};
+
+struct HitInfo {
+    bool hit;
+    float dist;
+    vec3 point;
+    vec3 normal;
+    vec3 matColor;
+    float reflectivity;
+    uint materialSource; // Where sphere hits leave their material, see resolveMaterial()
+    uint materialIndex;
+};
+
+#define MATERIAL_NONE 0u    // matColor and reflectivity are set directly
+#define MATERIAL_SCENE 1u   // sceneMaterialIds
+#define MATERIAL_CLUSTER 2u // clusterMaterialIds
+
+struct PointLight {
+    vec3 position;
+    float intensity;
+    vec3 color;
+    float padding;
+};
+
+struct SpotLight {
+    vec3 position;
+    float intensity;
+    vec3 direction;
+    float cutOff;
+    vec3 color;
+    float outerCutOff;
+};
+
+// This frame's slot of the renderer's uniform ring, a dynamic offset
+layout(binding = 0) uniform Uniforms {
+    PointLight pointLight;
+    SpotLight spotLight;
+    vec3 sunDirection;
+    float sunEnabled;
+    int sphereCount;   // Valid entries in scene.spheres
+    int wideBvh;       // Trace WideBvhNodes instead of BvhNodes
+    int instanceCount;
+} ubo;
+
+// Sized by the renderer, which grows it with the scene. Center in xyz,
+// radius in w; material indices are in sceneMaterialIds in the same order.
+layout(std430, binding = 1) readonly buffer SceneBuffer {
+    vec4 spheres[];
+} scene;
+
+layout(std430, binding = 11) readonly buffer SceneMaterialIds {
+    uint ids[];
+} sceneMaterialIds;
+
+// Shared by scene and cluster spheres
+layout(std430, binding = 13) readonly buffer Materials {
+    SphereMaterial materials[];
+} materialTable;
+
+// Node layout shared with BvhNode in Bvh.h
+struct BvhNode {
+    vec3 boundsMin;
+    uint left;  // Interior: left child index. Leaf: BVH_LEAF_BIT | first entry in primIndices
+    vec3 boundsMax;
+    uint right; // Interior: right child index. Leaf: number of spheres
+};
+
+layout(std430, binding = 2) readonly buffer BvhNodes {
+    BvhNode nodes[];
+} bvh;
+
+layout(std430, binding = 3) readonly buffer BvhIndices {
+    uint primIndices[];
+} bvhIndices;
+
+// Uniform grid, see SphereGrid in Grid.h. Cell c lists the spheres
+// gridSpheres.cellSpheres[cellStart[c] .. cellStart[c + 1]).
+layout(std430, binding = 4) readonly buffer GridCells {
+    vec3 boundsMin;
+    float cellSize;
+    uvec3 dims;
+    uint enabled; // 0: trace the BVH instead
+    uint cellStart[];
+} grid;
+
+layout(std430, binding = 5) readonly buffer GridSpheres {
+    uint cellSpheres[];
+} gridSpheres;
+
+// Four-wide nodes with quantized child boxes, see WideBvh.h. Leaves index
+// the same primIndices as the binary nodes.
+struct WideBvhNode {
+    vec3 origin;
+    uint exponents; // Biased exponent of the power of two step, byte per axis
+    uvec3 childMin; // Per axis: byte k holds child k's quantized minimum
+    uint counts;    // Byte k: 0 unused, WIDE_BVH_INTERIOR, else leaf sphere count
+    uvec3 childMax;
+    uint padding;
+    uvec4 children; // Interior: node index. Leaf: first entry in primIndices
+};
+
+layout(std430, binding = 10) readonly buffer WideBvhNodes {
+    WideBvhNode nodes[];
+} wideBvh;
+
+#define WIDE_BVH_INTERIOR 0xFFu
+
+// Instanced clusters, see TwoLevelBvh in Instances.h. instanceNodes holds
+// the top level over instance bounds at 0 followed by every cluster's bottom
+// level; bottom-level leaves index clusterSpheres through instancePrims.
+struct Instance {
+    vec3 position;
+    float invScale;
+    vec3 axisX;    // Local axes in world space
+    uint root;     // Bottom-level root in instanceNodes, ~0u for an empty cluster
+    vec3 axisY;
+    float scale;
+    vec3 axisZ;
+    float padding;
+};
+
+layout(std430, binding = 6) readonly buffer InstanceNodes {
+    BvhNode nodes[];
+} instanceNodes;
+
+layout(std430, binding = 7) readonly buffer InstancePrims {
+    uint prims[];
+} instancePrims;
+
+layout(std430, binding = 8) readonly buffer Instances {
+    Instance instances[];
+} instanceData;
+
+layout(std430, binding = 9) readonly buffer ClusterSpheres {
+    vec4 spheres[];
+} clusterSpheres;
+
+layout(std430, binding = 12) readonly buffer ClusterMaterialIds {
+    uint ids[];
+} clusterMaterialIds;
+
+#define BVH_LEAF_BIT 0x80000000u
+#define BVH_STACK_SIZE 64 // Must match Bvh::STACK_SIZE
+
+// Slab test; returns the entry distance or 1e30 on a miss.
+float intersectAabb(vec3 boundsMin, vec3 boundsMax, vec3 origin, vec3 invDir, float tMax) {
+    vec3 t0 = (boundsMin - origin) * invDir;
+    vec3 t1 = (boundsMax - origin) * invDir;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    float tNear = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float tFar = min(min(tmax.x, tmax.y), min(tmax.z, tMax));
+    return tNear <= tFar ? tNear : 1e30;
+}
+
+void intersectSphere(uint index, Ray ray, inout HitInfo closestHit) {
+    vec4 s = scene.spheres[index];
+    vec3 oc = ray.origin - s.xyz;
+    float b = dot(oc, ray.direction);
+    float c = dot(oc, oc) - s.w * s.w;
+    float h = b * b - c;
+
+    if (h > 0.0) {
+        float t = -b - sqrt(h);
+        if (t > 0.001 && t < closestHit.dist) {
+            closestHit.hit = true;
+            closestHit.dist = t;
+            closestHit.point = ray.origin + ray.direction * t;
+            closestHit.normal = normalize(closestHit.point - s.xyz);
+            closestHit.materialSource = MATERIAL_SCENE;
+            closestHit.materialIndex = index;
+        }
+    }
+}
+
+// BVH traversal, near child first
+void traceBvh(Ray ray, vec3 invDir, inout HitInfo closestHit) {
+    uint stack[BVH_STACK_SIZE];
+    int sp = 0;
+    uint current = 0;
+    bool active = intersectAabb(bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax, ray.origin, invDir, closestHit.dist) < 1e30;
+    while (active) {
+        BvhNode node = bvh.nodes[current];
+        if ((node.left & BVH_LEAF_BIT) != 0u) {
+            uint first = node.left & ~BVH_LEAF_BIT;
+            for (uint i = first; i < first + node.right; i++) {
+                intersectSphere(bvhIndices.primIndices[i], ray, closestHit);
+            }
+            if (sp == 0) break;
+            current = stack[--sp];
+            continue;
+        }
+
+        uint nearChild = node.left;
+        uint farChild = node.right;
+        float nearDist = intersectAabb(bvh.nodes[nearChild].boundsMin, bvh.nodes[nearChild].boundsMax, ray.origin, invDir, closestHit.dist);
+        float farDist = intersectAabb(bvh.nodes[farChild].boundsMin, bvh.nodes[farChild].boundsMax, ray.origin, invDir, closestHit.dist);
+        if (farDist < nearDist) {
+            uint tmpChild = nearChild; nearChild = farChild; farChild = tmpChild;
+            float tmpDist = nearDist; nearDist = farDist; farDist = tmpDist;
+        }
+
+        if (nearDist >= 1e30) {
+            if (sp == 0) break;
+            current = stack[--sp];
+        } else {
+            current = nearChild;
+            if (farDist < 1e30 && sp < BVH_STACK_SIZE) stack[sp++] = farChild;
+        }
+    }
+}
+
+vec4 unpackBytes(uint bytes) {
+    return vec4(uvec4(bytes, bytes >> 8, bytes >> 16, bytes >> 24) & 0xFFu);
+}
+
+// Wide BVH traversal: all four child boxes are tested at once, leaves are
+// intersected nearest first and inner nodes pushed farthest first.
+void traceWideBvh(Ray ray, vec3 invDir, inout HitInfo closestHit) {
+    uint stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0u;
+    while (sp > 0) {
+        WideBvhNode node = wideBvh.nodes[stack[--sp]];
+
+        // Bounds are origin + q * step, so the slab distances are affine in q.
+        uvec3 exponents = (uvec3(node.exponents, node.exponents >> 8, node.exponents >> 16) & 0xFFu) << 23;
+        vec3 scale = uintBitsToFloat(exponents) * invDir;
+        vec3 base = (node.origin - ray.origin) * invDir;
+        vec4 t0x = base.x + unpackBytes(node.childMin.x) * scale.x;
+        vec4 t1x = base.x + unpackBytes(node.childMax.x) * scale.x;
+        vec4 t0y = base.y + unpackBytes(node.childMin.y) * scale.y;
+        vec4 t1y = base.y + unpackBytes(node.childMax.y) * scale.y;
+        vec4 t0z = base.z + unpackBytes(node.childMin.z) * scale.z;
+        vec4 t1z = base.z + unpackBytes(node.childMax.z) * scale.z;
+        vec4 tNear = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), vec4(0.0)));
+        vec4 tFar = min(min(max(t0x, t1x), max(t0y, t1y)), min(max(t0z, t1z), vec4(closestHit.dist)));
+
+        uvec4 counts = uvec4(node.counts, node.counts >> 8, node.counts >> 16, node.counts >> 24) & 0xFFu;
+        vec4 entry = mix(vec4(1e30), tNear, lessThanEqual(tNear, tFar));
+        entry = mix(vec4(1e30), entry, notEqual(counts, uvec4(0u)));
+
+        // Insertion sort of the four children by entry distance
+        float dist[4] = float[4](entry.x, entry.y, entry.z, entry.w);
+        uint order[4] = uint[4](0u, 1u, 2u, 3u);
+        for (int i = 1; i < 4; i++) {
+            for (int j = i; j > 0 && dist[j - 1] > dist[j]; j--) {
+                float tmpDist = dist[j]; dist[j] = dist[j - 1]; dist[j - 1] = tmpDist;
+                uint tmpOrder = order[j]; order[j] = order[j - 1]; order[j - 1] = tmpOrder;
+            }
+        }
+
+        for (int i = 0; i < 4; i++) {
+            if (dist[i] >= closestHit.dist) break;
+            uint count = counts[order[i]];
+            if (count == WIDE_BVH_INTERIOR) continue;
+            uint first = node.children[order[i]];
+            for (uint p = first; p < first + count; p++) {
+                intersectSphere(bvhIndices.primIndices[p], ray, closestHit);
+            }
+        }
+        // Farthest pushed first so the nearest is popped next. Should the
+        // stack run out, the farthest children are the ones left out.
+        int inner = 0;
+        for (int i = 0; i < 4; i++) {
+            if (dist[i] < closestHit.dist && counts[order[i]] == WIDE_BVH_INTERIOR) inner++;
+        }
+        int skip = max(inner - (BVH_STACK_SIZE - sp), 0);
+        for (int i = 3; i >= 0; i--) {
+            if (dist[i] >= closestHit.dist || counts[order[i]] != WIDE_BVH_INTERIOR) continue;
+            if (skip > 0) {
+                skip--;
+                continue;
+            }
+            stack[sp++] = node.children[order[i]];
+        }
+    }
+}
+
+// Closest hit on one instance: the ray is moved into the cluster's local
+// space, where distances shrink by the instance scale.
+void traceInstance(Instance inst, Ray ray, inout HitInfo closestHit) {
+    if (inst.root == 0xFFFFFFFFu) return;
+    vec3 q = ray.origin - inst.position;
+    vec3 origin = vec3(dot(inst.axisX, q), dot(inst.axisY, q), dot(inst.axisZ, q)) * inst.invScale;
+    vec3 direction = vec3(dot(inst.axisX, ray.direction), dot(inst.axisY, ray.direction), dot(inst.axisZ, ray.direction));
+    vec3 safeDir = mix(direction, (step(0.0, direction) * 2.0 - 1.0) * 1e-8, lessThan(abs(direction), vec3(1e-8)));
+    vec3 invDir = 1.0 / safeDir;
+
+    float tMax = closestHit.dist * inst.invScale;
+    int hitSphere = -1;
+    uint stack[BVH_STACK_SIZE];
+    int sp = 0;
+    uint current = inst.root;
+    bool active = intersectAabb(instanceNodes.nodes[current].boundsMin, instanceNodes.nodes[current].boundsMax, origin, invDir, tMax) < 1e30;
+    while (active) {
+        BvhNode node = instanceNodes.nodes[current];
+        if ((node.left & BVH_LEAF_BIT) != 0u) {
+            uint first = node.left & ~BVH_LEAF_BIT;
+            for (uint i = first; i < first + node.right; i++) {
+                uint index = instancePrims.prims[i];
+                vec4 s = clusterSpheres.spheres[index];
+                vec3 oc = origin - s.xyz;
+                float b = dot(oc, direction);
+                float c = dot(oc, oc) - s.w * s.w;
+                float h = b * b - c;
+                if (h > 0.0) {
+                    float t = -b - sqrt(h);
+                    if (t > 0.001 && t < tMax) {
+                        tMax = t;
+                        hitSphere = int(index);
+                    }
+                }
+            }
+            if (sp == 0) break;
+            current = stack[--sp];
+            continue;
+        }
+
+        uint nearChild = node.left;
+        uint farChild = node.right;
+        float nearDist = intersectAabb(instanceNodes.nodes[nearChild].boundsMin, instanceNodes.nodes[nearChild].boundsMax, origin, invDir, tMax);
+        float farDist = intersectAabb(instanceNodes.nodes[farChild].boundsMin, instanceNodes.nodes[farChild].boundsMax, origin, invDir, tMax);
+        if (farDist < nearDist) {
+            uint tmpChild = nearChild; nearChild = farChild; farChild = tmpChild;
+            float tmpDist = nearDist; nearDist = farDist; farDist = tmpDist;
+        }
+
+        if (nearDist >= 1e30) {
+            if (sp == 0) break;
+            current = stack[--sp];
+        } else {
+            current = nearChild;
+            if (farDist < 1e30 && sp < BVH_STACK_SIZE) stack[sp++] = farChild;
+        }
+    }
+
+    if (hitSphere >= 0) {
+        vec3 center = clusterSpheres.spheres[hitSphere].xyz;
+        vec3 worldCenter = inst.position + (inst.axisX * center.x + inst.axisY * center.y + inst.axisZ * center.z) * inst.scale;
+        closestHit.hit = true;
+        closestHit.dist = tMax * inst.scale;
+        closestHit.point = ray.origin + ray.direction * closestHit.dist;
+        closestHit.normal = normalize(closestHit.point - worldCenter);
+        closestHit.materialSource = MATERIAL_CLUSTER;
+        closestHit.materialIndex = uint(hitSphere);
+    }
+}
+
+// Top level over instance bounds, near child first
+void traceInstances(Ray ray, vec3 invDir, inout HitInfo closestHit) {
+    uint stack[BVH_STACK_SIZE];
+    int sp = 0;
+    uint current = 0;
+    bool active = intersectAabb(instanceNodes.nodes[0].boundsMin, instanceNodes.nodes[0].boundsMax, ray.origin, invDir, closestHit.dist) < 1e30;
+    while (active) {
+        BvhNode node = instanceNodes.nodes[current];
+        if ((node.left & BVH_LEAF_BIT) != 0u) {
+            uint first = node.left & ~BVH_LEAF_BIT;
+            for (uint i = first; i < first + node.right; i++) {
+                traceInstance(instanceData.instances[instancePrims.prims[i]], ray, closestHit);
+            }
+            if (sp == 0) break;
+            current = stack[--sp];
+            continue;
+        }
+
+        uint nearChild = node.left;
+        uint farChild = node.right;
+        float nearDist = intersectAabb(instanceNodes.nodes[nearChild].boundsMin, instanceNodes.nodes[nearChild].boundsMax, ray.origin, invDir, closestHit.dist);
+        float farDist = intersectAabb(instanceNodes.nodes[farChild].boundsMin, instanceNodes.nodes[farChild].boundsMax, ray.origin, invDir, closestHit.dist);
+        if (farDist < nearDist) {
+            uint tmpChild = nearChild; nearChild = farChild; farChild = tmpChild;
+            float tmpDist = nearDist; nearDist = farDist; farDist = tmpDist;
+        }
+
+        if (nearDist >= 1e30) {
+            if (sp == 0) break;
+            current = stack[--sp];
+        } else {
+            current = nearChild;
+            if (farDist < 1e30 && sp < BVH_STACK_SIZE) stack[sp++] = farChild;
+        }
+    }
+}
+
+// 3D-DDA through the grid, same as SphereGrid::intersect: stops at the first
+// cell whose exit lies beyond the closest hit so far.
+void traceGrid(Ray ray, vec3 invDir, inout HitInfo closestHit) {
+    vec3 boundsMax = grid.boundsMin + vec3(grid.dims) * grid.cellSize;
+    vec3 t0 = (grid.boundsMin - ray.origin) * invDir;
+    vec3 t1 = (boundsMax - ray.origin) * invDir;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    float tNear = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float tFar = min(min(tmax.x, tmax.y), min(tmax.z, closestHit.dist));
+    if (tNear > tFar) return;
+
+    ivec3 dims = ivec3(grid.dims);
+    vec3 start = (ray.origin + ray.direction * tNear - grid.boundsMin) / grid.cellSize;
+    ivec3 cell = clamp(ivec3(start), ivec3(0), dims - 1);
+    ivec3 stepDir = ivec3(greaterThanEqual(ray.direction, vec3(0.0))) * 2 - 1;
+    ivec3 end = mix(ivec3(-1), dims, greaterThanEqual(ray.direction, vec3(0.0)));
+    vec3 boundary = grid.boundsMin + vec3(cell + max(stepDir, ivec3(0))) * grid.cellSize;
+    vec3 tNext = (boundary - ray.origin) * invDir;
+    vec3 tDelta = grid.cellSize * abs(invDir);
+
+    while (true) {
+        uint index = uint((cell.z * dims.y + cell.y) * dims.x + cell.x);
+        for (uint i = grid.cellStart[index]; i < grid.cellStart[index + 1u]; i++) {
+            intersectSphere(gridSpheres.cellSpheres[i], ray, closestHit);
+        }
+
+        int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+        float tExit = tNext[axis];
+        if (closestHit.dist <= tExit || tExit > tFar) break;
+        cell[axis] += stepDir[axis];
+        if (cell[axis] == end[axis]) break;
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+// Sphere hits only record where their material is, so traversal never
+// touches material data; this fetches it once for the closest hit.
+void resolveMaterial(inout HitInfo hit) {
+    if (hit.materialSource == MATERIAL_NONE) return;
+    uint id = hit.materialSource == MATERIAL_SCENE ? sceneMaterialIds.ids[hit.materialIndex] : clusterMaterialIds.ids[hit.materialIndex];
+    SphereMaterial m = materialTable.materials[id];
+    hit.matColor = m.color;
+    hit.reflectivity = 1.0 - m.roughness;
+    hit.materialSource = MATERIAL_NONE;
+}
+
+HitInfo traceScene(Ray ray) {
+    HitInfo closestHit;
+    closestHit.hit = false;
+    closestHit.dist = 1e30;
+    closestHit.reflectivity = 0.0;
+    closestHit.materialSource = MATERIAL_NONE;
+
+    // Check Spheres (grid or BVH)
+    if (ubo.sphereCount > 0) {
+        // Avoid infinities for axis-aligned rays
+        vec3 safeDir = mix(ray.direction, (step(0.0, ray.direction) * 2.0 - 1.0) * 1e-8, lessThan(abs(ray.direction), vec3(1e-8)));
+        vec3 invDir = 1.0 / safeDir;
+        if (grid.enabled != 0u) {
+            traceGrid(ray, invDir, closestHit);
+        } else if (ubo.wideBvh != 0) {
+            traceWideBvh(ray, invDir, closestHit);
+        } else {
+            traceBvh(ray, invDir, closestHit);
+        }
+    }
+
+    // Check instanced clusters
+    if (ubo.instanceCount > 0) {
+        vec3 safeDir = mix(ray.direction, (step(0.0, ray.direction) * 2.0 - 1.0) * 1e-8, lessThan(abs(ray.direction), vec3(1e-8)));
+        traceInstances(ray, 1.0 / safeDir, closestHit);
+    }
+    resolveMaterial(closestHit);
+
+    // Check Point Light (Visual Representation)
+    {
+        vec3 oc = ray.origin - ubo.pointLight.position;
+        float b = dot(oc, ray.direction);
+        float c = dot(oc, oc) - 0.1 * 0.1; // Small radius 0.1
+        float h = b * b - c;
+        if (h > 0.0) {
+            float t = -b - sqrt(h);
+            if (t > 0.001 && t < closestHit.dist) {
+                closestHit.hit = true;
+                closestHit.dist = t;
+                closestHit.point = ray.origin + ray.direction * t;
+                closestHit.normal = normalize(closestHit.point - ubo.pointLight.position);
+                closestHit.matColor = ubo.pointLight.color * 10.0; // Emissive
+                closestHit.reflectivity = 0.0;
+            }
+        }
+    }
+
+    // Check Spot Light (Visual Representation)
+    {
+        vec3 oc = ray.origin - ubo.spotLight.position;
+        float b = dot(oc, ray.direction);
+        float c = dot(oc, oc) - 0.1 * 0.1; // Small radius 0.1
+        float h = b * b - c;
+        if (h > 0.0) {
+            float t = -b - sqrt(h);
+            if (t > 0.001 && t < closestHit.dist) {
+                closestHit.hit = true;
+                closestHit.dist = t;
+                closestHit.point = ray.origin + ray.direction * t;
+                closestHit.normal = normalize(closestHit.point - ubo.spotLight.position);
+                closestHit.matColor = ubo.spotLight.color * 10.0; // Emissive
+                closestHit.reflectivity = 0.0;
+            }
+        }
+    }
+
+    return closestHit;
+}
+
+// Light sizes for soft shadows, which only accumulation averages out
+#define LIGHT_RADIUS 0.3
+#define SUN_ANGLE 0.02 // Radians
+
+// PCG, seeded per pixel and sample by seedRandom()
+uint rngState;
+
+void seedRandom(uvec2 pixel, uint sampleIndex) {
+    rngState = (pixel.y * 8192u + pixel.x) * 747796405u + sampleIndex * 2891336453u;
+}
+
+float random() {
+    rngState = rngState * 747796405u + 2891336453u;
+    uint word = ((rngState >> ((rngState >> 28u) + 4u)) ^ rngState) * 277803737u;
+    return float(((word >> 22u) ^ word) >> 8) / 16777216.0;
+}
+
+vec3 randomDirection() {
+    float z = random() * 2.0 - 1.0;
+    float phi = random() * 6.2831853;
+    return vec3(sqrt(1.0 - z * z) * vec2(cos(phi), sin(phi)), z);
+}
+
+// A point on the light's sphere when accumulating, its center otherwise
+vec3 lightSample(vec3 position) {
+    return frame.accumulate != 0u ? position + randomDirection() * LIGHT_RADIUS : position;
+}
+
+#define FOCAL_LENGTH 1.5 // Image plane distance; it spans [-aspect, aspect] by [-1, 1]
+
+void cameraBasis(vec3 cameraDir, out vec3 forward, out vec3 right, out vec3 up) {
+    forward = normalize(cameraDir);
+    right = normalize(cross(vec3(0.0, 1.0, 0.0), forward));
+    up = cross(forward, right);
+}
+
+// The ray through screenUV, [0, 1] from the top left
+Ray cameraRay(vec3 cameraPos, vec3 cameraDir, vec2 screenUV) {
+    // Correct aspect ratio
+    vec2 uv = screenUV * 2.0 - 1.0;
+    float aspect = frame.resolution.x / frame.resolution.y;
+    vec2 screenCoord = vec2(uv.x * aspect, -uv.y);
+
+    vec3 forward, right, up;
+    cameraBasis(cameraDir, forward, right, up);
+    return Ray(cameraPos, normalize(forward * FOCAL_LENGTH + right * screenCoord.x + up * screenCoord.y));
+}
+
+// Inverse of cameraRay(): where `point` lands on the screen, or a negative
+// UV when it is behind the camera.
+vec2 projectToScreen(vec3 cameraPos, vec3 cameraDir, vec3 point) {
+    vec3 forward, right, up;
+    cameraBasis(cameraDir, forward, right, up);
+    vec3 d = point - cameraPos;
+    float z = dot(d, forward);
+    if (z <= 1e-4) return vec2(-1.0);
+    vec2 screenCoord = FOCAL_LENGTH * vec2(dot(d, right), dot(d, up)) / z;
+    float aspect = frame.resolution.x / frame.resolution.y;
+    return vec2(screenCoord.x / aspect, -screenCoord.y) * 0.5 + 0.5;
+}
+
+#define MAX_BOUNCES 3      // Reflections past the primary hit are MAX_BOUNCES - 1
+#define AMBIENT 0.1
+#define SHADOW_FACTOR 0.1  // What is left of a blocked light
+#define SHADOW_BIAS 0.001  // Offset of secondary rays off the surface
+
+#define LIGHT_SUN 0u
+#define LIGHT_POINT 1u
+#define LIGHT_SPOT 2u
+#define LIGHT_COUNT 3u
+
+// The direction toward the sun for this pixel
+vec3 sunDirection() {
+    vec3 lightDir = normalize(ubo.sunDirection);
+    if (frame.accumulate != 0u) lightDir = normalize(lightDir + randomDirection() * SUN_ANGLE);
+    return lightDir;
+}
+
+// What `light` gives a surface at `point` facing `normal` before shadowing,
+// and the shadow ray that decides it: along `toLight`, blocked by hits
+// closer than `maxDist`. False when it gives nothing, so no ray is needed.
+bool lightContribution(uint light, vec3 point, vec3 normal, vec3 sunDir, out vec3 radiance, out vec3 toLight, out float maxDist) {
+    radiance = vec3(0.0);
+    if (light == LIGHT_SUN) {
+        if (ubo.sunEnabled <= 0.5) return false;
+        toLight = sunDir;
+        maxDist = 1e30;
+        radiance = vec3(max(dot(normal, toLight), 0.0));
+    } else {
+        bool spot = light == LIGHT_SPOT;
+        vec3 lightPos = lightSample(spot ? ubo.spotLight.position : ubo.pointLight.position);
+        toLight = normalize(lightPos - point);
+        maxDist = length(lightPos - point);
+        float attenuation = 1.0 / (1.0 + 0.09 * maxDist + 0.032 * maxDist * maxDist);
+        float diff = max(dot(normal, toLight), 0.0);
+        if (spot) {
+            float theta = dot(toLight, normalize(-ubo.spotLight.direction));
+            float epsilon = ubo.spotLight.cutOff - ubo.spotLight.outerCutOff;
+            float intensity = clamp((theta - ubo.spotLight.outerCutOff) / epsilon, 0.0, 1.0);
+            radiance = ubo.spotLight.color * ubo.spotLight.intensity * diff * attenuation * intensity;
+        } else {
+            radiance = ubo.pointLight.color * ubo.pointLight.intensity * diff * attenuation;
+        }
+    }
+    return any(greaterThan(radiance, vec3(0.0)));
+}
+
+// Light sources themselves cast no shadow.
+bool shadowBlocked(Ray shadowRay, float maxDist) {
+    HitInfo shadowHit = traceScene(shadowRay);
+    return shadowHit.hit && shadowHit.dist < maxDist && length(shadowHit.matColor) <= 2.0;
+}
+
+vec3 skyColor(vec3 direction) {
+    float t = 0.5 * (direction.y + 1.0);
+    return mix(vec3(0.5, 0.7, 1.0), vec3(0.1, 0.1, 0.2), t);
+}
+
+// Linear color along `ray`, whose closest hit is already known
+vec3 shadePath(Ray ray, HitInfo firstHit) {
+    vec3 finalColor = vec3(0.0);
+    vec3 throughput = vec3(1.0);
+
+    vec3 lightDir = sunDirection();
+
+    // Ray Bounce Loop
+    for (int bounce = 0; bounce < MAX_BOUNCES; bounce++) {
+        HitInfo hit = bounce == 0 ? firstHit : traceScene(ray);
+
+        if (hit.hit) {
+            // If it's an emissive object (light source representation), just return color
+            if (length(hit.matColor) > 2.0) {
+                finalColor += hit.matColor * throughput;
+                break;
+            }
+
+            vec3 totalLight = vec3(0.0);
+            // Sun, point light and spot light
+            for (uint light = 0u; light < LIGHT_COUNT; light++) {
+                vec3 radiance, toLight;
+                float maxDist;
+                if (!lightContribution(light, hit.point, hit.normal, lightDir, radiance, toLight, maxDist)) continue;
+                float shadow = shadowBlocked(Ray(hit.point + hit.normal * SHADOW_BIAS, toLight), maxDist) ? SHADOW_FACTOR : 1.0;
+                totalLight += hit.matColor * radiance * shadow;
+            }
+
+            // Add Ambient
+            totalLight += hit.matColor * AMBIENT;
+
+            finalColor += totalLight * throughput * (1.0 - hit.reflectivity);
+            throughput *= hit.reflectivity;
+
+            // Prepare next ray (Reflection)
+            ray.origin = hit.point + hit.normal * SHADOW_BIAS;
+            ray.direction = reflect(ray.direction, hit.normal);
+        } else {
+            finalColor += skyColor(ray.direction) * throughput;
+            break;
+        }
+    }
+
+    return finalColor;
+}
+
+// Linear color of the pixel at `screenUV`, (0, 0) at the top left corner
+// and (1, 1) at the bottom right; see gammaCorrect() for display.
+vec3 tracePixel(vec2 screenUV) {
+    Ray ray = cameraRay(frame.cameraPos, frame.cameraDir, screenUV);
+    return shadePath(ray, traceScene(ray));
+}
+
+vec3 gammaCorrect(vec3 color) {
+    return pow(color, vec3(1.0/2.2));
+}
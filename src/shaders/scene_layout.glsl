@@ -0,0 +1,13 @@
+// Sphere layouts shared by the shaders and Renderer.cpp, which includes this
+// file through SceneLayout.h. Keep it to declarations that are valid in both
+// GLSL and C++. Arrays of these are std430, where both types are 16 bytes.
+//
+// Sphere geometry is a plain vec4 array, center in xyz and radius in w, read
+// for every intersection test. Each sphere's material is a uint index into
+// one shared table of SphereMaterial, in a separate array of the same order
+// and only fetched for the closest hit.
+
+struct SphereMaterial {
+    vec3 color;
+    float roughness;
+};
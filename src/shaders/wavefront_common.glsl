@@ -0,0 +1,80 @@
+// Queues of the wavefront tracer, which runs shadePath() as separate
+// kernels: wavefront_generate, then per bounce wavefront_intersect,
+// wavefront_shade, wavefront_args and wavefront_shadow, and finally
+// wavefront_resolve. A frame is traced in batches of WAVEFRONT_BATCH
+// pixels; path i of the generated queue is pixel frame.batchStart + i in
+// row-major order.
+#include "raytracer_common.glsl"
+
+#define WAVEFRONT_GROUP_SIZE 64 // Must match WAVEFRONT_GROUP_SIZE in Renderer.cpp
+#define WAVEFRONT_BATCH 262144u // Must match WAVEFRONT_BATCH in Renderer.cpp
+
+// A path's next ray. Throughput is a scalar: reflectivity is the only thing
+// that scales it.
+struct PathRay {
+    vec3 origin;
+    uint pixel; // Index in the batch
+    vec3 direction;
+    float throughput;
+};
+
+// Closest hit of the ray in the same queue slot, material resolved;
+// distance is negative for a miss.
+struct PathHit {
+    vec3 normal;
+    float dist;
+    vec3 color;
+    float reflectivity;
+};
+
+// Two queues of WAVEFRONT_BATCH, read and written in turn by the bounces
+layout(std430, binding = 19) buffer PathRays {
+    PathRay rays[];
+} paths;
+
+layout(std430, binding = 20) buffer PathHits {
+    PathHit hits[];
+} pathHits;
+
+// Shadow rays to trace, each a queue slot of the bounce shaded last and a
+// light: slot << 2 | light. The ray itself is rebuilt from the slot's hit.
+layout(std430, binding = 21) buffer ShadowQueue {
+    uint entries[];
+} shadowQueue;
+
+// Linear color gathered by each path, 1 + LIGHT_COUNT slots per pixel of
+// the batch: shading, then the shadowed term of each light, so no two
+// invocations of a stage write the same slot.
+layout(std430, binding = 22) buffer Radiance {
+    vec4 slots[];
+} radiance;
+
+// Queue lengths, and the indirect dispatch arguments wavefront_args
+// derives from them. Matches WavefrontCounters in Renderer.cpp.
+layout(std430, binding = 23) buffer WavefrontCounters {
+    uvec3 intersectArgs;
+    uint rayCount;    // Bounce rays queued by this bounce's shading
+    uvec3 shadowArgs;
+    uint shadowCount; // Shadow rays queued by this bounce's shading
+    uint rayLaunch;   // Rays in the queue being traced
+    uint shadowLaunch;
+} counters;
+
+#define RADIANCE_SLOTS (1u + LIGHT_COUNT)
+
+uint queueBase(uint bounce) {
+    return (bounce & 1u) * WAVEFRONT_BATCH;
+}
+
+// Rebuilds a queued path's hit
+HitInfo pathHit(PathRay ray, PathHit stored) {
+    HitInfo hit;
+    hit.hit = stored.dist >= 0.0;
+    hit.dist = stored.dist;
+    hit.point = ray.origin + ray.direction * stored.dist;
+    hit.normal = stored.normal;
+    hit.matColor = stored.color;
+    hit.reflectivity = stored.reflectivity;
+    hit.materialSource = MATERIAL_NONE;
+    return hit;
+}